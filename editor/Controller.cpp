@@ -8,6 +8,10 @@
 #include "Utils.h"
 
 #include "audio/Player.h"
+#include "audio/Mixdown.h"
+#include "audio/PreviewCache.h"
+#include "audio/Procedural.h"
+#include "audio/Stream.h"
 #include "audio/codecs/Wav.h"
 #include "audio/codecs/AIFF.h"
 #include "audio/codecs/Flac.h"
@@ -15,30 +19,45 @@
 
 #include <QApplication>
 #include <QPluginLoader>
+#include <QSettings>
+
+// how many 10ms blocks player mixes ahead in its own thread, 0 to mix right in audio callback
+const QString c_key_render_ahead = QStringLiteral("audio_render_ahead_blocks");
+// quality of sample rate conversion for audio that isn't 44100Hz: 0 fast, 1 medium, 2 best
+const QString c_key_resampling   = QStringLiteral("audio_resample_quality");
+// how long replaced audio (like previous piano key preview) fades out while new one fades in, 0 to cut
+const QString c_key_crossfade    = QStringLiteral("audio_crossfade_ms");
+// where playback goes: "device", "null", "null-unthrottled", "wav:<file>", see makeSink(). Environment overrides it
+const QString c_key_audio_sink   = QStringLiteral("audio_sink");
+const char   *c_env_audio_sink   = "QTAU_AUDIO_SINK";
 
 
 qtauController::qtauController(QObject *parent) :
-    QObject(parent), player(nullptr), mw(nullptr), activeSession(nullptr)
+    QObject(parent), player(nullptr), mw(nullptr), activeSession(nullptr), mixdown(nullptr),
+    loopStartPulse(0), loopEndPulse(0), metronomeParams(new qtauMixParams()), synth(nullptr),
+    previews(nullptr)
 {
+    metronomeParams->muted = true;
+
     qtauCodecRegistry *cr = qtauCodecRegistry::instance();
     cr->addCodec(new qtauWavCodecFactory ());
     cr->addCodec(new qtauAIFFCodecFactory());
-//    cr->addCodec(new qtauFlacCodecFactory());
-//    cr->addCodec(new qtauOggCodecFactory ());
+    cr->addCodec(new qtauFlacCodecFactory());
+    cr->addCodec(new qtauOggCodecFactory ());
 
     player = new qtmmPlayer();
     player->moveToThread(&audioThread);
 
-    connect(&audioThread, &QThread::started,   player, &qtmmPlayer::threadedInit);
-
-    connect(this, &qtauController::setEffect,  player, &qtmmPlayer::addEffect);
-    connect(this, &qtauController::setTrack,   player, &qtmmPlayer::addTrack);
-    connect(this, &qtauController::playStart,  player, &qtmmPlayer::play);
-    connect(this, &qtauController::playPause,  player, &qtmmPlayer::pause);
-    connect(this, &qtauController::playStop,   player, &qtmmPlayer::stop);
+    QSettings settings("QTau_Devgroup", c_qtau_name);
+    player->setRenderAhead(settings.value(c_key_render_ahead, 0).toInt());
+    player->setResampleQuality(settings.value(c_key_resampling, 1).toInt());
+    player->setCrossfade(settings.value(c_key_crossfade, 30).toInt());
+    player->setSink(qEnvironmentVariableIsSet(c_env_audio_sink) ? QString::fromLocal8Bit(qgetenv(c_env_audio_sink))
+                                                                 : settings.value(c_key_audio_sink, "device").toString());
 
-    connect(this, &qtauController::playerSetVolume, player, &qtmmPlayer::setVolume);
+    connect(&audioThread, &QThread::started,   player, &qtmmPlayer::threadedInit);
 
+    // tracks, effects and transport are passed straight to player, it queues them for audio thread without locking
     connect(player, &qtmmPlayer::playbackEnded, this, &qtauController::onAudioPlaybackEnded);
     connect(player, &qtmmPlayer::tick,          this, &qtauController::onAudioPlaybackTick);
 
@@ -57,11 +76,40 @@ qtauController::~qtauController()
         audioThread.wait();
     }
 
+    delete mixdown;  // interrupts and waits for export thread
+    delete previews; // same for warming, it uses synthLock
+
     delete mw;
 }
 
 //------------------------------------------
 
+const qtauPlayhead* qtauController::getPlayhead() const
+{
+    return &player->getPlayhead();
+}
+
+const qtauLevelMeter* qtauController::getLevels() const
+{
+    return &player->getLevels();
+}
+
+SAudioStats qtauController::getCallbackStats() const
+{
+    return player->getCallbackStats();
+}
+
+SAudioStats qtauController::getMixStats() const
+{
+    return player->getMixStats();
+}
+
+qint64 qtauController::framesToPulses(qint64 frames, int sampleRate) const
+{
+    // inverse of qtauSoundMixer::pulsesToFrames, with the same session tempo seeks and loops use
+    return frames * sessionTempo() * c_midi_ppq / (60 * (qint64)qMax(sampleRate, 1));
+}
+
 bool qtauController::run()
 {
     mw = new MainWindow();
@@ -71,6 +119,8 @@ bool qtauController::run()
     newEmptySession();
     mw->setController(*this, *this->activeSession);
 
+    warmPreviews();
+
     return true;
 }
 
@@ -117,10 +167,45 @@ void qtauController::initSynth(ISynth *s)
 
         vsLog::s("Adding synthesizer " + s->name());
         synths[s->name()] = s;
+
+        if (!synth)
+        {
+            synth    = s;
+            previews = new qtauPreviewCache(synth, synthLock, this); // warmed later, synth has no voicebank yet
+            connect(previews, &qtauPreviewCache::warmed, this, &qtauController::onPreviewsWarmed);
+        }
     }
     else vsLog::d("Synthesizer " + s->name() + " is already registered!");
 }
 
+void qtauController::warmPreviews()
+{
+    if (previews)
+    {
+        bool ready = false;
+        {
+            QMutexLocker l(&synthLock);
+            ready = synth->isVbReady();
+        }
+
+        if (ready) // key previews of piano, for whole range it shows
+        {
+            SNoteSetup ns;
+            previews->clear();
+            previews->warm(ns.baseOctave * 12, (ns.baseOctave + ns.numOctaves) * 12 - 1);
+        }
+        else vsLog::d("Synthesizer " + synth->name() + " has no voicebank, piano previews are rendered on demand");
+    }
+}
+
+void qtauController::onPreviewsWarmed(int rendered, int failed, qint64 msec)
+{
+    if (failed > 0)
+        vsLog::d(QString("%1 piano key previews rendered in %2 ms, %3 failed").arg(rendered).arg(msec).arg(failed));
+    else
+        vsLog::d(QString("%1 piano key previews rendered in %2 ms").arg(rendered).arg(msec));
+}
+
 
 bool qtauController::setupVoicebanks()
 {
@@ -198,37 +283,53 @@ void qtauController::onSaveAudio(QString fileName, bool rewrite)
             return;
         }
 
-        QFile af(fileName);
-
-        if (!af.open(QFile::WriteOnly))
+        if (mixdown)
         {
-            vsLog::e(tr("Could not open file %1 to save audio").arg(fileName));
+            vsLog::e(tr("Previous audio export isn't finished yet, saving %1 cancelled.").arg(fileName));
             return;
         }
 
-        af.reset();
-        qtauAudioCodec *codec = codecForExt(QFileInfo(fileName).suffix(), af, this);
+        // mixed and encoded in its own thread as fast as possible, pcm of tracks is shared (streamed ones are decoded again) and params are copied
+        qtauSession::VocalWaveSetup &v = activeSession->getVocal();
+        qtauSession::MusicWaveSetup &m = activeSession->getMusic();
 
-        if (codec)
-        {
-            // TODO: mixdown of vocal + bgm?
+        mixdown = new qtauMixdown(fileName, this);
+        mixdown->addTrack(v.vocalWave);
 
-            // TODO: copy audio data when file io will be threaded
-            qtauAudioSource *v = activeSession->getVocal().vocalWave;
-            codec->setAudioFormat(v->getAudioFormat());
-            codec->buffer() = v->buffer();
-            codec->saveToDevice();
-            delete codec;
+        if (m.musicWave && m.musicWave->size() > 0)
+            mixdown->addTrack(m.musicWave);
 
-            vsLog::s(tr("Audio saved: ") + fileName);
-        }
-        else vsLog::e(tr("Could not make a codec for ").arg(fileName));
+        connect(mixdown, &qtauMixdown::progress, this, &qtauController::exportProgress);
+        connect(mixdown, &qtauMixdown::done,     this, &qtauController::onMixdownDone);
 
-        af.close();
+        vsLog::i(tr("Exporting audio to ") + fileName);
+        mixdown->start(QThread::LowPriority); // playback shouldn't suffer from it
     }
     else vsLog::e(tr("Trying to save audio from empty session!"));
 }
 
+void qtauController::onMixdownDone(bool success)
+{
+    if (mixdown)
+    {
+        if (success)
+            vsLog::s(tr("Audio saved: ") + mixdown->fileName());
+        else
+            vsLog::e(tr("Audio export to %1 was not finished").arg(mixdown->fileName()));
+
+        mixdown->wait();
+        mixdown->deleteLater();
+        mixdown = nullptr;
+
+        emit exportFinished(success);
+    }
+}
+
+void qtauController::onCancelExport()
+{
+    if (mixdown)
+        mixdown->requestInterruption(); // done() comes after file is removed
+}
 
 void qtauController::onAppMessage(const QString &msg)
 {
@@ -238,20 +339,15 @@ void qtauController::onAppMessage(const QString &msg)
 
 void qtauController::pianoKeyPressed(int keyNum)
 {
-    if (!synths.isEmpty())
+    if (previews)
     {
-        ISynth *s = synths.values().first();
-        ust u;
-        u.tempo = 120;
-        u.notes.append(ust_note(0, "a", 0, 480*3, keyNum)); // 480 pulses * 3 @ 120bpm is 3 notes, 1.5 sec
-        s->setVocals(u);
+        // pre-rendered usually, synthesized here only if warming didn't get to that key yet
+        qtauAudioSource *a = previews->render(keyNum);
 
-        qtauAudioSource *a = new qtauAudioSource();
-
-        if (s->synthesize(*a))
+        if (a) // player gets a copy sharing its pcm, and mixes it along with previous keys that still sound
         {
-            emit setEffect(a, true, true, false);
-            emit playStart();
+            player->addEffect(a, false, true, true);
+            player->play();
         }
     }
 }
@@ -267,24 +363,18 @@ void qtauController::onLoadAudio(QString fileName)
     {
         QFileInfo fi(fileName);
 
-        if (fi.exists() && !fi.isDir() && !fi.suffix().isEmpty())
+        if (fi.exists() && !fi.isDir())
         {
-            QFile f(fileName);
+            // decoded while it's played or drawn, opening reads only its header, and codec is picked by it
+            qtauStreamSource *s = new qtauStreamSource(fileName, false, this);
 
-            if (f.open(QFile::ReadOnly))
+            if (s->isValid())
+                activeSession->setBackgroundAudio(*s);
+            else
             {
-                qtauAudioCodec  *ac = codecForExt(fi.suffix(), f, this);
-                bool cached = ac->cacheAll();
-                f.close();
-
-                if (cached)
-                    activeSession->setBackgroundAudio(*ac);
-                else
-                    vsLog::e("Error caching audio");
-
-                f.close();
+                vsLog::e("Error opening audio");
+                delete s;
             }
-            else vsLog::e("Could not open file " + fileName);
         }
         else vsLog::e("Wrong file name: " + fileName);
     }
@@ -293,33 +383,32 @@ void qtauController::onLoadAudio(QString fileName)
 
 void qtauController::onAudioPlaybackEnded()
 {
-    if (playState.state == Repeating)
-        onRequestStartPlayback();
-    else
-    {
-        playState.state = Stopped;
-        activeSession->setPlaybackState(EAudioPlayback::stopped);
-    }
+    // looping is done by mixer and never ends, so it's only when tracks got replaced or removed
+    playState.state  = Stopped;
+    playState.looped = false;
+    activeSession->setPlaybackState(EAudioPlayback::stopped);
 }
 
 void qtauController::onVolumeChanged(int level)
 {
-    emit playerSetVolume(level);
+    player->setVolume(level);
 }
 
 void qtauController::onRequestSynthesis()
 {
     if (!activeSession->isSessionEmpty())
     {
-        if (!synths.isEmpty())
+        if (synth)
         {
             if (playState.state != Stopped)
             {
-                emit playStop();
+                player->stop();
+                playState.state = Stopped;
                 activeSession->setPlaybackState(EAudioPlayback::stopped);
             }
 
-            ISynth *s = synths.values().first();
+            ISynth *s = synth;
+            QMutexLocker l(&synthLock); // piano previews may be rendering in background
 
             s->setVocals(activeSession->ustRef());
 
@@ -343,13 +432,32 @@ void qtauController::onRequestSynthesis()
 }
 
 void qtauController::onRequestStartPlayback()
+{
+    if (playState.state == Paused)
+    {
+        // tracks are still in player at the same position, just continuing (looping too, if it was)
+        playState.state = playState.looped ? Repeating : Playing;
+        activeSession->setPlaybackState(playState.looped ? EAudioPlayback::repeating : EAudioPlayback::playing);
+        player->play();
+    }
+    else onRequestStartPlaybackAt(0);
+}
+
+// where audio ends on timeline
+inline qint64 durationMS(qtauAudioSource *a)
+{
+    const QAudioFormat &f = a->getAudioFormat();
+    return a->getTimelineStartMS() + a->size() * 1000 / qMax(1, f.bytesPerFrame() * f.sampleRate());
+}
+
+void qtauController::onRequestStartPlaybackAt(qint64 pulse)
 {
     // play only vocal or only audio (depending on what's available), or a mixdown of both
     qtauSession::VocalWaveSetup &v = activeSession->getVocal();
     qtauSession::MusicWaveSetup &m = activeSession->getMusic();
 
-    bool gotVocal = v.vocalWave && !v.vocalWave->buffer().isEmpty();
-    bool gotMusic = m.musicWave && !m.musicWave->buffer().isEmpty();
+    bool gotVocal = v.vocalWave && v.vocalWave->size() > 0; // streamed music has nothing in buffer
+    bool gotMusic = m.musicWave && m.musicWave->size() > 0;
 
     if (gotVocal || gotMusic)
     {
@@ -359,7 +467,7 @@ void qtauController::onRequestStartPlayback()
                 v.vocalWave->open(QIODevice::ReadOnly);
 
             v.vocalWave->reset();
-            emit setTrack(v.vocalWave, true, false, true);
+            player->addTrack(v.vocalWave, true, false, true);
         }
 
         if (gotMusic)
@@ -368,16 +476,29 @@ void qtauController::onRequestStartPlayback()
                 m.musicWave->open(QIODevice::ReadOnly);
 
             m.musicWave->reset();
-            emit setTrack(m.musicWave, false, false, true);
+            player->addTrack(m.musicWave, !gotVocal, false, true);
         }
 
+        // metronome is always played, just muted when it's off - so toggling it is only a flag for mixer
+        qint64 lengthMS = 0;
+
+        if (gotVocal) lengthMS = durationMS(v.vocalWave);
+        if (gotMusic) lengthMS = qMax(durationMS(m.musicWave), lengthMS);
+
+        qtauMetronomeSource *click = new qtauMetronomeSource(sessionTempo(), lengthMS);
+        click->setMixParams(metronomeParams);
+        player->addTrack(click, false, false, false); // player owns it, it'll be released with other tracks
+
         if (playState.state != Repeating)
         {
             playState.state = Playing;
             activeSession->setPlaybackState(EAudioPlayback::playing);
         }
 
-        emit playStart(); // won't do anything if nothing to play
+        // starts exactly at pulse, tracks before it aren't read at all
+        player->seekPulse(pulse, sessionTempo());
+
+        player->play(); // won't do anything if nothing to play
     }
 }
 
@@ -387,28 +508,126 @@ void qtauController::onRequestPausePlayback()
     {
         playState.state = Paused;
         activeSession->setPlaybackState(EAudioPlayback::paused);
-        emit playPause();
+        player->pause();
     }
     else vsLog::e("Controller isn't playing anything, can't pause playback.");
 }
 
 void qtauController::onRequestStopPlayback()
 {
-    playState.state = Stopped;
+    playState.state  = Stopped;
+    playState.looped = false; // mixer drops loop region on stop
     activeSession->setPlaybackState(EAudioPlayback::stopped);
-    emit playStop();
+    player->stop();
 }
 
 void qtauController::onRequestResetPlayback()
 {
-    emit playStop();
-    playState.state = Stopped;
-    onRequestStartPlayback();
+    if (playState.state == Stopped)
+        onRequestStartPlayback();
+    else
+    {
+        // rewinding tracks that are already in player, paused playback stays paused
+        qint64 start = 0, end = 0;
+
+        if (playState.looped && loopPulses(start, end))
+            player->seekPulse(start, sessionTempo());
+        else
+            player->seekFrame(0);
+    }
+}
+
+void qtauController::onMetronome(bool on)
+{
+    metronomeParams->muted = !on;
+}
+
+int qtauController::sessionTempo() const
+{
+    int tempo = activeSession->ustRef().tempo;
+    return tempo > 0 ? tempo : SNoteSetup().tempo;
+}
+
+bool qtauController::loopPulses(qint64 &start, qint64 &end)
+{
+    start = loopStartPulse;
+    end   = loopEndPulse;
+
+    if (end <= start) // whole score, or whole background music if there's no score
+    {
+        start = 0;
+        end   = 0;
+
+        foreach (const ust_note &n, activeSession->ustRef().notes)
+            end = qMax(end, (qint64)n.pulseOffset + n.pulseLength);
+
+        qtauAudioSource *m = activeSession->getMusic().musicWave;
+
+        if (end == 0 && m && m->size() > 0)
+            end = durationMS(m) * sessionTempo() * c_midi_ppq / 60000;
+    }
+
+    return end > start;
 }
 
 void qtauController::onRequestRepeatPlayback()
 {
-    //
+    const int tempo = sessionTempo();
+    qint64 start = 0, end = 0;
+
+    if (playState.looped) // turning it off, playback goes on from where it is
+    {
+        playState.looped = false;
+        player->setLoopPulses(0, 0, tempo);
+
+        if (playState.state == Repeating)
+        {
+            playState.state = Playing;
+            activeSession->setPlaybackState(EAudioPlayback::playing);
+        }
+    }
+    else if (loopPulses(start, end))
+    {
+        // mixer wraps on the exact frame, so nothing is re-copied and there's no gap at loop end
+        playState.looped = true;
+        player->setLoopPulses(start, end, tempo);
+
+        if (playState.state == Stopped)
+        {
+            playState.state = Repeating;
+            activeSession->setPlaybackState(EAudioPlayback::repeating);
+            onRequestStartPlaybackAt(start);
+        }
+        else
+        {
+            if (!player->isInLoop(start, end, tempo))
+                player->seekPulse(start, tempo);
+
+            if (playState.state == Playing)
+            {
+                playState.state = Repeating;
+                activeSession->setPlaybackState(EAudioPlayback::repeating);
+            }
+        }
+    }
+    else vsLog::e(tr("Nothing to repeat, score and background music are empty."));
+}
+
+void qtauController::onLoopRegion(qint64 startPulse, qint64 endPulse)
+{
+    loopStartPulse = startPulse;
+    loopEndPulse   = endPulse;
+
+    qint64 start = 0, end = 0;
+
+    if (playState.looped && loopPulses(start, end))
+    {
+        const int tempo = sessionTempo();
+        player->setLoopPulses(start, end, tempo);
+
+        if (!player->isInLoop(start, end, tempo))
+            player->seekPulse(start, tempo);
+    }
 }
 
 void qtauController::onAudioPlaybackTick(qint64 /*mcsecElapsed*/)
@@ -7,12 +7,20 @@
 #include <QMap>
 #include <QDir>
 #include <QThread>
+#include <QMutex>
+#include <QSharedPointer>
 
 class MainWindow;
 class qtauSynth;
 class qtmmPlayer;
 class qtauAudioSource;
 class qtauSession;
+class qtauMixdown;
+class qtauPlayhead;
+class qtauLevelMeter;
+struct SAudioStats;
+class qtauPreviewCache;
+class qtauMixParams;
 class ISynth;
 
 
@@ -28,15 +36,11 @@ public:
 
     bool run(); // app startup & setup, window creation
 
-signals:
-    void setEffect(qtauAudioSource *e, bool replace, bool smoothly, bool copy);
-    void setTrack (qtauAudioSource *t, bool replace, bool smoothly, bool copy);
-
-    void playStart();
-    void playPause();
-    void playStop();
-
-    void playerSetVolume(int level);
+    const qtauPlayhead*   getPlayhead() const; // lock-free playback position, for GUI to poll
+    const qtauLevelMeter* getLevels()   const; // same for master levels
+    SAudioStats getCallbackStats() const;        // timing of playback since its start, safe to poll
+    SAudioStats getMixStats()      const;
+    qint64 framesToPulses(qint64 frames, int sampleRate) const; // at tempo that mixer places score with
 
 public slots:
     void onAppMessage(const QString& msg);
@@ -52,22 +56,35 @@ public slots:
 
     void onRequestSynthesis();
     void onRequestStartPlayback();
+    void onRequestStartPlaybackAt(qint64 pulse);
     void onRequestPausePlayback();
     void onRequestStopPlayback();
     void onRequestResetPlayback();
-    void onRequestRepeatPlayback();
+    void onRequestRepeatPlayback(); // toggles looping of chosen region, or of whole score
+    void onLoopRegion(qint64 startPulse, qint64 endPulse); // empty region means whole score
+    void onMetronome(bool on); // clicks on beats of score tempo along with played audio
 
     void onVolumeChanged(int);
 
+    void onMixdownDone(bool success);
+    void onCancelExport();
+
     void pianoKeyPressed(int);
     void pianoKeyReleased(int);
 
+    void onPreviewsWarmed(int rendered, int failed, qint64 msec);
+
+signals:
+    void exportProgress(int percent);
+    void exportFinished(bool success);
+
 protected:
     qtmmPlayer *player;
     MainWindow *mw;
 
     QMap<QString, qtauSession*> sessions;
     qtauSession *activeSession;
+    qtauMixdown *mixdown; // audio export in progress
 
     typedef enum {
         Playing = 0,
@@ -80,18 +97,30 @@ protected:
         EPlayerState     state;
         qtauAudioSource *audio;
         qtauSession     *session;
+        bool             looped; // player has a loop region, playback is Repeating (or Paused while repeating)
 
-        _PlayState() : state(Stopped), audio(nullptr), session(nullptr) {}
+        _PlayState() : state(Stopped), audio(nullptr), session(nullptr), looped(false) {}
     } SPlayState;
 
     SPlayState playState;
+    qint64     loopStartPulse;
+    qint64     loopEndPulse;
+
+    QSharedPointer<qtauMixParams> metronomeParams; // shared with each played metronome, mute toggles it
+
+    int  sessionTempo() const;
+    bool loopPulses(qint64 &start, qint64 &end); // false if there's nothing to loop
 
     bool setupTranslations();
     bool setupPlugins();
     bool setupVoicebanks();
 
     void initSynth(ISynth *s);
+    void warmPreviews(); // when synth can render: after window is set up, and after voicebank changes
     QMap<QString, ISynth*> synths;
+    ISynth            *synth;     // first one registered, used for score synthesis and piano previews
+    QMutex             synthLock; // synths aren't thread-safe, previews are rendered in background
+    qtauPreviewCache  *previews;  // of synth
 
     QDir pluginsDir;
 
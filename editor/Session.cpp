@@ -18,6 +18,7 @@ qtauSession::qtauSession(QObject *parent) :
 {
     vocal.vocalWave = new qtauAudioSource(this);
     music.musicWave = new qtauAudioSource(this);
+    mixSetupWasModified();
 
     data.tempo = 120;
 }
@@ -351,6 +352,7 @@ void qtauSession::setSynthesizedVocal(qtauAudioSource &s)
     if (!vocal.vocalWave)
         vocal.vocalWave = &s;
 
+    mixSetupWasModified();
     emit vocalSet();
 }
 
@@ -365,12 +367,35 @@ void qtauSession::setBackgroundAudio(qtauAudioSource &s)
     if (!music.musicWave)
         music.musicWave = &s;
 
+    mixSetupWasModified();
     emit musicSet();
 }
 
 void qtauSession::vocalWaveWasModified() { emit vocalSet(); }
 void qtauSession::musicWaveWasModified() { emit musicSet(); }
 
+void qtauSession::mixSetupWasModified()
+{
+    // player mixes copies of these sources, but they share mixing parameters with originals
+    if (vocal.vocalWave)
+    {
+        QSharedPointer<qtauMixParams> p = vocal.vocalWave->getMixParams();
+        p->gain  = vocal.volume;
+        p->pan   = vocal.pan;
+        p->muted = vocal.muted;
+    }
+
+    if (music.musicWave)
+    {
+        QSharedPointer<qtauMixParams> p = music.musicWave->getMixParams();
+        p->gain  = music.volume;
+        p->pan   = music.pan;
+        p->muted = music.muted;
+
+        music.musicWave->setTimelineStartMS(music.offset); // for next playback start
+    }
+}
+
 void qtauSession::setModified(bool m)
 {
     if (m != isModified)
@@ -51,18 +51,22 @@ public:
         qtauAudioSource *vocalWave;
         bool  needsSynthesis;
         float volume;
+        float pan;   // -1..1
+        bool  muted;
 
-        SVocalWaveSetup() : vocalWave(nullptr), needsSynthesis(true), volume(1.0) {}
+        SVocalWaveSetup() : vocalWave(nullptr), needsSynthesis(true), volume(1.0), pan(0), muted(false) {}
     } VocalWaveSetup;
 
     typedef struct SMusicWaveSetup {
         qtauAudioSource *musicWave;
 
-        qint64 offset;
+        qint64 offset; // ms from start of song to start of music, negative to skip its beginning
         int    tempo;
         float  volume;
+        float  pan;
+        bool   muted;
 
-        SMusicWaveSetup() : musicWave(nullptr), offset(0), tempo(120), volume(1) {}
+        SMusicWaveSetup() : musicWave(nullptr), offset(0), tempo(120), volume(1), pan(0), muted(false) {}
     } MusicWaveSetup;
 
     VocalWaveSetup& getVocal() { return vocal; }
@@ -99,6 +103,8 @@ public slots:
     void vocalWaveWasModified();
     void musicWaveWasModified();
 
+    void mixSetupWasModified(); // volume, pan, mute or offset of vocal/music, applied to playing audio too
+
 protected:
     bool    parseUSTStrings(QStringList ustStrings);
     QString filePath;
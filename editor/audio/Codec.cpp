@@ -5,11 +5,60 @@
 
 
 qtauAudioCodec::qtauAudioCodec(QIODevice &d, QObject *parent) :
-    qtauAudioSource(parent)
+    qtauAudioSource(parent), streamFrames(0), streamFrame(0)
 {
     dev = &d;
 }
 
+bool qtauAudioCodec::beginStream()
+{
+    if (isOpen())
+        close();
+
+    return open(QIODevice::WriteOnly); // truncates buffer
+}
+
+bool qtauAudioCodec::writeStream(const char *pcm, qint64 bytes)
+{
+    return write(pcm, bytes) == bytes;
+}
+
+bool qtauAudioCodec::endStream()
+{
+    close();
+    return saveToDevice();
+}
+
+bool qtauAudioCodec::openStream()
+{
+    bool result = cacheAll();
+
+    streamFrames = result ? size() / qMax(fmt.bytesPerFrame(), 1) : 0;
+    streamFrame  = 0;
+
+    return result;
+}
+
+qint64 qtauAudioCodec::readFrames(char *pcm, qint64 frames)
+{
+    const int    frameBytes = fmt.bytesPerFrame();
+    const qint64 result     = qBound((qint64)0, streamFrames - streamFrame, frames);
+
+    if (result > 0)
+    {
+        memcpy(pcm, data().constData() + streamFrame * frameBytes, result * frameBytes);
+        streamFrame += result;
+    }
+
+    return result;
+}
+
+bool qtauAudioCodec::seekFrame(qint64 frame)
+{
+    streamFrame = qBound((qint64)0, frame, streamFrames);
+    return frame == streamFrame;
+}
+
 //---------------------------------------------------
 
 qtauCodecRegistry::~qtauCodecRegistry()
@@ -48,6 +97,35 @@ qtauAudioCodec* qtauCodecRegistry::getCodecByExt(const QString &ext, QIODevice &
     return result;
 }
 
+qtauAudioCodec* qtauCodecRegistry::getCodecByContent(QIODevice &d, const QString &ext, QObject *parent)
+{
+    qtauAudioCodec        *result = 0;
+    qtauAudioCodecFactory *best   = (!ext.isEmpty() && codecsByExt.contains(ext)) ? codecsByExt[ext] : 0;
+    const QByteArray       head   = d.peek(c_probe_bytes);
+    int bestScore = best ? best->probe(head) : 0;
+
+    foreach (qtauAudioCodecFactory *f, codecsByMime.values())
+    {
+        const int score = f->probe(head);
+
+        if (score > bestScore)
+        {
+            best      = f;
+            bestScore = score;
+        }
+    }
+
+    if (best)
+    {
+        if (!ext.isEmpty() && best->ext() != ext)
+            vsLog::i(QString("Audio with extension %1 is %2").arg(ext).arg(best->desc()));
+
+        result = best->make(d, parent);
+    }
+
+    return result;
+}
+
 bool qtauCodecRegistry::addCodec(qtauAudioCodecFactory *factory, bool replace)
 {
     bool result = false;
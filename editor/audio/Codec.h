@@ -6,16 +6,47 @@
 #include "audio/Source.h"
 #include <QMap>
 
+const int c_probe_bytes = 4096; // from file start, what factories look at to recognize their format
+const int c_probe_sure  = 100;  // score of a header that's surely factory's format
+
 // codec is intermediate between buffered PCM data and some source of encoded audio
 class qtauAudioCodec : public qtauAudioSource
 {
     Q_OBJECT
     friend class qtauAudioCodecFactory;
 
+public:
+    /* Streaming save of PCM in format set by setAudioFormat, for audio that's produced block by block:
+     * beginStream writes whatever goes before audio data, writeStream encodes next frames, endStream finishes file.
+     * Codecs that can't write incrementally keep default versions, which collect PCM in buffer
+     * and call saveToDevice at the end. */
+    virtual bool beginStream();
+    virtual bool writeStream(const char *pcm, qint64 bytes);
+    virtual bool endStream();
+
+    /* Incremental decoding, so that long audio is never in memory whole: openStream reads only what goes before
+     * audio, sets format (always little-endian, as mixer reads it) and frame count, readFrames decodes next
+     * frames to pcm and returns how many there were, 0 at the end. Codecs that can't decode incrementally keep
+     * default versions, which cacheAll and then read from buffer. Device should stay open while decoding. */
+    virtual bool   openStream();
+    virtual qint64 readFrames(char *pcm, qint64 frames);
+    virtual bool   seekFrame(qint64 frame); // next readFrames starts there
+
+    /* PCM that lies in file exactly as mixer reads it, mapped into memory instead of being read: after openStream,
+     * for codecs of uncompressed formats and devices that are files. Empty if that's not possible.
+     * Valid while device stays open, and shouldn't be written to. */
+    virtual QByteArray mapPcm() { return QByteArray(); }
+
+    qint64 frameCount() const { return streamFrames; }
+    qint64 streamPos()  const { return streamFrame;  }
+
 protected:
     QIODevice *dev;
     qtauAudioCodec(QIODevice &d, QObject *parent = 0);
 
+    qint64 streamFrames; // what openStream found
+    qint64 streamFrame;  // next one to decode
+
 };
 
 class qtauAudioCodecFactory
@@ -24,6 +55,9 @@ public:
     virtual qtauAudioCodec* make(QIODevice &d, QObject *parent = 0) = 0;
     virtual ~qtauAudioCodecFactory() {}
 
+    // how sure factory is that audio starting with head (c_probe_bytes or less) is its format, 0 to c_probe_sure
+    virtual int probe(const QByteArray &head) const { Q_UNUSED(head); return 0; }
+
     const QString& ext () const { return _ext;  }
     const QString& mime() const { return _mime; }
     const QString& desc() const { return _desc; }
@@ -51,6 +85,10 @@ public:
     qtauAudioCodec* getCodecByMime(const QString &mime, QIODevice &d, QObject *parent = 0);
     qtauAudioCodec* getCodecByExt (const QString &ext,  QIODevice &d, QObject *parent = 0);
 
+    /* codec of factory that's most sure about first c_probe_bytes of device, which are peeked so its position stays.
+     * Extension only breaks ties, and picks codec if nobody recognizes content. 0 if neither works */
+    qtauAudioCodec* getCodecByContent(QIODevice &d, const QString &ext = "", QObject *parent = 0);
+
     bool addCodec(qtauAudioCodecFactory *factory, bool replace = false);
 
     // utility for load/save dialogs, returns strings in format "description (*.ext)"
@@ -86,4 +124,9 @@ inline qtauAudioCodec* codecForExt(const QString &ext, QIODevice &d, QObject *pa
     return qtauCodecRegistry::instance()->getCodecByExt(ext, d, parent);
 }
 
+inline qtauAudioCodec* codecForContent(QIODevice &d, const QString &ext = "", QObject *parent = 0)
+{
+    return qtauCodecRegistry::instance()->getCodecByContent(d, ext, parent);
+}
+
 #endif // QTAU_AUDIO_FILE_H
@@ -0,0 +1,1016 @@
+/* Kernels.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/Kernels.h"
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+#ifdef QTAU_SSE2
+    #include <emmintrin.h>
+#endif
+
+#ifdef QTAU_SSSE3
+    #include <tmmintrin.h>
+#endif
+
+#ifdef QTAU_AVX2
+    #include <immintrin.h>
+#endif
+
+
+ESampleFormat sampleFormat(const QAudioFormat &f, bool anyByteOrder)
+{
+    ESampleFormat result = ESampleFormat::unknown;
+
+    if (f.byteOrder() == QAudioFormat::LittleEndian || anyByteOrder)
+        switch (f.sampleSize())
+        {
+        case 8:
+            if      (f.sampleType() == QAudioFormat::UnSignedInt) result = ESampleFormat::U8;
+            else if (f.sampleType() == QAudioFormat::SignedInt)   result = ESampleFormat::S8;
+            break;
+        case 16: if (f.sampleType() == QAudioFormat::SignedInt)   result = ESampleFormat::S16; break;
+        case 24: if (f.sampleType() == QAudioFormat::SignedInt)   result = ESampleFormat::S24; break;
+        case 32:
+            if      (f.sampleType() == QAudioFormat::SignedInt) result = ESampleFormat::S32;
+            else if (f.sampleType() == QAudioFormat::Float)     result = ESampleFormat::F32;
+            break;
+        default:
+            break;
+        }
+
+    return result;
+}
+
+int sampleBytes(ESampleFormat f)
+{
+    int result = 0;
+
+    switch (f)
+    {
+    case ESampleFormat::U8:
+    case ESampleFormat::S8:  result = 1; break;
+    case ESampleFormat::S16: result = 2; break;
+    case ESampleFormat::S24: result = 3; break;
+    case ESampleFormat::S32:
+    case ESampleFormat::F32: result = 4; break;
+    default:
+        break;
+    }
+
+    return result;
+}
+
+//----- scalar sample decoders, all give floats in [-1..1) -----------------
+
+static const float c_u8_scale  = 1.f / 128.f;
+static const float c_s16_scale = 1.f / 32768.f;
+static const float c_s24_scale = 1.f / 8388608.f;
+static const float c_s32_scale = 1.f / 2147483648.f;
+
+inline float decodeU8 (const char *p) { return ((int)(quint8)*p - 128) * c_u8_scale; }
+inline float decodeS8 (const char *p) { return (qint8)*p * c_u8_scale; }
+inline float decodeS16(const char *p) { qint16 s; memcpy(&s, p, 2); return s * c_s16_scale; }
+inline float decodeS32(const char *p) { qint32 s; memcpy(&s, p, 4); return s * c_s32_scale; }
+inline float decodeF32(const char *p) { float  s; memcpy(&s, p, 4); return s; }
+
+inline float decodeS24(const char *p)
+{
+    const quint8 *b = reinterpret_cast<const quint8*>(p);
+    qint32 s = (qint32)((quint32)b[0] << 8 | (quint32)b[1] << 16 | (quint32)b[2] << 24) >> 8; // sign extension
+    return s * c_s24_scale;
+}
+
+/* Each loader reads 4 (and 8 with AVX2) frames of mono or stereo data into left and right float vectors.
+ * tail() is how many frames after those 4 should exist because loader reads a bit more than it uses. */
+
+struct SLoadU8
+{
+    static int   size()             { return 1; }
+    static int   tail(int)          { return 0; }
+    static float get(const char *p) { return decodeU8(p); }
+
+#ifdef QTAU_SSE2
+    static void load4(const char *p, int ch, __m128 &l, __m128 &r)
+    {
+        const __m128i zero   = _mm_setzero_si128();
+        const __m128  bias   = _mm_set1_ps(128.f);
+        const __m128  scale  = _mm_set1_ps(c_u8_scale);
+
+        if (ch == 2)
+        {
+            __m128i x = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), zero); // L|R<<16
+            l = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_and_si128(x, _mm_set1_epi32(0xFFFF))), bias), scale);
+            r = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 16)),                    bias), scale);
+        }
+        else
+        {
+            int four;
+            memcpy(&four, p, 4);
+            __m128i x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(four), zero), zero);
+            l = r = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(x), bias), scale);
+        }
+    }
+#endif
+};
+
+struct SLoadS8
+{
+    static int   size()             { return 1; }
+    static int   tail(int)          { return 0; }
+    static float get(const char *p) { return decodeS8(p); }
+
+#ifdef QTAU_SSE2
+    static void load4(const char *p, int ch, __m128 &l, __m128 &r)
+    {
+        quint64 bits = 0;
+        memcpy(&bits, p, 4 * ch);
+        bits ^= Q_UINT64_C(0x8080808080808080); // signed to unsigned, then it's U8
+        SLoadU8::load4(reinterpret_cast<const char*>(&bits), ch, l, r);
+    }
+#endif
+};
+
+struct SLoadS16
+{
+    static int   size()             { return 2; }
+    static int   tail(int)          { return 0; }
+    static float get(const char *p) { return decodeS16(p); }
+
+#ifdef QTAU_SSE2
+    static void load4(const char *p, int ch, __m128 &l, __m128 &r)
+    {
+        const __m128 scale = _mm_set1_ps(c_s16_scale);
+
+        if (ch == 2)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); // each int32 lane is one frame
+            l = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(x, 16), 16)), scale);
+            r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(x, 16)), scale);
+        }
+        else
+        {
+            __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+            l = r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), scale);
+        }
+    }
+#endif
+
+#ifdef QTAU_AVX2
+    static void load8(const char *p, int ch, __m256 &l, __m256 &r)
+    {
+        const __m256 scale = _mm256_set1_ps(c_s16_scale);
+
+        if (ch == 2)
+        {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            l = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16)), scale);
+            r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(x, 16)), scale);
+        }
+        else
+        {
+            __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+            l = r = _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale);
+        }
+    }
+#endif
+};
+
+struct SLoadS24
+{
+    static int   size()             { return 3; }
+    static float get(const char *p) { return decodeS24(p); }
+
+#ifdef QTAU_SSSE3
+    static int   tail(int ch)       { return (ch == 2) ? 1 : 2; } // 16 byte loads of 12 byte groups
+
+    static void load4(const char *p, int ch, __m128 &l, __m128 &r)
+    {
+        const __m128  scale = _mm_set1_ps(c_s24_scale);
+        const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+
+        __m128i a = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), spread), 8);
+
+        if (ch == 2)
+        {
+            __m128i b = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12)), spread), 8);
+            __m128 af = _mm_castsi128_ps(a);
+            __m128 bf = _mm_castsi128_ps(b);
+            l = _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(_mm_shuffle_ps(af, bf, _MM_SHUFFLE(2,0,2,0)))), scale);
+            r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(_mm_shuffle_ps(af, bf, _MM_SHUFFLE(3,1,3,1)))), scale);
+        }
+        else l = r = _mm_mul_ps(_mm_cvtepi32_ps(a), scale);
+    }
+#elif defined(QTAU_SSE2)
+    static int   tail(int)          { return 0; }
+
+    static void load4(const char *p, int ch, __m128 &l, __m128 &r)
+    {
+        if (ch == 2)
+        {
+            l = _mm_setr_ps(decodeS24(p),     decodeS24(p + 6),  decodeS24(p + 12), decodeS24(p + 18));
+            r = _mm_setr_ps(decodeS24(p + 3), decodeS24(p + 9),  decodeS24(p + 15), decodeS24(p + 21));
+        }
+        else l = r = _mm_setr_ps(decodeS24(p), decodeS24(p + 3), decodeS24(p + 6), decodeS24(p + 9));
+    }
+#else
+    static int   tail(int)          { return 0; }
+#endif
+};
+
+struct SLoadS32
+{
+    static int   size()             { return 4; }
+    static int   tail(int)          { return 0; }
+    static float get(const char *p) { return decodeS32(p); }
+
+#ifdef QTAU_SSE2
+    static void load4(const char *p, int ch, __m128 &l, __m128 &r)
+    {
+        const __m128 scale = _mm_set1_ps(c_s32_scale);
+        __m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(p)); // just bits, converted after shuffle
+
+        if (ch == 2)
+        {
+            __m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(p + 16));
+            l = _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)))), scale);
+            r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)))), scale);
+        }
+        else l = r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(a)), scale);
+    }
+#endif
+};
+
+struct SLoadF32
+{
+    static int   size()             { return 4; }
+    static int   tail(int)          { return 0; }
+    static float get(const char *p) { return decodeF32(p); }
+
+#ifdef QTAU_SSE2
+    static void load4(const char *p, int ch, __m128 &l, __m128 &r)
+    {
+        __m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(p));
+
+        if (ch == 2)
+        {
+            __m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(p + 16));
+            l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+            r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+        }
+        else l = r = a;
+    }
+#endif
+
+#ifdef QTAU_AVX2
+    static void load8(const char *p, int ch, __m256 &l, __m256 &r)
+    {
+        __m256 a = _mm256_loadu_ps(reinterpret_cast<const float*>(p));
+
+        if (ch == 2)
+        {
+            __m256 b = _mm256_loadu_ps(reinterpret_cast<const float*>(p + 32));
+            // in-lane shuffles give L0 L1 L4 L5 | L2 L3 L6 L7, 64-bit permute puts them in order
+            l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0))), _MM_SHUFFLE(3,1,2,0)));
+            r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1))), _MM_SHUFFLE(3,1,2,0)));
+        }
+        else l = r = a;
+    }
+#endif
+};
+
+#ifdef QTAU_AVX2
+// formats without a native 8-frame loader use two 4-frame ones
+template<class L> struct SLoad8
+{
+    static void load8(const char *p, int ch, __m256 &l, __m256 &r)
+    {
+        __m128 l0, r0, l1, r1;
+        L::load4(p,                          ch, l0, r0);
+        L::load4(p + 4 * ch * L::size(),     ch, l1, r1);
+        l = _mm256_insertf128_ps(_mm256_castps128_ps256(l0), l1, 1);
+        r = _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r1, 1);
+    }
+};
+
+template<class L> struct SWide : public SLoad8<L>, public L {
+    using SLoad8<L>::load8;
+};
+template<> struct SWide<SLoadS16> : public SLoadS16 {};
+template<> struct SWide<SLoadF32> : public SLoadF32 {};
+#endif
+
+
+// levels of a block are added to what was measured before
+inline void addLevels(SBlockLevels *lv, float peakL, float peakR, float sumSqL, float sumSqR, int frames)
+{
+    lv->peakL   = std::max(lv->peakL, peakL);
+    lv->peakR   = std::max(lv->peakR, peakR);
+    lv->sumSqL += sumSqL;
+    lv->sumSqR += sumSqR;
+    lv->frames += frames;
+}
+
+#ifdef QTAU_SSE2
+inline float hmax(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_max_ss(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1,1,1,1))));
+}
+
+inline float hsum(__m128 x)
+{
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_add_ss(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1,1,1,1))));
+}
+
+// peak and sum of squares of 4 samples, added to accumulators
+inline void meter4(__m128 x, __m128 &peak, __m128 &sumSq)
+{
+    peak  = _mm_max_ps(peak, _mm_andnot_ps(_mm_set1_ps(-0.f), x));
+    sumSq = _mm_add_ps(sumSq, _mm_mul_ps(x, x));
+}
+#endif
+
+template<class L, bool Ramp, bool Meter>
+void mixToBusT(const char *src, int channels, int frames, float *busL, float *busR, const SGainRamp &g,
+               SBlockLevels *lv)
+{
+    const int stride = channels * L::size();
+    const float stepL = Ramp ? (g.toL - g.fromL) / frames : 0.f;
+    const float stepR = Ramp ? (g.toR - g.fromR) / frames : 0.f;
+    float peakL = 0, peakR = 0, sumSqL = 0, sumSqR = 0;
+    int i = 0;
+
+#ifdef QTAU_SSE2
+    if (channels <= 2)
+    {
+        const int vecEnd = frames - L::tail(channels);
+        __m128 pkL = _mm_setzero_ps(), pkR = pkL, sqL = pkL, sqR = pkL;
+
+    #ifdef QTAU_AVX2
+        __m256 gL8 = _mm256_setzero_ps(), gR8 = gL8, dL8 = gL8, dR8 = gL8;
+        __m256 pkL8 = gL8, pkR8 = gL8, sqL8 = gL8, sqR8 = gL8;
+        const __m256 absMask8 = _mm256_set1_ps(-0.f);
+
+        if (Ramp)
+        {
+            const __m256 n = _mm256_setr_ps(1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f);
+            gL8 = _mm256_add_ps(_mm256_set1_ps(g.fromL), _mm256_mul_ps(_mm256_set1_ps(stepL), n));
+            gR8 = _mm256_add_ps(_mm256_set1_ps(g.fromR), _mm256_mul_ps(_mm256_set1_ps(stepR), n));
+            dL8 = _mm256_set1_ps(stepL * 8);
+            dR8 = _mm256_set1_ps(stepR * 8);
+        }
+
+        for (; i + 8 <= vecEnd; i += 8)
+        {
+            __m256 l, r;
+            SWide<L>::load8(src + i * stride, channels, l, r);
+
+            if (Ramp)
+            {
+                l = _mm256_mul_ps(l, gL8);
+                r = _mm256_mul_ps(r, gR8);
+                gL8 = _mm256_add_ps(gL8, dL8);
+                gR8 = _mm256_add_ps(gR8, dR8);
+            }
+
+            if (Meter)
+            {
+                pkL8 = _mm256_max_ps(pkL8, _mm256_andnot_ps(absMask8, l));
+                pkR8 = _mm256_max_ps(pkR8, _mm256_andnot_ps(absMask8, r));
+                sqL8 = _mm256_add_ps(sqL8, _mm256_mul_ps(l, l));
+                sqR8 = _mm256_add_ps(sqR8, _mm256_mul_ps(r, r));
+            }
+
+            _mm256_storeu_ps(busL + i, _mm256_add_ps(_mm256_loadu_ps(busL + i), l));
+            _mm256_storeu_ps(busR + i, _mm256_add_ps(_mm256_loadu_ps(busR + i), r));
+        }
+
+        if (Meter) // halves of wide accumulators go on in narrow ones
+        {
+            pkL = _mm_max_ps(_mm256_castps256_ps128(pkL8), _mm256_extractf128_ps(pkL8, 1));
+            pkR = _mm_max_ps(_mm256_castps256_ps128(pkR8), _mm256_extractf128_ps(pkR8, 1));
+            sqL = _mm_add_ps(_mm256_castps256_ps128(sqL8), _mm256_extractf128_ps(sqL8, 1));
+            sqR = _mm_add_ps(_mm256_castps256_ps128(sqR8), _mm256_extractf128_ps(sqR8, 1));
+        }
+    #endif
+
+        __m128 gL = _mm_setzero_ps(), gR = gL, dL = gL, dR = gL;
+
+        if (Ramp) // continuing from where wider loop stopped
+        {
+            const __m128 n = _mm_setr_ps(i + 1.f, i + 2.f, i + 3.f, i + 4.f);
+            gL = _mm_add_ps(_mm_set1_ps(g.fromL), _mm_mul_ps(_mm_set1_ps(stepL), n));
+            gR = _mm_add_ps(_mm_set1_ps(g.fromR), _mm_mul_ps(_mm_set1_ps(stepR), n));
+            dL = _mm_set1_ps(stepL * 4);
+            dR = _mm_set1_ps(stepR * 4);
+        }
+
+        for (; i + 4 <= vecEnd; i += 4)
+        {
+            __m128 l, r;
+            L::load4(src + i * stride, channels, l, r);
+
+            if (Ramp)
+            {
+                l = _mm_mul_ps(l, gL);
+                r = _mm_mul_ps(r, gR);
+                gL = _mm_add_ps(gL, dL);
+                gR = _mm_add_ps(gR, dR);
+            }
+
+            if (Meter)
+            {
+                meter4(l, pkL, sqL);
+                meter4(r, pkR, sqR);
+            }
+
+            _mm_storeu_ps(busL + i, _mm_add_ps(_mm_loadu_ps(busL + i), l));
+            _mm_storeu_ps(busR + i, _mm_add_ps(_mm_loadu_ps(busR + i), r));
+        }
+
+        if (Meter)
+        {
+            peakL  = hmax(pkL);
+            peakR  = hmax(pkR);
+            sumSqL = hsum(sqL);
+            sumSqR = hsum(sqR);
+        }
+    }
+#endif
+
+    const int rOff = (channels > 1) ? L::size() : 0;
+
+    for (; i < frames; ++i)
+    {
+        const char *p = src + i * stride;
+        float l = L::get(p);
+        float r = L::get(p + rOff);
+
+        if (Ramp)
+        {
+            l *= g.fromL + stepL * (i + 1);
+            r *= g.fromR + stepR * (i + 1);
+        }
+
+        if (Meter)
+        {
+            peakL = std::max(peakL, std::fabs(l));
+            peakR = std::max(peakR, std::fabs(r));
+            sumSqL += l * l;
+            sumSqR += r * r;
+        }
+
+        busL[i] += l;
+        busR[i] += r;
+    }
+
+    if (Meter)
+        addLevels(lv, peakL, peakR, sumSqL, sumSqR, frames);
+}
+
+template<class L> inline void mixToBusG(const char *src, int channels, int frames, float *busL, float *busR,
+                                        const SGainRamp &g, SBlockLevels *lv)
+{
+    if (lv)
+    {
+        if (g.isUnity()) mixToBusT<L, false, true>(src, channels, frames, busL, busR, g, lv);
+        else             mixToBusT<L, true,  true>(src, channels, frames, busL, busR, g, lv);
+    }
+    else
+    {
+        if (g.isUnity()) mixToBusT<L, false, false>(src, channels, frames, busL, busR, g, lv);
+        else             mixToBusT<L, true,  false>(src, channels, frames, busL, busR, g, lv);
+    }
+}
+
+void mixToBus(ESampleFormat f, const char *src, int channels, int frames, float *busL, float *busR,
+              const SGainRamp &g, SBlockLevels *levels)
+{
+    if (frames <= 0 || channels <= 0)
+        return;
+
+    switch (f)
+    {
+    case ESampleFormat::U8:  mixToBusG<SLoadU8> (src, channels, frames, busL, busR, g, levels); break;
+    case ESampleFormat::S16: mixToBusG<SLoadS16>(src, channels, frames, busL, busR, g, levels); break;
+    case ESampleFormat::S24: mixToBusG<SLoadS24>(src, channels, frames, busL, busR, g, levels); break;
+    case ESampleFormat::S32: mixToBusG<SLoadS32>(src, channels, frames, busL, busR, g, levels); break;
+    case ESampleFormat::F32: mixToBusG<SLoadF32>(src, channels, frames, busL, busR, g, levels); break;
+    case ESampleFormat::S8:  mixToBusG<SLoadS8> (src, channels, frames, busL, busR, g, levels); break;
+    default:
+        break;
+    }
+}
+
+//----- bus to device format ------------------------------------------------
+
+/* Storers are the opposite of loaders, with same power of two scales, rounding to nearest and saturation.
+ * Floats are stored as is, without clipping. */
+
+#ifdef QTAU_SSE2
+inline __m128i quantize4(__m128 v, float scale, float maxValue)
+{
+    v = _mm_max_ps(_mm_min_ps(v, _mm_set1_ps(maxValue)), _mm_set1_ps(-1.f));
+    return _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(scale)));
+}
+#endif
+
+// same steps as in quantize4, so that vector and scalar tails give identical results
+inline int quantize(float v, float scale, float maxValue, int maxInt)
+{
+    return qMin((int)std::lrint(qBound(-1.f, v, maxValue) * scale), maxInt);
+}
+
+struct SStoreU8
+{
+    static int  size()                { return 1; }
+    static void put(float v, char *p) { *p = (char)(quint8)(quantize(v, 128.f, 1.f, 127) + 128); }
+
+#ifdef QTAU_SSE2
+    static void store4(__m128 v, char *p)
+    {
+        __m128i x = _mm_add_epi32(quantize4(v, 128.f, 1.f), _mm_set1_epi32(128));
+        x = _mm_packs_epi32(x, x);
+        int four = _mm_cvtsi128_si32(_mm_packus_epi16(x, x)); // saturates 256 to 255
+        memcpy(p, &four, 4);
+    }
+#endif
+};
+
+struct SStoreS8
+{
+    static int  size()                { return 1; }
+    static void put(float v, char *p) { *p = (char)(qint8)quantize(v, 128.f, 1.f, 127); }
+
+#ifdef QTAU_SSE2
+    static void store4(__m128 v, char *p)
+    {
+        __m128i x = quantize4(v, 128.f, 1.f);
+        x = _mm_packs_epi32(x, x);
+        int four = _mm_cvtsi128_si32(_mm_packs_epi16(x, x));
+        memcpy(p, &four, 4);
+    }
+#endif
+};
+
+struct SStoreS16
+{
+    static int  size()                { return 2; }
+    static void put(float v, char *p) { qint16 s = (qint16)quantize(v, 32768.f, 1.f, 32767); memcpy(p, &s, 2); }
+
+#ifdef QTAU_SSE2
+    static void store4(__m128 v, char *p)
+    {
+        __m128i x = quantize4(v, 32768.f, 1.f);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(x, x));
+    }
+#endif
+};
+
+static const float c_s24_max = 8388607.f / 8388608.f; // both exact in float
+static const float c_s32_max = 1.f - 1.f / 16777216.f; // biggest float below 1, 2147483520 after scaling
+
+struct SStoreS24
+{
+    static int  size() { return 3; }
+
+    static void put(float v, char *p)
+    {
+        qint32 s = quantize(v, 8388608.f, c_s24_max, 8388607);
+        p[0] = (char)(s & 0xFF);
+        p[1] = (char)((s >> 8) & 0xFF);
+        p[2] = (char)((s >> 16) & 0xFF);
+    }
+
+#ifdef QTAU_SSE2
+    static void store4(__m128 v, char *p)
+    {
+        __m128i x = quantize4(v, 8388608.f, c_s24_max);
+    #ifdef QTAU_SSSE3
+        x = _mm_shuffle_epi8(x, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), x);
+        int last = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+        memcpy(p + 8, &last, 4);
+    #else
+        qint32 s[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(s), x);
+
+        for (int k = 0; k < 4; ++k)
+        {
+            p[k * 3]     = (char)(s[k] & 0xFF);
+            p[k * 3 + 1] = (char)((s[k] >> 8) & 0xFF);
+            p[k * 3 + 2] = (char)((s[k] >> 16) & 0xFF);
+        }
+    #endif
+    }
+#endif
+};
+
+struct SStoreS32
+{
+    static int  size() { return 4; }
+
+    static void put(float v, char *p)
+    {
+        qint32 s = quantize(v, 2147483648.f, c_s32_max, 2147483647);
+        memcpy(p, &s, 4);
+    }
+
+#ifdef QTAU_SSE2
+    static void store4(__m128 v, char *p)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), quantize4(v, 2147483648.f, c_s32_max));
+    }
+#endif
+};
+
+struct SStoreF32
+{
+    static int  size()                { return 4; }
+    static void put(float v, char *p) { memcpy(p, &v, 4); }
+
+#ifdef QTAU_SSE2
+    static void store4(__m128 v, char *p) { _mm_storeu_ps(reinterpret_cast<float*>(p), v); }
+#endif
+};
+
+inline float clip(float v) { return (v > 1.f) ? 1.f : ((v < -1.f) ? -1.f : v); }
+
+// integers go through storers, same as in converter, so pcm mixed at unity gain comes out unchanged
+inline void encodeF32(float v, char *p) { v = clip(v); memcpy(p, &v, 4); }
+
+typedef void (*encodeFunc)(float, char*);
+
+bool busToPcm(const float *busL, const float *busR, int frames, ESampleFormat f, int channels, char *dst,
+              float gain, SBlockLevels *levels)
+{
+    if (channels < 1 || channels > 2)
+        return false;
+
+    const bool meter = levels != nullptr; // same for whole block, branches on it are always predicted
+    float peakL = 0, peakR = 0, sumSqL = 0, sumSqR = 0;
+    int i = 0;
+
+#ifdef QTAU_SSE2
+    const __m128 vMax = _mm_set1_ps( 1.f);
+    const __m128 vMin = _mm_set1_ps(-1.f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 vGain = _mm_set1_ps(gain);
+    __m128 pkL = _mm_setzero_ps(), pkR = pkL, sqL = pkL, sqR = pkL;
+
+    if (f == ESampleFormat::S16)
+    {
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 l = _mm_mul_ps(_mm_loadu_ps(busL + i), vGain);
+            __m128 r = _mm_mul_ps(_mm_loadu_ps(busR + i), vGain);
+
+            if (meter)
+            {
+                meter4(l, pkL, sqL);
+                meter4(r, pkR, sqR);
+            }
+
+            if (channels == 2)
+            {
+                __m128i li = quantize4(l, 32768.f, 1.f);
+                __m128i ri = quantize4(r, 32768.f, 1.f);
+                __m128i lr = _mm_packs_epi32(_mm_unpacklo_epi32(li, ri), _mm_unpackhi_epi32(li, ri));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), lr);
+            }
+            else
+            {
+                __m128  m  = _mm_mul_ps(_mm_add_ps(l, r), half); // already with gain
+                __m128i mi = quantize4(m, 32768.f, 1.f);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i * 2), _mm_packs_epi32(mi, mi));
+            }
+        }
+    }
+    else if (f == ESampleFormat::F32)
+    {
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 l = _mm_mul_ps(_mm_loadu_ps(busL + i), vGain);
+            __m128 r = _mm_mul_ps(_mm_loadu_ps(busR + i), vGain);
+
+            if (meter)
+            {
+                meter4(l, pkL, sqL);
+                meter4(r, pkR, sqR);
+            }
+
+            if (channels == 2)
+            {
+                l = _mm_max_ps(_mm_min_ps(l, vMax), vMin);
+                r = _mm_max_ps(_mm_min_ps(r, vMax), vMin);
+                _mm_storeu_ps(reinterpret_cast<float*>(dst + i * 8),      _mm_unpacklo_ps(l, r));
+                _mm_storeu_ps(reinterpret_cast<float*>(dst + i * 8 + 16), _mm_unpackhi_ps(l, r));
+            }
+            else
+            {
+                __m128 m = _mm_mul_ps(_mm_add_ps(l, r), half);
+                _mm_storeu_ps(reinterpret_cast<float*>(dst + i * 4), _mm_max_ps(_mm_min_ps(m, vMax), vMin));
+            }
+        }
+    }
+
+    if (meter)
+    {
+        peakL  = hmax(pkL);
+        peakR  = hmax(pkR);
+        sumSqL = hsum(sqL);
+        sumSqR = hsum(sqR);
+    }
+#endif
+
+    encodeFunc enc = nullptr;
+
+    switch (f)
+    {
+    case ESampleFormat::U8:  enc = SStoreU8 ::put; break;
+    case ESampleFormat::S16: enc = SStoreS16::put; break;
+    case ESampleFormat::S24: enc = SStoreS24::put; break;
+    case ESampleFormat::S32: enc = SStoreS32::put; break;
+    case ESampleFormat::F32: enc = encodeF32;      break;
+    default:
+        return false;
+    }
+
+    const int ss = sampleBytes(f);
+
+    if (meter) // tail that vector loops didn't take, or whole block without them
+    {
+        for (int k = i; k < frames; ++k)
+        {
+            const float l = busL[k] * gain;
+            const float r = busR[k] * gain;
+            peakL = std::max(peakL, std::fabs(l));
+            peakR = std::max(peakR, std::fabs(r));
+            sumSqL += l * l;
+            sumSqR += r * r;
+        }
+
+        addLevels(levels, peakL, peakR, sumSqL, sumSqR, frames);
+    }
+
+    if (channels == 2)
+        for (; i < frames; ++i)
+        {
+            enc(busL[i] * gain, dst + i * ss * 2);
+            enc(busR[i] * gain, dst + i * ss * 2 + ss);
+        }
+    else
+        for (; i < frames; ++i)
+            enc((busL[i] * gain + busR[i] * gain) * 0.5f, dst + i * ss); // same steps as vector loop
+
+    return true;
+}
+
+//----- format conversion ---------------------------------------------------
+
+static const int c_convert_chunk = 1024; // samples, conversion goes through float buffers of this size on stack
+
+// reverses bytes of each sample in place
+static void swapSamples(char *p, int samples, int bytes)
+{
+    int i = 0;
+
+    switch (bytes)
+    {
+    case 2:
+#ifdef QTAU_SSE2
+        for (; i + 8 <= samples; i += 8)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i * 2), _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+        }
+#endif
+        for (; i < samples; ++i)
+            std::swap(p[i * 2], p[i * 2 + 1]);
+        break;
+
+    case 3:
+#ifdef QTAU_SSSE3
+    {
+        // 5 samples per 16 byte load, last byte is written back unchanged
+        const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+
+        for (; i + 6 <= samples; i += 5)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i * 3), _mm_shuffle_epi8(x, mask));
+        }
+    }
+#endif
+        for (; i < samples; ++i)
+            std::swap(p[i * 3], p[i * 3 + 2]);
+        break;
+
+    case 4:
+#ifdef QTAU_SSSE3
+    {
+        const __m128i mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+        for (; i + 4 <= samples; i += 4)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i * 4), _mm_shuffle_epi8(x, mask));
+        }
+    }
+#elif defined(QTAU_SSE2)
+        for (; i + 4 <= samples; i += 4)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 4));
+            x = _mm_or_si128(_mm_slli_epi16(x, 8),  _mm_srli_epi16(x, 8));  // swap bytes in halves
+            x = _mm_or_si128(_mm_slli_epi32(x, 16), _mm_srli_epi32(x, 16)); // and halves
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i * 4), x);
+        }
+#endif
+        for (; i < samples; ++i)
+        {
+            std::swap(p[i * 4],     p[i * 4 + 3]);
+            std::swap(p[i * 4 + 1], p[i * 4 + 2]);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// any PCM samples to floats, channels don't matter here
+template<class L> void decodeFlat(const char *src, int samples, float *out)
+{
+    int i = 0;
+
+#ifdef QTAU_SSE2
+    const int vecEnd = samples - L::tail(1);
+    __m128 l, r;
+
+    #ifdef QTAU_AVX2
+    for (; i + 8 <= vecEnd; i += 8)
+    {
+        __m256 l8, r8;
+        SWide<L>::load8(src + i * L::size(), 1, l8, r8);
+        _mm256_storeu_ps(out + i, l8);
+    }
+    #endif
+
+    for (; i + 4 <= vecEnd; i += 4)
+    {
+        L::load4(src + i * L::size(), 1, l, r);
+        _mm_storeu_ps(out + i, l);
+    }
+#endif
+
+    for (; i < samples; ++i)
+        out[i] = L::get(src + i * L::size());
+}
+
+template<class S> void encodeFlat(const float *in, int samples, char *dst)
+{
+    int i = 0;
+
+#ifdef QTAU_SSE2
+    for (; i + 4 <= samples; i += 4)
+        S::store4(_mm_loadu_ps(in + i), dst + i * S::size());
+#endif
+
+    for (; i < samples; ++i)
+        S::put(in[i], dst + i * S::size());
+}
+
+static void monoToStereo(const float *in, int frames, float *out)
+{
+    int i = 0;
+
+#ifdef QTAU_SSE2
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 m = _mm_loadu_ps(in + i);
+        _mm_storeu_ps(out + i * 2,     _mm_unpacklo_ps(m, m));
+        _mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(m, m));
+    }
+#endif
+
+    for (; i < frames; ++i)
+        out[i * 2] = out[i * 2 + 1] = in[i];
+}
+
+static void stereoToMono(const float *in, int frames, float *out)
+{
+    int i = 0;
+
+#ifdef QTAU_SSE2
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 a = _mm_loadu_ps(in + i * 2);
+        __m128 b = _mm_loadu_ps(in + i * 2 + 4);
+        __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+        __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(l, r), half));
+    }
+#endif
+
+    for (; i < frames; ++i)
+        out[i] = (in[i * 2] + in[i * 2 + 1]) * 0.5f;
+}
+
+// one entry of conversion table, everything that can be known at compile time is a template parameter
+template<class L, bool SwapIn, class S, bool SwapOut, EChannelMap M>
+void convertT(const char *src, char *dst, int channels, int frames)
+{
+    const int inCh  = (M == EChannelMap::same) ? channels : ((M == EChannelMap::monoToStereo) ? 1 : 2);
+    const int outCh = (M == EChannelMap::same) ? channels : ((M == EChannelMap::monoToStereo) ? 2 : 1);
+    const int chunk = c_convert_chunk / qMax(inCh, outCh); // frames
+
+    float a[c_convert_chunk];
+    float b[c_convert_chunk];
+    char  swapped[c_convert_chunk * 4];
+
+    for (int done = 0; done < frames; )
+    {
+        const int n = qMin(chunk, frames - done);
+        const char *in  = src + done * inCh  * L::size();
+        char       *out = dst + done * outCh * S::size();
+
+        if (SwapIn && L::size() > 1)
+        {
+            memcpy(swapped, in, n * inCh * L::size());
+            swapSamples(swapped, n * inCh, L::size());
+            in = swapped;
+        }
+
+        decodeFlat<L>(in, n * inCh, a);
+
+        const float *f = a;
+
+        if (M == EChannelMap::monoToStereo) { monoToStereo(a, n, b); f = b; }
+        if (M == EChannelMap::stereoToMono) { stereoToMono(a, n, b); f = b; }
+
+        encodeFlat<S>(f, n * outCh, out);
+
+        if (SwapOut && S::size() > 1)
+            swapSamples(out, n * outCh, S::size());
+
+        done += n;
+    }
+}
+
+typedef void (*convertFunc)(const char*, char*, int, int);
+
+// [src format][src swapped][dst format][dst swapped][channel map], formats in order of ESampleFormat
+#define QTAU_CONV_MAPS(L, SI, S, SO) { &convertT<L, SI, S, SO, EChannelMap::same>,         \
+                                       &convertT<L, SI, S, SO, EChannelMap::monoToStereo>, \
+                                       &convertT<L, SI, S, SO, EChannelMap::stereoToMono> }
+#define QTAU_CONV_DST(L, SI, S) { QTAU_CONV_MAPS(L, SI, S, false), QTAU_CONV_MAPS(L, SI, S, true) }
+#define QTAU_CONV_DSTS(L, SI)   { QTAU_CONV_DST(L, SI, SStoreU8),  QTAU_CONV_DST(L, SI, SStoreS16), \
+                                  QTAU_CONV_DST(L, SI, SStoreS24), QTAU_CONV_DST(L, SI, SStoreS32), \
+                                  QTAU_CONV_DST(L, SI, SStoreF32), QTAU_CONV_DST(L, SI, SStoreS8) }
+#define QTAU_CONV_SRC(L)        { QTAU_CONV_DSTS(L, false), QTAU_CONV_DSTS(L, true) }
+
+static const int c_num_formats = 6;
+
+static const convertFunc c_convert_table[c_num_formats][2][c_num_formats][2][3] = {
+    QTAU_CONV_SRC(SLoadU8),
+    QTAU_CONV_SRC(SLoadS16),
+    QTAU_CONV_SRC(SLoadS24),
+    QTAU_CONV_SRC(SLoadS32),
+    QTAU_CONV_SRC(SLoadF32),
+    QTAU_CONV_SRC(SLoadS8)
+};
+
+#undef QTAU_CONV_SRC
+#undef QTAU_CONV_DSTS
+#undef QTAU_CONV_DST
+#undef QTAU_CONV_MAPS
+
+bool convertPcm(const char *src, ESampleFormat srcF, bool srcBigEndian,
+                char       *dst, ESampleFormat dstF, bool dstBigEndian,
+                EChannelMap map, int channels, int frames)
+{
+    const int si = (int)srcF - 1;
+    const int di = (int)dstF - 1;
+
+    bool result = si >= 0 && si < c_num_formats && di >= 0 && di < c_num_formats && channels > 0 &&
+                  channels <= c_convert_chunk / 2 && (map == EChannelMap::same || channels == 1);
+
+    if (result && frames > 0)
+    {
+        if (srcF == dstF && map == EChannelMap::same)
+        {
+            const int samples = frames * channels;
+            memcpy(dst, src, samples * sampleBytes(srcF)); // only byte order may change
+
+            if (srcBigEndian != dstBigEndian)
+                swapSamples(dst, samples, sampleBytes(srcF));
+        }
+        else c_convert_table[si][srcBigEndian][di][dstBigEndian][(int)map](src, dst, channels, frames);
+    }
+
+    return result;
+}
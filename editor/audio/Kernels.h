@@ -0,0 +1,83 @@
+/* Kernels.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_KERNELS_H
+#define QTAU_AUDIO_KERNELS_H
+
+#include <QAudioFormat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define QTAU_SSE2
+#endif
+
+#if defined(QTAU_SSE2) && defined(__SSSE3__)
+    #define QTAU_SSSE3
+#endif
+
+#if defined(QTAU_SSE2) && defined(__AVX2__)
+    #define QTAU_AVX2
+#endif
+
+
+// PCM sample formats that mixer and converters know how to read, mixer reads only little-endian ones
+enum class ESampleFormat : char {
+    unknown,
+    U8,
+    S16,
+    S24, // packed, 3 bytes per sample
+    S32,
+    F32,
+    S8   // AIFF has signed 8-bit samples
+};
+
+enum class EChannelMap : char {
+    same,         // any number of channels, kept as is
+    monoToStereo,
+    stereoToMono  // average of two channels
+};
+
+ESampleFormat sampleFormat(const QAudioFormat &f, bool anyByteOrder = false);
+int           sampleBytes (ESampleFormat f);
+
+// gains of both sides going linearly from "from" to "to" during a block, reaching it on the last frame
+typedef struct SGainRamp {
+    float fromL;
+    float fromR;
+    float toL;
+    float toR;
+
+    SGainRamp(float fl = 1, float fr = 1, float tl = 1, float tr = 1) : fromL(fl), fromR(fr), toL(tl), toR(tr) {}
+
+    bool isUnity()  const { return fromL == 1 && fromR == 1 && toL == 1 && toR == 1; }
+    bool isSilent() const { return fromL == 0 && fromR == 0 && toL == 0 && toR == 0; }
+} SGainRamp;
+
+// levels of samples that kernels went through, accumulated on the way - adding more blocks keeps maximum and sums
+typedef struct SBlockLevels {
+    float peakL;  // max absolute sample
+    float peakR;
+    float sumSqL; // sum of squared samples
+    float sumSqR;
+    int   frames;
+
+    SBlockLevels() : peakL(0), peakR(0), sumSqL(0), sumSqR(0), frames(0) {}
+} SBlockLevels;
+
+/* Converts "frames" frames of interleaved PCM from src to float and adds them to planar bus, with gain ramp
+ * applied on the way. Mono sources are added to both sides, sources with more than 2 channels give only first two.
+ * With levels given, also measures what's added (after gain) in the same pass. */
+void mixToBus(ESampleFormat f, const char *src, int channels, int frames, float *busL, float *busR,
+              const SGainRamp &g = SGainRamp(), SBlockLevels *levels = nullptr);
+
+// single conversion of a planar float bus to interleaved PCM of device (1 or 2 channels), with gain and saturation
+// levels are measured after gain and before saturation, so they can go over 1
+bool busToPcm(const float *busL, const float *busR, int frames, ESampleFormat f, int channels, char *dst,
+              float gain = 1.f, SBlockLevels *levels = nullptr);
+
+/* Converts interleaved PCM between any two of known sample formats, byte orders and channel layouts.
+ * Integer formats are scaled by powers of two, so converting to a wider one and back is lossless.
+ * Returns false if combination isn't supported. */
+bool convertPcm(const char *src, ESampleFormat srcF, bool srcBigEndian,
+                char       *dst, ESampleFormat dstF, bool dstBigEndian,
+                EChannelMap map, int channels, int frames);
+
+#endif // QTAU_AUDIO_KERNELS_H
@@ -0,0 +1,167 @@
+/* Levels.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/Levels.h"
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+#ifdef QTAU_SSE2
+    #include <emmintrin.h>
+#endif
+
+
+float SLevels::toDB(float linear)
+{
+    return (linear > 0) ? std::max(20.f * std::log10(linear), c_levels_floor_db) : c_levels_floor_db;
+}
+
+//------------------------------------------------------------------
+
+qtauLevelMeter::qtauLevelMeter() :
+    resetRequested(false)
+{
+    //
+}
+
+void qtauLevelMeter::addBlock(const SBlockLevels &b, int frames, int sampleRate, float blockTruePeak)
+{
+    if (frames <= 0 || sampleRate <= 0)
+        return;
+
+    if (resetRequested.exchange(false, std::memory_order_acquire))
+        state = SLevels();
+
+    // peaks fall at constant speed in dB, RMS is averaged over exponential window
+    const float fall  = std::pow(10.f, -c_levels_fall_db_s * frames / (20.f * sampleRate));
+    const float decay = std::exp(-(float)frames * 1000 / ((float)sampleRate * c_levels_rms_ms));
+    const float blockPeak = std::max(b.peakL, b.peakR);
+
+    state.peakL    = std::max(b.peakL, state.peakL * fall);
+    state.peakR    = std::max(b.peakR, state.peakR * fall);
+    state.truePeak = std::max(std::max(blockTruePeak, blockPeak), state.truePeak * fall);
+    state.maxPeak  = std::max(state.maxPeak, std::max(blockTruePeak, blockPeak));
+
+    // source may give less than a block, the rest of it is silence
+    const float msL = b.sumSqL / frames;
+    const float msR = b.sumSqR / frames;
+    const float oldL = state.rmsL * state.rmsL;
+    const float oldR = state.rmsR * state.rmsR;
+    state.rmsL = std::sqrt(oldL * decay + msL * (1 - decay));
+    state.rmsR = std::sqrt(oldR * decay + msR * (1 - decay));
+
+    if (blockPeak > 1.f)
+        ++state.clips;
+
+    published.store(state);
+}
+
+SLevels qtauLevelMeter::levels() const
+{
+    return published.load();
+}
+
+//------------------------------------------------------------------
+
+qtauTruePeak::qtauTruePeak()
+{
+    // lowpass at original Nyquist for rate * phases, Hann-windowed. Phase p of tap k is point k * phases + p
+    const int    len    = c_truepeak_taps * c_truepeak_phases;
+    const double center = (len - 1) / 2.0;
+    const double pi     = 3.141592653589793;
+
+    for (int p = 0; p < c_truepeak_phases; ++p)
+    {
+        double sum = 0;
+
+        for (int k = 0; k < c_truepeak_taps; ++k)
+        {
+            const double t = (k * c_truepeak_phases + p - center) / c_truepeak_phases;
+            const double w = 0.5 - 0.5 * std::cos(2 * pi * (k * c_truepeak_phases + p + 0.5) / len);
+            const double h = (t == 0) ? 1.0 : std::sin(pi * t) / (pi * t);
+
+            // taps are stored reversed, so filter reads samples forwards
+            coeffs[c_truepeak_taps - 1 - k][p] = (float)(h * w);
+            sum += h * w;
+        }
+
+        for (int k = 0; k < c_truepeak_taps; ++k) // each phase passes DC unchanged
+            coeffs[k][p] = (float)(coeffs[k][p] / sum);
+    }
+
+    reset();
+}
+
+void qtauTruePeak::reset()
+{
+    memset(histL, 0, sizeof(histL));
+    memset(histR, 0, sizeof(histR));
+}
+
+float qtauTruePeak::filter(const float *x, int frames) const
+{
+    float result = 0;
+    int i = 0;
+
+#ifdef QTAU_SSE2
+    __m128 c[c_truepeak_taps];
+    __m128 peak = _mm_setzero_ps();
+    const __m128 absMask = _mm_set1_ps(-0.f);
+
+    for (int k = 0; k < c_truepeak_taps; ++k)
+        c[k] = _mm_loadu_ps(coeffs[k]);
+
+    // all four interpolated points between two samples at once
+    for (; i < frames; ++i)
+    {
+        __m128 y = _mm_setzero_ps();
+
+        for (int k = 0; k < c_truepeak_taps; ++k)
+            y = _mm_add_ps(y, _mm_mul_ps(c[k], _mm_set1_ps(x[i + k])));
+
+        peak = _mm_max_ps(peak, _mm_andnot_ps(absMask, y));
+    }
+
+    peak   = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    result = _mm_cvtss_f32(_mm_max_ss(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1,1,1,1))));
+#endif
+
+    for (; i < frames; ++i)
+        for (int p = 0; p < c_truepeak_phases; ++p)
+        {
+            float y = 0;
+
+            for (int k = 0; k < c_truepeak_taps; ++k)
+                y += coeffs[k][p] * x[i + k];
+
+            result = std::max(result, std::fabs(y));
+        }
+
+    return result;
+}
+
+float qtauTruePeak::process(const float *busL, const float *busR, int frames, float gain)
+{
+    const int h = c_truepeak_taps - 1;
+    float result = 0;
+    float x[h + c_truepeak_chunk];
+
+    for (int done = 0; done < frames; )
+    {
+        const int n = std::min(frames - done, c_truepeak_chunk);
+
+        // both sides go through the same buffer, history is just before the chunk
+        memcpy(x, histL, sizeof(histL));
+        memcpy(x + h, busL + done, n * sizeof(float));
+        result = std::max(result, filter(x, n));
+        memcpy(histL, x + n, sizeof(histL));
+
+        memcpy(x, histR, sizeof(histR));
+        memcpy(x + h, busR + done, n * sizeof(float));
+        result = std::max(result, filter(x, n));
+        memcpy(histR, x + n, sizeof(histR));
+
+        done += n;
+    }
+
+    return result * std::fabs(gain);
+}
@@ -0,0 +1,79 @@
+/* Levels.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_LEVELS_H
+#define QTAU_AUDIO_LEVELS_H
+
+#include "audio/Kernels.h"
+#include "audio/Seqlock.h"
+#include <atomic>
+
+const int   c_levels_rms_ms    = 300;   // exponential window of RMS
+const float c_levels_fall_db_s = 20.f;  // how fast peak indication falls back after a peak
+const float c_levels_floor_db  = -90.f; // what silence is shown as
+const int   c_truepeak_phases  = 4;     // oversampling of true-peak estimation, as in ITU-R BS.1770
+const int   c_truepeak_taps    = 12;    // of each phase of interpolation filter
+const int   c_truepeak_chunk   = 256;   // frames filtered at once on stack
+
+
+// levels as meter shows them, all linear (1 is full scale)
+typedef struct SLevels {
+    float   peakL;    // sample peak, falling back at c_levels_fall_db_s after it
+    float   peakR;
+    float   rmsL;
+    float   rmsR;
+    float   truePeak; // inter-sample peak of both sides, falling back too. Measured only on master bus
+    float   maxPeak;  // highest sample or true peak since reset, stays
+    quint64 clips;    // blocks that went over full scale since reset
+
+    SLevels() : peakL(0), peakR(0), rmsL(0), rmsR(0), truePeak(0), maxPeak(0), clips(0) {}
+
+    static float toDB(float linear); // not lower than c_levels_floor_db
+} SLevels;
+
+
+/* Meter of one source or of master bus. Mixing thread gives it levels that kernels measured in a block anyway,
+ * meter applies ballistics and publishes result through a seqlock like qtauPlayhead does, so GUI can poll
+ * it at its frame rate without locks. One writer only. Reset is only requested by readers, writer does it. */
+class qtauLevelMeter
+{
+public:
+    qtauLevelMeter();
+
+    // writer side, frames is block length even if source gave less (or nothing) in it
+    void addBlock(const SBlockLevels &b, int frames, int sampleRate, float blockTruePeak = 0);
+
+    // any thread
+    SLevels levels() const;
+    void    reset() const { resetRequested.store(true, std::memory_order_release); } // applied with next block
+
+protected:
+    SLevels state; // writer's own
+
+    mutable std::atomic<bool> resetRequested; // only thing readers change
+    qtauSeqlock<SLevels>      published;
+
+    Q_DISABLE_COPY(qtauLevelMeter)
+};
+
+
+/* Estimates peaks between samples of a planar stereo bus by interpolating it c_truepeak_phases times with
+ * a windowed-sinc polyphase filter - peaks of converted (or clipped) audio may be higher than any sample.
+ * Keeps filter history between blocks, nothing is allocated after construction. */
+class qtauTruePeak
+{
+public:
+    qtauTruePeak();
+
+    float process(const float *busL, const float *busR, int frames, float gain = 1.f); // peak of a block
+    void  reset(); // forgets history, after a jump
+
+protected:
+    // coefficients of all phases for each tap, so one pass over taps gives all interpolated points
+    float coeffs[c_truepeak_taps][c_truepeak_phases];
+    float histL[c_truepeak_taps - 1]; // last samples of previous block
+    float histR[c_truepeak_taps - 1];
+
+    float filter(const float *x, int frames) const; // x has c_truepeak_taps - 1 frames of history before it
+};
+
+#endif // QTAU_AUDIO_LEVELS_H
@@ -0,0 +1,207 @@
+/* Mixdown.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/Mixdown.h"
+#include "audio/Mixer.h"
+#include "audio/Codec.h"
+#include "Utils.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QThreadPool>
+#include <QRunnable>
+
+
+// one chunk of timeline to be mixed by thread pool
+class qtauMixdownJob : public QRunnable
+{
+public:
+    qtauMixdownJob(qtauMixdown *m, int index) : owner(m), index(index) {}
+
+    void run() override
+    {
+        owner->chunkDone(index, owner->mixChunk((qint64)index * c_mixdown_chunk_frames, c_mixdown_chunk_frames));
+    }
+
+protected:
+    qtauMixdown *owner;
+    int index;
+};
+
+
+qtauMixdown::qtauMixdown(const QString &fileName, QObject *parent) :
+    QThread(parent), file(fileName), succeeded(false), stopping(false)
+{
+    fmt = qtauSoundMixer().getAudioFormat();
+}
+
+qtauMixdown::~qtauMixdown()
+{
+    requestInterruption();
+    wait();
+
+    foreach (qtauAudioSource *t, tracks)
+        delete t;
+}
+
+void qtauMixdown::addTrack(qtauAudioSource *t)
+{
+    if (t && t->size() > 0)
+    {
+        qtauAudioSource *copy = t->duplicate();
+
+        // own parameters, so that changing them in GUI during export won't affect it
+        QSharedPointer<qtauMixParams> from = t->getMixParams();
+        QSharedPointer<qtauMixParams> to   = copy->getMixParams();
+        to->gain  = from->gain.load();
+        to->pan   = from->pan.load();
+        to->muted = from->muted.load();
+
+        tracks.append(copy);
+    }
+}
+
+QByteArray qtauMixdown::mixChunk(qint64 first, qint64 frames) const
+{
+    QByteArray result;
+
+    if (!stopping.load(std::memory_order_relaxed) && frames > 0)
+    {
+        qtauSoundMixer mixer;
+        mixer.setResampleQuality(EResampleQuality::best); // offline, there's time for it
+        mixer.setMetering(false); // chunks are mixed in parallel, meters have one writer
+        QList<qtauAudioSource*> copies;
+
+        foreach (qtauAudioSource *t, tracks)
+        {
+            qtauAudioSource *c = t->duplicate(); // streamed tracks are decoded by each chunk from its start,
+                                                 // unless they were cached whole - those share one decode
+            c->setMixParams(t->getMixParams()); // read-only while exporting
+
+            mixer.addTrack(c);
+            copies.append(c);
+        }
+
+        mixer.prepare(c_mixdown_block_frames);
+
+        // seekSource rewinds each track by its rate converter's history and restores subsample phase,
+        // so the chunk starts exactly like it would in continuous mix
+        const int frameBytes = fmt.bytesPerFrame();
+        mixer.seekFrame(first);
+
+        result.resize(frames * frameBytes);
+        qint64 got = mixer.read(result.data(), result.size());
+        result.resize(qMax(got, (qint64)0));
+
+        mixer.clear();
+
+        foreach (qtauAudioSource *c, copies)
+            delete c;
+    }
+
+    return result;
+}
+
+void qtauMixdown::chunkDone(int index, const QByteArray &pcm)
+{
+    QMutexLocker l(&chunksLock);
+    chunks[index] = pcm;
+    chunkReady.wakeAll();
+}
+
+void qtauMixdown::run()
+{
+    succeeded = false;
+    emit progress(0);
+
+    QFile f(file);
+    qtauAudioCodec *codec = nullptr;
+
+    if (f.open(QFile::WriteOnly))
+        codec = codecForExt(QFileInfo(file).suffix(), f);
+    else
+        vsLog::e(QString("Could not open file %1 to save audio").arg(file));
+
+    if (codec)
+    {
+        const int frameBytes = fmt.bytesPerFrame();
+        const int chunkBytes = c_mixdown_chunk_frames * frameBytes;
+        qint64 totalFrames = 1;
+
+        foreach (qtauAudioSource *t, tracks)
+        {
+            const QAudioFormat &tf = t->getAudioFormat();
+            qint64 start  = t->getTimelineStartMS() * fmt.sampleRate() / 1000;
+            qint64 length = t->size() / qMax(tf.bytesPerFrame(), 1) * fmt.sampleRate() / qMax(tf.sampleRate(), 1);
+            totalFrames = qMax(totalFrames, start + length);
+        }
+
+        QThreadPool pool; // own one, waited for before file is closed
+        pool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+        const int ahead = pool.maxThreadCount() * c_mixdown_chunks_per_thread;
+
+        int  submitted = 0;
+        int  written   = 0;
+        int  lastPercent = 0;
+        bool ended = false;
+        stopping = false;
+        chunks.clear();
+
+        codec->setAudioFormat(fmt);
+        bool ok = codec->beginStream();
+
+        // chunks are mixed in any order, but written strictly one after another
+        while (ok && !ended && !isInterruptionRequested())
+        {
+            for (; submitted < written + ahead; ++submitted)
+                pool.start(new qtauMixdownJob(this, submitted));
+
+            QByteArray pcm;
+            bool got = false;
+            {
+                QMutexLocker l(&chunksLock);
+
+                while (!(got = chunks.contains(written)) && !isInterruptionRequested())
+                    chunkReady.wait(&chunksLock, 100); // to notice cancel too
+
+                if (got)
+                    pcm = chunks.take(written);
+            }
+
+            if (!got)
+                break;
+
+            if (!pcm.isEmpty())
+                ok = codec->writeStream(pcm.constData(), pcm.size());
+
+            ended = pcm.size() < chunkBytes; // all tracks have ended in it
+            ++written;
+
+            int percent = (int)qMin((qint64)written * c_mixdown_chunk_frames * 100 / totalFrames, (qint64)99);
+
+            if (percent != lastPercent)
+            {
+                lastPercent = percent;
+                emit progress(percent);
+            }
+        }
+
+        stopping = true; // rest of queue is past the end, or export is cancelled
+        pool.waitForDone();
+        chunks.clear();
+
+        succeeded = ok && !isInterruptionRequested() && codec->endStream();
+        delete codec;
+
+        if (succeeded)
+            emit progress(100);
+    }
+    else if (f.isOpen())
+        vsLog::e(QString("Could not make a codec for %1").arg(file));
+
+    f.close();
+
+    if (!succeeded)
+        f.remove(); // nothing useful there
+
+    emit done(succeeded);
+}
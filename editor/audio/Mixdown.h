@@ -0,0 +1,66 @@
+/* Mixdown.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_MIXDOWN_H
+#define QTAU_AUDIO_MIXDOWN_H
+
+#include <QThread>
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QAudioFormat>
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+
+class qtauAudioSource;
+
+const int c_mixdown_block_frames   = 8192;
+const int c_mixdown_chunk_frames   = 4 * 44100; // part of timeline mixed by one pool job
+const int c_mixdown_chunks_per_thread = 2;      // how far mixing may go ahead of writing, bounds memory
+
+
+/* Offline bounce of tracks to an audio file: same mixer as playback (timeline, gain/pan/mute, rate conversion),
+ * but driven as fast as CPU allows. Timeline is cut into chunks that are mixed in parallel on a thread pool,
+ * each by its own mixer with own copies of tracks, and written in order to codec's writeStream by this thread.
+ * Mixer keeps no state between blocks except rate converter history and gain ramps: converters are seeked
+ * with exact subsample phase and their history is read again, gains are constant during export, so chunked
+ * mix is the same as mixing it in one go. Cancelled with requestInterruption(), unfinished file is removed. */
+class qtauMixdown : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit qtauMixdown(const QString &fileName, QObject *parent = 0);
+    ~qtauMixdown();
+
+    // before start(): track is copied with its current mixing setup, pcm is shared and won't change during export
+    void addTrack(qtauAudioSource *t);
+
+    bool isSucceeded() const { return succeeded; } // after finished
+    QString fileName() const { return file; }
+
+    // output frames [first, first + frames) of the mix, shorter if tracks end before that. Any thread
+    QByteArray mixChunk(qint64 first, qint64 frames) const;
+
+    void chunkDone(int index, const QByteArray &pcm); // called by pool jobs
+
+signals:
+    void progress(int percent);
+    void done(bool success); // last thing thread does, cancelled export isn't a success
+
+protected:
+    void run() override;
+
+    QString file;
+    QList<qtauAudioSource*> tracks; // templates, each chunk mixes its own copies of them
+    QAudioFormat fmt;
+    bool succeeded;
+
+    QMutex                 chunksLock;
+    QWaitCondition         chunkReady;
+    QMap<int, QByteArray>  chunks;   // mixed but not written yet
+    std::atomic<bool>      stopping; // jobs still in queue should skip mixing
+
+};
+
+#endif // QTAU_AUDIO_MIXDOWN_H
@@ -2,16 +2,16 @@
 
 #include "audio/Mixer.h"
 #include "Utils.h"
-#include <math.h>
-#include <qendian.h>
+#include "audio/Kernels.h"
+#include "audio/Procedural.h"
 #include <QDebug>
-
-#ifndef M_SQRT1_2
-    #define M_SQRT1_2	0.70710678118654752440
-#endif
+#include <qmath.h>
 
 qtauSoundMixer::qtauSoundMixer(QObject *parent) :
-    qtauAudioSource(parent), replacingEffectsSmoothly(false), replacingTracksSmoothly(false)
+    qtauAudioSource(parent), tailFrames(0), tailMixed(0), rtPrepared(false), paused(false), tracksEnded(false), metering(true), position(0),
+    seeks(0), resampleQuality((int)EResampleQuality::medium), crossfadeMS(c_mixer_crossfade_ms), loopStart(0),
+    loopEnd(0), advanced(0), masterGain(1),
+    commands(c_mixer_commands), events(c_mixer_events)
 {
     fmt.setByteOrder(QAudioFormat::LittleEndian);
     fmt.setCodec("audio/pcm");
@@ -20,11 +20,11 @@ qtauSoundMixer::qtauSoundMixer(QObject *parent) :
     fmt.setSampleSize(16);
     fmt.setSampleType(QAudioFormat::SignedInt);
 
-    open(QIODevice::ReadOnly);
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered); // readData is called directly, no QIODevice buffer in between
 }
 
 qtauSoundMixer::qtauSoundMixer(QList<qtauAudioSource*> &tracks, QObject *parent) :
-    qtauAudioSource(parent), replacingEffectsSmoothly(false), replacingTracksSmoothly(false)
+    qtauSoundMixer(parent) // same default output format
 {
     foreach (qtauAudioSource *a, tracks)
         addTrack(a);
@@ -50,17 +50,38 @@ void qtauSoundMixer::addTrack(qtauAudioSource *t, bool replace, bool smoothly)
         if (!t->isReadable())
             t->open(QIODevice::ReadOnly);
 
+        prepareSource(t);
+
         if (t->isReadable())
         {
-            if (replace)
+            bool fadeIn = replace && smoothly && fadeOutSources(tracks, false);
+
+            if (replace && !smoothly)
+                clearTracks();
+
+            t->getMixRamp() = SMixRamp();
+            seekSource(t, framePos()); // joins timeline where it is now
+
+            if (fadeIn)
             {
-                if (smoothly) replacingTracksSmoothly = true;
-                else          tracks.clear();
+                t->getMixRamp().fade     = 0;
+                t->getMixRamp().fadeStep = 1.f / crossfadeFrames();
             }
 
             tracks.append(t);
+            tracksEnded = false;
+
+            if (isLooping())
+                prefetchLoop(t);
+
+            if (endedTracks.size() < tracks.size()) // only past reserved capacity, see prepare()
+                endedTracks.resize(tracks.size());
+        }
+        else
+        {
+            vsLog::e("Sound mixer could not open a track for reading, adding cancelled.");
+            report(EMixerEvent::trackEnded, t); // so that owner could release it
         }
-        else vsLog::e("Sound mixer could not open a track for reading, adding cancelled.");
     }
     else vsLog::e("Sound mixer can't add an empty track!");
 }
@@ -72,201 +93,589 @@ void qtauSoundMixer::addEffect(qtauAudioSource *e, bool replace, bool smoothly)
         if (!e->isReadable())
             e->open(QIODevice::ReadOnly);
 
+        prepareSource(e);
+
         if (e->isReadable())
         {
-            if (replace)
+            bool fadeIn = replace && smoothly && fadeOutSources(effects, true);
+
+            if (replace && !smoothly)
+                clearEffects();
+            else if (!replace)
+                stealEffect();
+
+            e->getMixRamp() = SMixRamp();
+
+            if (fadeIn)
             {
-                if (smoothly) replacingEffectsSmoothly = true;
-                else          effects.clear();
+                e->getMixRamp().fade     = 0;
+                e->getMixRamp().fadeStep = 1.f / crossfadeFrames();
             }
 
             effects.append(e);
+
+            if (endedEffects.size() < effects.size())
+                endedEffects.resize(effects.size());
+        }
+        else
+        {
+            vsLog::e("Sound mixer could not open an effect for reading, adding cancelled.");
+            report(EMixerEvent::effectEnded, e); // so that owner could release it
         }
-        else vsLog::e("Sound mixer could not open an effect for reading, adding cancelled.");
     }
     else vsLog::e("Sound mixer can't add an empty effect!");
 }
 
-template<typename T> int sampleTS16(const T &s) { return s; }
-
-template<typename T = quint8> int sampleToS16(const quint8 &s) { return ((float)s - 128.0) / 127.0 * 32767.0;  }
-template<typename T = qint16> int sampleToS16(const qint16 &s) { return s;                                     }
-template<typename T = qint32> int sampleToS16(const qint32 &s) { float *fS = (float*)&s; return *fS * 32767.0; }
-
-template<class T> inline qint64 mixSamplesT(const QByteArray &src, QByteArray &dst, bool stereo, qint64 n)
+void qtauSoundMixer::stealEffect()
 {
-    const int sT = sizeof(T);
-    const int sT2 = sT * 2;
+    int sounding = 0;
+    int oldest   = -1;
 
-    qint64 nBytes = stereo ? (sT2 * n) : (sT * n);
-    qint64 max = qMin((qint64)src.size(), nBytes);
-    n = stereo ? (max / sT2) : (max / sT);
+    for (int i = 0; i < effects.size(); ++i)
+        if (effects[i]->getMixRamp().fadeStep >= 0)
+        {
+            if (oldest < 0)
+                oldest = i;
 
-    const char *inData  = src.data();
-    char       *outData = dst.data();
-    T       *srcS;
-    qint16 *dstS;
-    int iS, iD;
+            ++sounding;
+        }
 
-    if (stereo)
+    if (sounding >= c_mixer_max_effects)
     {
-        for (qint64 bS = 0, bD = 0; bS < max; bS += sT2, bD += 4)
+        if (crossfadeFrames() > 0)
+            effects[oldest]->getMixRamp().fadeStep = -1.f / crossfadeFrames(); // removed by mixBlock when silent
+        else
         {
-            // left channel
-            srcS = (T*)     (inData  + bS);
-            dstS = (qint16*)(outData + bD);
-            iS = sampleToS16(*srcS);
-            iD = *dstS;
-
-            iD = M_SQRT1_2 * (iS + iD);
-            *dstS = qMax(qMin(iD, SHRT_MAX), SHRT_MIN);
-
-            // right channel - a bit redundant, but twice less cycles easily
-            srcS = (T*)     (inData  + bS + 2);
-            dstS = (qint16*)(outData + bD + 2);
-            iS = sampleToS16<T>(*srcS);
-            iD = *dstS;
-
-            iD = M_SQRT1_2 * (iS + iD);
-            *dstS = qMax(qMin(iD, SHRT_MAX), SHRT_MIN);
+            report(EMixerEvent::effectEnded, effects[oldest]);
+            effects.removeAt(oldest);
         }
     }
-    else
-    {
-        for (qint64 bS = 0, bD = 0; bS < max; bS += sT, bD += 4)
-        {
-            // left channel
-            srcS = (T*)     (inData  + bS);
-            dstS = (qint16*)(outData + bD);
-            iS = sampleToS16<T>(*srcS);
-            iD = *dstS;
+}
 
-            iD = M_SQRT1_2 * (iS + iD);
-            *dstS = qMax(qMin(iD, SHRT_MAX), SHRT_MIN);
+void qtauSoundMixer::dropSources(QList<qtauAudioSource*> &sources, bool areEffects)
+{
+    for (int i = 0; i < sources.size(); ++i)
+        report(areEffects ? EMixerEvent::effectEnded : EMixerEvent::trackEnded, sources[i]);
 
-            // right channel - dest val may be different
-            dstS = (qint16*)(outData + bD + 2);
-            iD = *dstS;
+    sources.erase(sources.begin(), sources.end()); // unlike clear() keeps allocated memory
+}
 
-            iD = M_SQRT1_2 * (iS + iD);
-            *dstS = qMax(qMin(iD, SHRT_MAX), SHRT_MIN);
+bool qtauSoundMixer::fadeOutSources(QList<qtauAudioSource*> &sources, bool areEffects)
+{
+    bool result = false;
+
+    if (crossfadeFrames() > 0)
+    {
+        foreach (qtauAudioSource *s, sources)
+        {
+            SMixRamp &r = s->getMixRamp();
+            result = result || r.fade > 0;
+            r.fadeStep = -1.f / crossfadeFrames(); // removed by mixBlock when silent
         }
     }
+    else dropSources(sources, areEffects); // no crossfade, just a cut
 
-    return n;
+    return result;
 }
 
-
-qint64 qtauSoundMixer::readData(char *data, qint64 maxlen)
+bool qtauSoundMixer::post(const SMixerCommand &c)
 {
-    qint64 result = 0;
-    qint64 frames = maxlen / 4;
-    qint64 truncated = maxlen - frames*4;
-    qint64 framesProcessed = 0;
+    bool result = commands.push(c);
 
-    if (truncated > 0)
-        vsLog::d(QString("Sound mixer was asked to give %1 bytes, %2 more than equeal to frame size!")
-                         .arg(maxlen).arg(truncated));
+    if (!result)
+        vsLog::e("Sound mixer command queue is full, command is dropped.");
 
-    maxlen -= truncated;
+    return result;
+}
 
-    if (maxlen > 0) // mix samples of all tracks and effects
-    {
-        /*
-         * all audios are considered to be open for reading, U8 or S16 or F32 LE, mono or stereo, 44100Hz
-         * output from readData is considered to be 16LE stereo, 4 bytes per frame (2*2)
-         * need to read same amount of frames from all tracks and sources, and if any one is giving less, it's ended
-         * signal ended audios so that they may be released
-         * */
+void qtauSoundMixer::report(EMixerEvent type, qtauAudioSource *s)
+{
+    if (!events.push(SMixerEvent(type, s)))
+        vsLog::e("Sound mixer event queue is full, ended source won't be released.");
+}
 
-        if (buffer().size() < maxlen)
-            buffer().resize(maxlen);
+void qtauSoundMixer::deliverEvents()
+{
+    SMixerEvent e;
 
-        QByteArray &buf = buffer();
-        memset(buf.data(), 0, maxlen);
+    while (events.pop(e))
+        switch (e.type)
+        {
+        case EMixerEvent::trackEnded:      emit trackEnded (e.source); break;
+        case EMixerEvent::effectEnded:     emit effectEnded(e.source); break;
+        case EMixerEvent::allTracksEnded:  emit allTracksEnded();      break;
+        case EMixerEvent::allEffectsEnded: emit allEffectsEnded();     break;
+        }
+}
 
-        QList<qtauAudioSource*> endedEffects;
-        QList<qtauAudioSource*> endedTracks;
+void qtauSoundMixer::applyCommands()
+{
+    SMixerCommand c;
 
-        // cycle all effects and tracks and try to get required amount of frames from them
-        foreach (qtauAudioSource *e, effects)
+    while (commands.pop(c))
+        switch (c.type)
         {
-            qint64 effFrames = 0;
-            qint64 numCh = (e->getAudioFormat().channelCount() > 1) ? 2 : 1;
+        case EMixerCommand::addTrack:  addTrack (c.source, c.replace, c.smoothly); break;
+        case EMixerCommand::addEffect: addEffect(c.source, c.replace, c.smoothly); break;
+        case EMixerCommand::play:      paused = false;  break;
+        case EMixerCommand::pause:     paused = true;   break;
+        case EMixerCommand::stop:      clear(); paused = false; position.store(0); setLoop(0, 0); tailFrames = 0; break;
+        case EMixerCommand::volume:    masterGain = c.value; break;
+        case EMixerCommand::seek:      seekFrame(c.frame);   break;
+        case EMixerCommand::loop:      setLoop(c.frame, c.endFrame); break;
+        default:
+            break;
+        }
+}
 
-            switch (e->getAudioFormat().sampleSize())
+bool qtauSoundMixer::atEnd() const
+{
+    bool result = effects.isEmpty();
+
+    if (result)
+        foreach (qtauAudioSource *t, tracks)
+            if (!t->atEnd())
             {
-            case 8:  effFrames = mixSamplesT<quint8>(e->read(frames     * numCh), buf, numCh > 1, frames); break;
-            case 16: effFrames = mixSamplesT<qint16>(e->read(frames * 2 * numCh), buf, numCh > 1, frames); break;
-            case 32: effFrames = mixSamplesT<qint32>(e->read(frames * 4 * numCh), buf, numCh > 1, frames); break;
-            default:
-                vsLog::e("Sound mixer is processing an effect with unsupported sample size, dropping.");
-                endedEffects.append(e);
+                result = false;
+                break;
             }
 
-            if (effFrames < frames)
-                endedEffects.append(e);
+    return result;
+}
 
-            framesProcessed = qMax(effFrames, framesProcessed);
-        }
+bool qtauSoundMixer::seek(qint64 pos)
+{
+    seekFrame(pos / fmt.bytesPerFrame());
+    return true;
+}
+
+void qtauSoundMixer::seekFrame(qint64 frame)
+{
+    frame = qMax(frame, (qint64)0);
+
+    foreach (qtauAudioSource *t, tracks)
+        seekSource(t, frame);
+
+    tracksEnded = false; // will report again if nothing is left after seek point
+    truePeak.reset();    // filter history is from another place
+    tailFrames  = 0;
+    position.store(frame, std::memory_order_release);
+    seeks.fetch_add(1, std::memory_order_release);
+}
+
+void qtauSoundMixer::setLoop(qint64 startFrame, qint64 endFrame)
+{
+    startFrame = qMax(startFrame, (qint64)0);
+
+    if (endFrame <= startFrame) // off
+        startFrame = endFrame = 0;
 
+    loopStart.store(startFrame, std::memory_order_release);
+    loopEnd  .store(endFrame,   std::memory_order_release);
+
+    if (endFrame > startFrame) // streamed tracks decode loop start ahead, every wrap seeks there
         foreach (qtauAudioSource *t, tracks)
-        {
-            qint64 trFrames = 0;
-            qint64 numCh = (t->getAudioFormat().channelCount() > 1) ? 2 : 1;
+            prefetchLoop(t);
+}
 
-            switch (t->getAudioFormat().sampleSize())
-            {
-            case 8:  trFrames = mixSamplesT<quint8>(t->read(frames     * numCh), buf, numCh > 1, frames); break;
-            case 16: trFrames = mixSamplesT<qint16>(t->read(frames * 2 * numCh), buf, numCh > 1, frames); break;
-            case 32: trFrames = mixSamplesT<qint32>(t->read(frames * 4 * numCh), buf, numCh > 1, frames); break;
-            default:
-                vsLog::e("Sound mixer is processing an effect with unsupported sample size, dropping.");
-                endedTracks.append(t);
-            }
+void qtauSoundMixer::prefetchLoop(qtauAudioSource *t)
+{
+    qint64 frac    = 0;
+    int    history = 0;
 
-            if (trFrames < frames)
-                endedTracks.append(t);
+    t->prefetch(sourcePos(t, loopStart.load(std::memory_order_relaxed), frac, history));
+}
+
+void qtauSoundMixer::wrapLoop()
+{
+    const qint64 frame = loopStart.load(std::memory_order_relaxed);
+
+    // tracks are read on past loop end first, a hard cut from there to loop start would click
+    tailFrames = (int)qMin((qint64)qMin(qMin(crossfadeFrames(), busL.size()), tailL.size()),
+                           loopEnd.load(std::memory_order_relaxed) - frame); // not longer than a pass
+    tailMixed  = 0;
+
+    if (tailFrames > 0)
+    {
+        const bool wasMetering = metering; // it's not heard as it is
+        qint64 tailProcessed = 0;
+        int    tailEnded     = 0;
+
+        metering = false;
+        memset(busL.data(), 0, tailFrames * sizeof(float));
+        memset(busR.data(), 0, tailFrames * sizeof(float));
+        mixSources(tracks, endedTracks, tailEnded, tailFrames, tailProcessed, true);
+        memcpy(tailL.data(), busL.constData(), tailFrames * sizeof(float));
+        memcpy(tailR.data(), busR.constData(), tailFrames * sizeof(float));
+        metering = wasMetering;
+    }
+
+    // same as seekFrame, but render-ahead shouldn't drop what it has rendered before the jump
+    foreach (qtauAudioSource *t, tracks)
+        seekSource(t, frame);
+
+    tracksEnded = false;
+    position.store(frame, std::memory_order_release);
+}
+
+void qtauSoundMixer::mixTail(qint64 frames)
+{
+    const int n = (int)qMin(frames, (qint64)(tailFrames - tailMixed));
+
+    for (int i = 0; i < n; ++i)
+    {
+        const float in = (float)(tailMixed + i) / tailFrames; // linear, like crossfades of replaced sources
+
+        busL[i] = busL[i] * in + tailL[tailMixed + i] * (1.f - in);
+        busR[i] = busR[i] * in + tailR[tailMixed + i] * (1.f - in);
+    }
+
+    tailMixed += n;
+
+    if (tailMixed >= tailFrames)
+        tailFrames = 0;
+}
+
+int qtauSoundMixer::crossfadeFrames() const
+{
+    return crossfadeMS.load() * fmt.sampleRate() / 1000;
+}
+
+qint64 qtauSoundMixer::startFrame(qtauAudioSource *t) const
+{
+    return t->getTimelineStartMS() * fmt.sampleRate() / 1000;
+}
+
+void qtauSoundMixer::seekSource(qtauAudioSource *t, qint64 frame)
+{
+    qint64 frac    = 0;
+    int    history = 0;
+    const qint64 pos = sourcePos(t, frame, frac, history);
+
+    if (t->getRateConverter())
+        t->getRateConverter()->reset(frac, history);
+
+    t->seek(pos);
+}
+
+qint64 qtauSoundMixer::sourcePos(qtauAudioSource *t, qint64 frame, qint64 &frac, int &history) const
+{
+    qtauRateConverter *rc = t->getRateConverter();
+    qint64 srcFrame = qMax(frame - startFrame(t), (qint64)0); // track that starts later waits at its beginning
 
-            framesProcessed = qMax(trFrames, framesProcessed);
+    frac    = 0;
+    history = 0;
+
+    if (rc) // keeps the same subsample phase that reading from timeline start would have here
+    {
+        const qint64 srcPos = srcFrame * rc->getSrcRate();
+        srcFrame = srcPos / rc->getDstRate();
+        frac     = srcPos % rc->getDstRate();
+
+        // and the same filter history, audio before seek point is read again, or there'd be a click
+        history   = (int)qMin(srcFrame, (qint64)rc->historyFrames());
+        srcFrame -= history;
+    }
+
+    return qMin(srcFrame * t->getAudioFormat().bytesPerFrame(), t->size()); // past the end means it's just ended
+}
+
+qint64 qtauSoundMixer::pulsesToFrames(qint64 pulses, int tempo) const
+{
+    // quarter note is c_midi_ppq pulses and lasts 60/tempo seconds
+    return pulses * 60 * fmt.sampleRate() / (qMax(tempo, 1) * c_midi_ppq);
+}
+
+void qtauSoundMixer::prepareSource(qtauAudioSource *s)
+{
+    const int srcRate = s->getAudioFormat().sampleRate();
+    const int dstRate = fmt.sampleRate();
+    const EResampleQuality q = (EResampleQuality)resampleQuality.load();
+    qtauRateConverter *rc = s->getRateConverter();
+
+    if (s->isProcedural()) // renders at whatever rate it's asked to
+    {
+        static_cast<qtauProceduralSource*>(s)->setSampleRate(dstRate);
+        s->setRateConverter(nullptr);
+    }
+    else if (srcRate != dstRate)
+    {
+        if (!rc || rc->getSrcRate() != srcRate || rc->getDstRate() != dstRate || rc->getQuality() != q)
+        {
+            rc = new qtauRateConverter(srcRate, dstRate, q); // prepared for largest block of real-time mode
+            s->setRateConverter(rc);
         }
+    }
+    else if (rc)
+        s->setRateConverter(nullptr);
+}
+
+void qtauSoundMixer::prepare(int maxFrames)
+{
+    maxFrames = qMax(maxFrames, 1);
 
-        //-- cleanup ---------------------------------
+    busL.fill(0.f, maxFrames);
+    busR.fill(0.f, maxFrames);
+    tailL.fill(0.f, maxFrames);
+    tailR.fill(0.f, maxFrames);
 
-        if (!endedEffects.isEmpty())
+    // ended lists are never bigger than source lists, give them some spare room for additions during playback
+    int maxSources = qMax(tracks.size() + effects.size(), c_mixer_reserved_sources);
+    endedEffects.fill(nullptr, maxSources);
+    endedTracks .fill(nullptr, maxSources);
+    tracks .reserve(maxSources);
+    effects.reserve(maxSources);
+
+    foreach (qtauAudioSource *s, tracks)
+        if (s->getRateConverter())
+            s->getRateConverter()->prepare(maxFrames);
+
+    foreach (qtauAudioSource *s, effects)
+        if (s->getRateConverter())
+            s->getRateConverter()->prepare(maxFrames);
+
+    rtPrepared = true;
+}
+
+// gains of left and right sides for source's mixing parameters, pan keeps the louder side at full level
+inline void targetGains(const qtauMixParams &p, float &gainL, float &gainR)
+{
+    const float gain = p.muted.load(std::memory_order_relaxed) ? 0.f : p.gain.load(std::memory_order_relaxed);
+    const float pan  = qBound(-1.f, p.pan.load(std::memory_order_relaxed), 1.f);
+
+    gainL = gain * ((pan > 0) ? qCos(pan  * M_PI_2) : 1.f);
+    gainR = gain * ((pan < 0) ? qCos(-pan * M_PI_2) : 1.f);
+}
+
+// reads a block from every source and adds it to the float bus, collects sources that gave less than asked
+void qtauSoundMixer::mixSources(QList<qtauAudioSource*> &sources, QVector<qtauAudioSource*> &ended, int &numEnded,
+                                qint64 frames, qint64 &framesProcessed, bool onTimeline)
+{
+    const qint64 blockStart = framePos();
+
+    foreach (qtauAudioSource *s, sources)
+    {
+        const QAudioFormat &sf = s->getAudioFormat();
+        ESampleFormat sfmt = sampleFormat(sf);
+        qint64 srcFrames = 0;
+        SBlockLevels  levels;
+        SBlockLevels *lv = metering ? &levels : nullptr;
+
+        // track that starts later on timeline is silent until then, but isn't ended
+        const qint64 lead = onTimeline ? qBound((qint64)0, startFrame(s) - blockStart, frames) : 0;
+        const qint64 toMix = frames - lead;
+
+        SMixRamp &ramp = s->getMixRamp();
+        const float fadeFrom = ramp.fade;
+        ramp.fade = qBound(0.f, ramp.fade + ramp.fadeStep * frames, 1.f);
+        const bool fadedOut = ramp.fadeStep < 0 && ramp.fade <= 0;
+
+        if (sfmt != ESampleFormat::unknown && toMix > 0)
         {
-            foreach (qtauAudioSource *e, endedEffects)
+            const int frameBytes = sampleBytes(sfmt) * sf.channelCount();
+            qtauRateConverter *rc = s->getRateConverter();
+            qint64 gotBytes = 0;
+
+            float gainL, gainR;
+            targetGains(*s->getMixParams(), gainL, gainR);
+
+            if (!ramp.started) // starts at its level right away, ramps are only for changes
             {
-                emit effectEnded(e);
-                effects.removeOne(e);
+                ramp.gainL   = gainL;
+                ramp.gainR   = gainR;
+                ramp.started = true;
             }
 
-            if (effects.isEmpty())
+            // gain, pan and crossfade changes are all applied by mixing kernels, they measure levels too
+            const SGainRamp g(ramp.gainL * fadeFrom, ramp.gainR * fadeFrom, gainL * ramp.fade, gainR * ramp.fade);
+            float *mixL = busL.data() + lead;
+            float *mixR = busR.data() + lead;
+
+            if (s->isProcedural()) // nothing to read, it's rendered right into the bus
+                srcFrames = s->render(mixL, mixR, toMix, g, lv);
+            else if (rc) // source has another sample rate, its frames are pushed through converter
             {
-                emit allEffectsEnded();
-                replacingEffectsSmoothly = false;
+                if (!rtPrepared)
+                    rc->prepare(toMix);
+
+                int needed = rc->framesNeeded(toMix);
+
+                if (needed > 0)
+                {
+                    const char *pcm = s->readPcm(needed * frameBytes, gotBytes);
+                    rc->push(sfmt, pcm, sf.channelCount(), gotBytes / frameBytes);
+
+                    if (gotBytes / frameBytes < needed)
+                        rc->pushEnd();
+                }
+
+                srcFrames = rc->mixTo(mixL, mixR, toMix, g, lv);
             }
+            else
+            {
+                const char *pcm = s->readPcm(toMix * frameBytes, gotBytes);
+                srcFrames = gotBytes / frameBytes;
+
+                if (!g.isSilent()) // muted source is still read, to keep its place
+                    mixToBus(sfmt, pcm, sf.channelCount(), srcFrames, mixL, mixR, g, lv);
+            }
+
+            ramp.gainL = gainL;
+            ramp.gainR = gainR;
+            srcFrames += lead;
         }
+        else if (sfmt != ESampleFormat::unknown)
+            srcFrames = frames; // whole block is before its start
+        else vsLog::e("Sound mixer is processing a source with unsupported sample format, dropping.");
+
+        if (metering) // silent or waiting ones too, so that their meters fall back
+            s->getMixParams()->levels.addBlock(levels, frames, fmt.sampleRate());
+
+        if ((srcFrames < frames || fadedOut) && numEnded < ended.size())
+            ended[numEnded++] = s;
+
+        framesProcessed = qMax(srcFrames, framesProcessed);
+    }
+}
+
+qint64 qtauSoundMixer::mixBlock(char *data, qint64 frames)
+{
+    /*
+     * all audios are considered to be open for reading, U8/S16/S24/S32/F32 LE, mono or stereo,
+     * sources with sample rate other than mixer's (44100Hz) are read through their rate converters
+     * procedural sources aren't read at all, they render their frames at mixer's rate right into the bus
+     * they're summed into planar float bus and converted to output format (S16LE stereo) once at the end
+     * need to read same amount of frames from all tracks and sources, and if any one is giving less, it's ended
+     * signal ended effects so that they may be released, ended tracks stay on timeline
+     * */
+    qint64 framesProcessed = 0;
+    qint64 trackFrames     = 0;
+    int numEndedEffects = 0;
+    int numEndedTracks  = 0;
 
-        if (!endedTracks.isEmpty())
+    memset(busL.data(), 0, frames * sizeof(float));
+    memset(busR.data(), 0, frames * sizeof(float));
+
+    // cycle all effects and tracks and try to get required amount of frames from them
+    mixSources(effects, endedEffects, numEndedEffects, frames, framesProcessed, false);
+    mixSources(tracks,  endedTracks,  numEndedTracks,  frames, trackFrames,     true);
+
+    // looped timeline goes on in silence up to loop end when tracks end before it
+    const qint64 blockStart = position.load(std::memory_order_relaxed);
+
+    if (trackFrames < frames && !tracks.isEmpty() && isLooping() && blockStart < loopEnd.load(std::memory_order_relaxed))
+        trackFrames = frames; // bus is zeroed already
+
+    if (tailFrames > 0) // tail sounds even if tracks have ended
+    {
+        framesProcessed = qMax(framesProcessed, qMin(frames, (qint64)(tailFrames - tailMixed)));
+        mixTail(frames);
+    }
+
+    framesProcessed = qMax(framesProcessed, trackFrames);
+    position.store(blockStart + trackFrames, std::memory_order_release);
+    advanced.store(advanced.load(std::memory_order_relaxed) + trackFrames, std::memory_order_release);
+
+    //-- cleanup ---------------------------------
+
+    if (numEndedEffects > 0)
+    {
+        for (int i = 0; i < numEndedEffects; ++i)
         {
-            foreach (qtauAudioSource *t, endedTracks)
-            {
-                emit trackEnded(t);
-                tracks.removeOne(t);
-            }
+            report(EMixerEvent::effectEnded, endedEffects[i]);
+            effects.removeOne(endedEffects[i]);
+        }
 
-            if (tracks.isEmpty())
-            {
-                emit allTracksEnded();
-                replacingTracksSmoothly = false;
-            }
+        if (effects.isEmpty())
+            report(EMixerEvent::allEffectsEnded);
+    }
+
+    // tracks are kept for seeking, except for replaced ones that have faded out
+    int numStayingEnded = numEndedTracks;
+
+    for (int i = 0; i < numEndedTracks; ++i)
+    {
+        const SMixRamp &r = endedTracks[i]->getMixRamp();
+
+        if (r.fadeStep < 0 && r.fade <= 0)
+        {
+            report(EMixerEvent::trackEnded, endedTracks[i]);
+            tracks.removeOne(endedTracks[i]);
+            --numStayingEnded;
         }
+    }
+
+    // just reporting when all of them are done
+    if (!tracksEnded && !tracks.isEmpty() && numStayingEnded == tracks.size() && !isLooping())
+    {
+        tracksEnded = true;
+        report(EMixerEvent::allTracksEnded);
+    }
+
+    SBlockLevels levels;
+
+    if (framesProcessed > 0 && !busToPcm(busL.constData(), busR.constData(), framesProcessed,
+                                         sampleFormat(fmt), fmt.channelCount(), data, masterGain,
+                                         metering ? &levels : nullptr))
+        framesProcessed = 0;
+
+    // inter-sample peaks need an oversampling filter, that's the only pass over bus that isn't mixing
+    if (metering && framesProcessed > 0)
+        masterLevels.addBlock(levels, framesProcessed, fmt.sampleRate(),
+                              truePeak.process(busL.constData(), busR.constData(), framesProcessed, masterGain));
+
+    return framesProcessed;
+}
+
+qint64 qtauSoundMixer::readData(char *data, qint64 maxlen)
+{
+    qint64 result = 0;
+    const int frameBytes = fmt.bytesPerFrame();
+    qint64 frames = maxlen / frameBytes;
+    qint64 truncated = maxlen - frames * frameBytes;
+
+    applyCommands(); // everything that came before this block starts from its first sample
+
+    if (paused)
+        return 0;
+
+    if (truncated > 0 && !rtPrepared)
+        vsLog::d(QString("Sound mixer was asked to give %1 bytes, %2 more than equeal to frame size!")
+                         .arg(maxlen).arg(truncated));
+
+    if (!rtPrepared && busL.size() < frames) // not in real-time mode, may grow buffers as needed
+    {
+        busL.resize(frames);
+        busR.resize(frames);
+    }
+
+    if (!rtPrepared && tailL.size() < crossfadeFrames())
+    {
+        tailL.resize(crossfadeFrames());
+        tailR.resize(crossfadeFrames());
+    }
+
+    // in real-time mode bus size is fixed, bigger requests are mixed block by block
+    while (frames > 0)
+    {
+        qint64 block = qMin(frames, (qint64)busL.size());
+        const qint64 from    = framePos();
+        const qint64 end     = loopEndFrame();
+        const bool   crosses = isLooping() && from < end;
+
+        if (crosses)
+            block = qMin(block, end - from); // block ends exactly at loop end, next one starts at its start
+
+        qint64 mixed = mixBlock(data + result, block);
+
+        result += mixed * frameBytes;
+        frames -= mixed;
 
-        result = framesProcessed * 4; // 4 bytes per frame (16LE stereo, always)
+        if (crosses && framePos() >= end)
+            wrapLoop();
 
-        if (result > 0)
-            memcpy(data, buf.data(), result);
+        if (mixed < block)
+            break;
     }
 
     return result;
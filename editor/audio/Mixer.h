@@ -4,10 +4,68 @@
 #define QTAU_AUDIO_MIXER_H
 
 #include "audio/Source.h"
+#include "audio/SpscRing.h"
+#include "audio/Resampler.h"
+#include "audio/Levels.h"
+#include <QVector>
+
+const int c_mixer_reserved_sources = 32;  // capacity of source lists in real-time mode
+const int c_mixer_commands         = 256; // capacity of command ring
+const int c_mixer_events           = 256; // capacity of ring of ended sources, until owner delivers them
+const int c_mixer_crossfade_ms     = 30;  // default length of smooth replacement
+const int c_mixer_max_effects      = 8;   // polyphony of effects added without replacing, oldest is faded out
+
+enum class EMixerCommand : char {
+    none,
+    addTrack,
+    addEffect,
+    play,
+    pause,
+    stop,   // drop all tracks and effects
+    volume, // value is master gain
+    seek,   // frame is new timeline position
+    loop    // frame and endFrame are loop region on timeline, empty one turns looping off
+};
+
+typedef struct SMixerCommand {
+    EMixerCommand    type;
+    qtauAudioSource *source;
+    bool  replace;
+    bool  smoothly;
+    float value;
+    qint64 frame;
+    qint64 endFrame;
+
+    SMixerCommand(EMixerCommand t = EMixerCommand::none, qtauAudioSource *s = nullptr, bool r = false,
+                  bool sm = true, float v = 0, qint64 fr = 0, qint64 efr = 0) :
+        type(t), source(s), replace(r), smoothly(sm), value(v), frame(fr), endFrame(efr) {}
+} SMixerCommand;
+
+enum class EMixerEvent : char {
+    trackEnded,
+    effectEnded,
+    allTracksEnded,
+    allEffectsEnded
+};
+
+typedef struct SMixerEvent {
+    EMixerEvent      type;
+    qtauAudioSource *source;
+
+    SMixerEvent(EMixerEvent t = EMixerEvent::trackEnded, qtauAudioSource *s = nullptr) : type(t), source(s) {}
+} SMixerEvent;
 
 /* Audio Mixer is aimed to be used for mix-on-demand, always ready to accept a new source to be mixed in.
  * Mixer does NOT manage memory of audio sources - they were created somewhere and must be deleted there too
- * To mix audio data: use constructor with list of audio sources, do readAll() */
+ * To mix audio data: use constructor with list of audio sources, do readAll()
+ *
+ * Tracks are placed on a timeline at their start time (frame 0 by default) and stay in mixer after their end,
+ * so it's possible to seek back to them; they're released (trackEnded) only when replaced or cleared.
+ * Effects aren't on the timeline, they're played from start to end and released right after that.
+ * Replacing "smoothly" crossfades: replaced sources fade out and are released, new one fades in.
+ * With a loop region set, timeline jumps from its end back to its start on the exact frame, inside of a block;
+ * tracks ending before loop end are followed by silence up to it, and aren't reported as ended. What tracks
+ * would play after loop end is crossfaded with loop start, for crossfade length (or a bus block if that's shorter). */
 class qtauSoundMixer : public qtauAudioSource
 {
     Q_OBJECT
@@ -19,35 +77,131 @@ public:
     void addTrack (qtauAudioSource *t, bool replace = false, bool smoothly = true);
     void addEffect(qtauAudioSource *e, bool replace = false, bool smoothly = true);
 
+    /* Wait-free way to control mixer from another thread (only one, usually controller's).
+     * Commands are applied at the start of next mixed block, sources should be opened for reading already. */
+    bool post(const SMixerCommand &c);
+    void applyCommands(); // called by readData, or by owner of mixer when it isn't read
+
+    /* Signals below aren't emitted by mixing thread: emitting one to another thread allocates an event.
+     * Ends are queued in a wait-free ring instead, and owner emits them from its thread (only one) with this. */
+    void deliverEvents();
+
     //--- QIODevice interface functions ---------
-    bool   isSequential()   const override { return true;  } // always sequential
-    qint64 pos()            const override { return 0;     } // don't have one.
-    bool   seek(qint64)           override { return false; } // nope.
-    bool   reset()                override { return false; } // what? NO.
-    bool   atEnd()          const override { return tracks.isEmpty() && effects.isEmpty(); }
+    bool   isSequential()   const override { return true;  } // it's a stream for audio device, seeking is timeline-only
+    qint64 pos()            const override { return framePos() * fmt.bytesPerFrame(); }
+    bool   seek(qint64 pos)       override; // in bytes of output format, from mixing thread (or post a command)
+    bool   reset()                override { return seek(0); }
+    bool   atEnd()          const override;
     qint64 size()           const override { return bytesAvailable(); }
     qint64 bytesToWrite()   const override { return 0;     } // unwritable, use addTrack/addEffect
 
     qint64 bytesAvailable() const override;
     //-------------------------------------------
 
+    /* Real-time mode: preallocates all scratch memory for blocks of up to maxFrames,
+     * after that readData never allocates and mixes larger requests block by block. */
+    void prepare(int maxFrames);
+
+    // removes sources without reporting "all ended", each one is reported as ended though, to be released
     void clear()        { clearTracks(); clearEffects(); }
-    void clearTracks()  { tracks.clear();  emit allTracksEnded();  }
-    void clearEffects() { effects.clear(); emit allEffectsEnded(); }
+    void clearTracks()  { dropSources(tracks,  false); }
+    void clearEffects() { dropSources(effects, true);  }
+
+    bool isPaused() const { return paused; }
+
+    // timeline position in frames of output format, safe to read from any thread
+    qint64 framePos() const { return position.load(std::memory_order_acquire); }
+    int    seekCount() const { return seeks.load(std::memory_order_acquire); } // to tell that timeline jumped
+
+    void seekFrame(qint64 frame); // sample-accurate, only moves read positions of tracks (from mixing thread)
+    void seekPulse(qint64 pulse, int tempo) { seekFrame(pulsesToFrames(pulse, tempo)); }
+
+    // from mixing thread, or post a command. Wraps only when playback crosses end, not if it's past it already
+    void setLoop(qint64 startFrame, qint64 endFrame);
+    bool isLooping() const { return loopEnd.load(std::memory_order_acquire) > loopStart.load(std::memory_order_acquire); }
+    qint64 loopStartFrame() const { return loopStart.load(std::memory_order_acquire); }
+    qint64 loopEndFrame()   const { return loopEnd  .load(std::memory_order_acquire); }
+
+    // timeline frames mixed since mixer was created, keeps growing through seeks and loop jumps. Any thread
+    qint64 advancedFrames() const { return advanced.load(std::memory_order_acquire); }
+
+    qint64 pulsesToFrames(qint64 pulses, int tempo) const;
+
+    /* Gives source a rate converter if its sample rate differs from mixer's. Allocates, so should be done
+     * by whoever posts the source to mixer; addTrack/addEffect do it too if it wasn't done. Any thread. */
+    void prepareSource(qtauAudioSource *s);
+    void setResampleQuality(EResampleQuality q) { resampleQuality = (int)q; } // for sources prepared after this
+
+    // gain, pan and mute of each source are read from its qtauMixParams at every block, see Source.h
+    void setCrossfadeMS(int ms) { crossfadeMS = qMax(ms, 0); } // for next replacements, 0 makes them cuts
+
+    /* Levels of each source (in its qtauMixParams) and of master bus are measured by mixing kernels in the same
+     * pass that sums them. Only one mixer may meter sources that share parameters, others (offline ones)
+     * should turn it off before mixing. Master levels are safe to poll from any thread. */
+    void setMetering(bool on) { metering = on; }
+    const qtauLevelMeter& getLevels() const { return masterLevels; }
 
 signals:
     void allTracksEnded();
     void allEffectsEnded();
 
-    void trackEnded(qtauAudioSource*);
+    void trackEnded(qtauAudioSource*);  // source isn't used by mixer anymore
     void effectEnded(qtauAudioSource*);
 
 protected:
     QList<qtauAudioSource*> tracks; // keeps its own copy of audio data because original may be chaged, in another thread even
     QList<qtauAudioSource*> effects;
 
-    bool replacingEffectsSmoothly;
-    bool replacingTracksSmoothly;
+    QVector<float> busL; // planar float32 mixing bus, converted to fmt once per block
+    QVector<float> busR;
+
+    QVector<float> tailL; // tracks right after loop end, faded out over start of next pass
+    QVector<float> tailR;
+    int tailFrames;       // in tail, 0 when there's no wrap to crossfade
+    int tailMixed;
+
+    QVector<qtauAudioSource*> endedEffects; // fixed size scratch lists, filled up to a counter in each block
+    QVector<qtauAudioSource*> endedTracks;
+
+    bool rtPrepared;
+    bool paused;
+    bool tracksEnded; // all tracks are at their end, reported with allTracksEnded
+    bool metering;
+
+    qtauLevelMeter masterLevels;
+    qtauTruePeak   truePeak;
+
+    std::atomic<qint64> position; // frames of tracks mixed since timeline start
+    std::atomic<int>    seeks;
+    std::atomic<int>    resampleQuality;
+    std::atomic<int>    crossfadeMS;
+    std::atomic<qint64> loopStart; // written only by mixing thread
+    std::atomic<qint64> loopEnd;
+    std::atomic<qint64> advanced;
+    float masterGain;
+
+    qtauSpscRing<SMixerCommand> commands; // written by controlling thread, read at the start of readData
+    qtauSpscRing<SMixerEvent>   events;   // written by mixing thread, read by deliverEvents
+
+    void report(EMixerEvent type, qtauAudioSource *s = nullptr);
+
+    void dropSources(QList<qtauAudioSource*> &sources, bool areEffects);
+    void stealEffect(); // fades out oldest effect that isn't fading out already, if there are too many
+    bool fadeOutSources(QList<qtauAudioSource*> &sources, bool areEffects); // true if any was audible
+
+    int    crossfadeFrames() const;
+    void   wrapLoop(); // jump to loop start that isn't a seek for readers of mixer
+    void   prefetchLoop(qtauAudioSource *t);
+    void   mixTail(qint64 frames); // crossfades what's left of tail with bus
+    qint64 startFrame(qtauAudioSource *t) const;  // where track starts on timeline
+    void   seekSource(qtauAudioSource *t, qint64 frame);
+
+    // byte position that track is read from for timeline frame, and its converter's subsample phase and history
+    qint64 sourcePos(qtauAudioSource *t, qint64 frame, qint64 &frac, int &history) const;
+
+    qint64 mixBlock(char *data, qint64 frames); // frames should fit in bus
+    void   mixSources(QList<qtauAudioSource*> &sources, QVector<qtauAudioSource*> &ended, int &numEnded,
+                      qint64 frames, qint64 &framesProcessed, bool onTimeline);
 
     qint64 readData(char *data, qint64 maxlen) override;
     qint64 writeData(const char *, qint64)     override { return 0; } // unwritable, use addTrack/addEffect
@@ -3,17 +3,29 @@
 #include "audio/Player.h"
 #include "audio/Source.h"
 #include "audio/Mixer.h"
+#include "audio/RtGuard.h"
+#include "audio/RenderAhead.h"
+#include "audio/Sink.h"
 #include "Utils.h"
 
-#include <QAudioOutput>
+#include <QAudioDeviceInfo>
+#include <QElapsedTimer>
 #include <QThread>
 #include <QTimer>
 #include <QDebug>
 #include <QApplication>
 
+const int c_housekeeping_ms   = 50;
+const int c_retired_reserved  = 64;
+const int c_rt_block_divider  = 10; // mixer block is 1/10 of a second, bigger device requests are mixed in parts
+const int c_ra_block_divider  = 100; // render-ahead block is 1/100 of a second
+const int c_ra_max_blocks     = 64;
+
 
 qtmmPlayer::qtmmPlayer() :
-    audioOutput(nullptr), mixer(nullptr), stopTimer(nullptr), volume(50)
+    sink(nullptr), mixer(nullptr), renderer(nullptr), stopTimer(nullptr), housekeeping(nullptr),
+    renderAheadBlocks(0), rendering(false), mixerDrained(false), bytesPerSecond(1), bytesPerFrame(1),
+    loggedUnderruns(0), latencyNSec(0), sampleRate(44100), tracksEnded(false)
 {
     vsLog::d("QtMultimedia :: supported output devices and codecs:");
     QList<QAudioDeviceInfo> advs = QAudioDeviceInfo::availableDevices(QAudio::AudioOutput);
@@ -21,15 +33,37 @@ qtmmPlayer::qtmmPlayer() :
     foreach (QAudioDeviceInfo i, advs)
         vsLog::d(QString("%1 %2").arg(i.deviceName()).arg(i.supportedCodecs().join(' ')));
 
-    open(QIODevice::ReadOnly);
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered); // audio output reads straight from readData
+
+    retired.reserve(c_retired_reserved);
+
+    // created here and not in threadedInit because controller may post commands before audio thread starts.
+    // Its signals are emitted by housekeeping in this thread, so these are direct connections
+    mixer = new qtauSoundMixer(this); // moved to audio thread together with player
+    connect(mixer, &qtauSoundMixer::effectEnded,     this, &qtmmPlayer::onEffectEnded);
+    connect(mixer, &qtauSoundMixer::trackEnded,      this, &qtmmPlayer::onTrackEnded);
+    connect(mixer, &qtauSoundMixer::allEffectsEnded, this, &qtmmPlayer::onAllEffectsEnded);
+    connect(mixer, &qtauSoundMixer::allTracksEnded,  this, &qtmmPlayer::onAllTracksEnded);
+
+    setVolume(50);
 }
 
 qtmmPlayer::~qtmmPlayer()
 {
+    if (sink)
+        sink->stop(); // threaded sinks read player till then
+
     close();
+    stopRenderer();
+    delete renderer;
+
+    mixer->applyCommands();
+    mixer->clear(); // what's left in mixer is retired too
+    mixer->deliverEvents();
+    releaseRetired();
+    delete housekeeping;
     delete stopTimer;
-    delete audioOutput;
-    delete mixer;
+    delete sink;
 }
 
 qint64 qtmmPlayer::size() const
@@ -37,191 +71,367 @@ qint64 qtmmPlayer::size() const
     return mixer->bytesAvailable();
 }
 
+qint64 qtmmPlayer::pos() const
+{
+    return mixer->pos();
+}
+
+bool qtmmPlayer::seek(qint64 pos)
+{
+    seekFrame(pos / mixer->getAudioFormat().bytesPerFrame());
+    return true;
+}
+
+void qtmmPlayer::seekFrame(qint64 frame)
+{
+    mixer->post(SMixerCommand(EMixerCommand::seek, nullptr, false, false, 0, frame));
+}
+
+void qtmmPlayer::seekPulse(qint64 pulse, int tempo)
+{
+    seekFrame(mixer->pulsesToFrames(pulse, tempo));
+}
+
+void qtmmPlayer::setLoopPulses(qint64 startPulse, qint64 endPulse, int tempo)
+{
+    mixer->post(SMixerCommand(EMixerCommand::loop, nullptr, false, false, 0,
+                              mixer->pulsesToFrames(startPulse, tempo), mixer->pulsesToFrames(endPulse, tempo)));
+}
+
+bool qtmmPlayer::isInLoop(qint64 startPulse, qint64 endPulse, int tempo) const
+{
+    const qint64 frame = mixer->framePos();
+    return frame >= mixer->pulsesToFrames(startPulse, tempo) && frame < mixer->pulsesToFrames(endPulse, tempo);
+}
+
 void qtmmPlayer::threadedInit()
 {
     stopTimer = new QTimer();
     stopTimer->setSingleShot(true);
-    connect(stopTimer, &QTimer::timeout, this, &qtmmPlayer::stop);
+    connect(stopTimer, &QTimer::timeout, this, &qtmmPlayer::stopDevice);
 
-    mixer = new qtauSoundMixer();
-    connect(mixer, &qtauSoundMixer::effectEnded,     this, &qtmmPlayer::onEffectEnded);
-    connect(mixer, &qtauSoundMixer::trackEnded,      this, &qtmmPlayer::onTrackEnded);
-    connect(mixer, &qtauSoundMixer::allEffectsEnded, this, &qtmmPlayer::onAllEffectsEnded);
-    connect(mixer, &qtauSoundMixer::allTracksEnded,  this, &qtmmPlayer::onAllTracksEnded);
+    housekeeping = new QTimer();
+    connect(housekeeping, &QTimer::timeout, this, &qtmmPlayer::onHousekeeping);
 
-    QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
-    QAudioFormat fmt = mixer->getAudioFormat();
+    const QAudioFormat fmt = mixer->getAudioFormat();
+    sink = makeSink(sinkDescription, this);
 
-    if (info.isFormatSupported(fmt))
+    if (!sink->setFormat(fmt))
     {
-        QAudioDeviceInfo di(QAudioDeviceInfo::defaultOutputDevice());
-        audioOutput = new QAudioOutput(di, fmt, this);
-        audioOutput->setVolume((qreal)volume / 100.f);
+        // playback still goes on, so that playhead, meters and ending work without sound hardware
+        vsLog::e(QString("Audio format not supported by %1, cannot play audio. Using null sink instead.")
+                 .arg(sink->name()));
+        delete sink;
+        sink = new qtauNullSink(true, this);
+        sink->setFormat(fmt);
+    }
+
+    vsLog::i("Audio output: " + sink->name());
+    connect(sink, &qtauAudioSink::notify, this, &qtmmPlayer::onTick);
+}
 
-        connect(audioOutput, SIGNAL(stateChanged(QAudio::State)), SLOT(onQtmmStateChanged(QAudio::State)));;
-        connect(audioOutput, SIGNAL(notify()), SLOT(onTick()));
+const qtauLevelMeter& qtmmPlayer::getLevels() const
+{
+    return mixer->getLevels();
+}
+
+inline qtauAudioSource* prepareSource(qtauAudioSource *s, bool copy, qtauSoundMixer *mixer)
+{
+    qtauAudioSource *result = s;
+
+    if (copy && !s->isProcedural()) // shares pcm with original, so it's cheap - and won't change if original gets rewritten
+    {
+        result = s->duplicate(true); // streamed ones decode ahead in their own thread
+        result->setMixParams(s->getMixParams()); // gain/pan/mute of original still control the copy
     }
-    else vsLog::e("Default audio format not supported by QtMultimedia backend, cannot play audio.");
+
+    if (!result->isReadable())
+        result->open(QIODevice::ReadOnly); // opening may allocate, audio callback shouldn't do it
+
+    mixer->prepareSource(result); // same for rate converter
+
+    return result;
 }
 
 void qtmmPlayer::addEffect(qtauAudioSource *e, bool replace, bool smoothly, bool copy)
 {
-    qtauAudioSource *added = e;
-
-    if (copy)
-        added = new qtauAudioSource(e->data(), e->getAudioFormat());
+    if (e && e->size())
+    {
+        qtauAudioSource *added = prepareSource(e, copy, mixer);
 
-    effects.append(added);
-    mixer->addEffect(added, replace, smoothly);
+        if (!mixer->post(SMixerCommand(EMixerCommand::addEffect, added, replace, smoothly)))
+            delete added; // well, if it's not a copy then player was supposed to own it anyway
+    }
 }
 
 void qtmmPlayer::addTrack (qtauAudioSource *t, bool replace, bool smoothly, bool copy)
 {
-    qtauAudioSource *added = t;
-
-    if (copy)
-        added = new qtauAudioSource(t->data(), t->getAudioFormat());
+    if (t && t->size())
+    {
+        qtauAudioSource *added = prepareSource(t, copy, mixer);
 
-    tracks.append(added);
-    mixer->addTrack(added, replace, smoothly);
+        if (!mixer->post(SMixerCommand(EMixerCommand::addTrack, added, replace, smoothly)))
+            delete added;
+    }
 }
 
 qint64 qtmmPlayer::readData(char *data, qint64 maxlen)
 {
-    qint64 result = mixer->read(data, maxlen);
+    qtauRtScope rt; // no heap usage from here on, see RtGuard.h
+    QElapsedTimer timer;
+    timer.start();
+
+    qint64 result = 0;
+    bool underrun = false;
+    const qint64 blockNsecs = maxlen * 1000000000 / bytesPerSecond;
+    SPlayheadSample ph = playhead.sample(); // stays where it is if nothing was played
+
+    if (rendering)
+    {
+        result = renderer->read(data, maxlen, &ph.frame, &ph.advance);
+        mixerDrained = result < maxlen && renderer->isDrained();
+        underrun     = result < maxlen && !mixerDrained; // mixing thread didn't keep up
+    }
+    else
+    {
+        mixer->applyCommands(); // so that a seek is applied before taking block start
+        ph.frame = mixer->framePos();
+        const qint64 advancedBefore = mixer->advancedFrames();
+
+        result = mixer->read(data, maxlen);
+        mixerDrained = result == 0 && !mixer->isPaused(); // housekeeping will stop playback if it stays like this
+        ph.advance = mixer->advancedFrames() - advancedBefore;
+
+        mixStats.addBlock(timer.nsecsElapsed(), blockNsecs);
+    }
+
+    ph.nsec        = qtauPlayhead::clockNSec();
+    ph.latencyNSec = latencyNSec;
+    ph.sampleRate  = sampleRate;
+    ph.loopStart   = mixer->loopStartFrame();
+    ph.loopEnd     = mixer->loopEndFrame();
+    playhead.publish(ph);
 
     if (result < maxlen)
     {
-        if (result == 0)
-            stopTimer->start(500);
+        callbackStats.addPadding((maxlen - result) / bytesPerFrame, underrun);
 
         memset(data + result, 0, maxlen - result); // silence
         result = maxlen; // else it'll complain on "buffer underflow"... and will keep asking for more
     }
 
+    callbackStats.addBlock(timer.nsecsElapsed(), blockNsecs);
+
     return result;
 }
 
 void qtmmPlayer::play()
 {
-    stopTimer->stop();
-
-    if (audioOutput->state() == QAudio::SuspendedState)
-        audioOutput->resume();
-    else
-        if (audioOutput->state() != QAudio::ActiveState)
-        {
-            audioOutput->reset();
-            audioOutput->start(this);
-        }
+    mixer->post(SMixerCommand(EMixerCommand::play));
+    QMetaObject::invokeMethod(this, "startDevice", Qt::QueuedConnection);
 }
 
 void qtmmPlayer::pause()
 {
-    stopTimer->stop();
-    audioOutput->suspend();
+    mixer->post(SMixerCommand(EMixerCommand::pause));
+    QMetaObject::invokeMethod(this, "suspendDevice", Qt::QueuedConnection);
 }
 
 void qtmmPlayer::stop()
 {
-    stopTimer->stop();
-    audioOutput->stop();
-
-    if (!mixer->atEnd())
-        mixer->clear();
+    mixer->post(SMixerCommand(EMixerCommand::stop));
+    QMetaObject::invokeMethod(this, "stopDevice", Qt::QueuedConnection);
 }
 
 void qtmmPlayer::setVolume(int level)
 {
     level = qMax(qMin(level, 100), 0);
-    volume = level;
+    mixer->post(SMixerCommand(EMixerCommand::volume, nullptr, false, false, (float)level / 100.f));
+}
+
+void qtmmPlayer::setResampleQuality(int quality)
+{
+    quality = qMax(qMin(quality, (int)EResampleQuality::best), (int)EResampleQuality::fast);
+    mixer->setResampleQuality((EResampleQuality)quality);
+}
 
-    if (audioOutput)
-        audioOutput->setVolume((qreal)level / 100.f);
+void qtmmPlayer::setCrossfade(int ms)
+{
+    mixer->setCrossfadeMS(ms);
 }
 
-void qtmmPlayer::onEffectEnded(qtauAudioSource* e)
+void qtmmPlayer::setRenderAhead(int blocks)
 {
-    int ind = effects.indexOf(e);
+    renderAheadBlocks = qMax(qMin(blocks, c_ra_max_blocks), 0);
+}
 
-    if (ind != -1)
+void qtmmPlayer::stopRenderer()
+{
+    if (rendering)
     {
-        delete e;
-        effects.removeAt(ind);
+        rendering = false;
+        renderer->requestInterruption();
+        renderer->wait();
+        renderer->flush(); // whatever was rendered ahead is discarded with the rest of playback
     }
 }
 
-void qtmmPlayer::onTrackEnded(qtauAudioSource* t)
+void qtmmPlayer::startDevice()
 {
-    int ind = tracks.indexOf(t);
+    if (!sink)
+        return;
+
+    stopTimer->stop();
+    mixerDrained = false;
 
-    if (ind != -1)
+    if (sink->state() == ESinkState::stopped)
     {
-        delete t;
-        tracks.removeAt(ind);
+        callbackStats.reset(); // new playback, callback isn't running yet
+        mixStats.reset();
+        loggedUnderruns = 0;
     }
+
+    if (!rendering)
+    {
+        const QAudioFormat fmt = mixer->getAudioFormat();
+        const int blocks = renderAheadBlocks;
+        bytesPerFrame  = qMax(1, fmt.bytesPerFrame());
+        bytesPerSecond = bytesPerFrame * qMax(1, fmt.sampleRate());
+        sampleRate     = qMax(1, fmt.sampleRate());
+
+        if (blocks > 0)
+        {
+            const int blockFrames = fmt.sampleRate() / c_ra_block_divider;
+            const int blockBytes  = blockFrames * fmt.bytesPerFrame();
+
+            if (!renderer || renderer->getBlocks() != blocks || renderer->getBlockBytes() != blockBytes)
+            {
+                delete renderer;
+                renderer = new qtauRenderAhead(mixer, blockBytes, blocks, &mixStats);
+            }
+
+            mixer->prepare(blockFrames);
+            renderer->start(QThread::TimeCriticalPriority);
+            rendering = true;
+        }
+        else
+            mixer->prepare(fmt.sampleRate() / c_rt_block_divider);
+    }
+
+    housekeeping->start(c_housekeeping_ms);
+
+    if (sink->state() == ESinkState::suspended)
+        sink->resume();
+    else
+        if (sink->state() == ESinkState::stopped)
+        {
+            sink->start(this);
+
+            // everything in device buffer is ahead of what's heard, render-ahead fifo is accounted by blocks
+            latencyNSec = sink->bufferBytes() * 1000000000 / bytesPerSecond;
+        }
 }
 
-void qtmmPlayer::onAllEffectsEnded()
+void qtmmPlayer::suspendDevice()
 {
-    if (!effects.isEmpty())
+    if (sink)
     {
-        for (auto &e: effects)
-            delete e;
-
-        effects.clear();
+        stopTimer->stop();
+        sink->suspend();
     }
+
+    holdPlayhead(playhead.frameNow());
 }
 
-void qtmmPlayer::onAllTracksEnded()
+void qtmmPlayer::stopDevice()
 {
-    if (!tracks.isEmpty())
+    if (sink)
     {
-        for (auto &t: tracks)
-            delete t;
+        stopTimer->stop();
+        sink->stop();
+    }
+
+    stopRenderer();
+    mixer->applyCommands(); // sink and renderer don't read anymore, so applying whatever came after the last block here
+
+    holdPlayhead(mixer->framePos()); // stop command rewinds it
+
+    mixerDrained = false;
+    onHousekeeping(); // last signals and cleanup
+    housekeeping->stop();
 
-        tracks.clear();
+    SAudioStats cs = callbackStats.snapshot();
+
+    if (cs.blocks > 0)
+    {
+        vsLog::i("Audio callback: " + cs.toString());
+
+        if (rendering || renderAheadBlocks > 0)
+            vsLog::i("Render-ahead mixing: " + mixStats.snapshot().toString());
     }
 
-    emit playbackEnded();
+    int heapCalls = rtHeapCalls();
+
+    if (heapCalls > 0)
+    {
+        vsLog::e(QString("Audio callback used heap %1 times during playback, expect crackles").arg(heapCalls));
+        rtResetHeapCalls();
+    }
 }
 
-inline QString audioStatusToString(QAudio::State st)
+void qtmmPlayer::holdPlayhead(qint64 frame)
 {
-    QString result = QStringLiteral("unknown");
+    SPlayheadSample ph = playhead.sample();
+    ph.frame   = frame;
+    ph.advance = 0; // isn't extrapolated until callback runs again
+    ph.nsec    = qtauPlayhead::clockNSec();
+    playhead.publish(ph);
+}
 
-    switch (st)
+void qtmmPlayer::onEffectEnded(qtauAudioSource* e) { retired.append(e); }
+void qtmmPlayer::onTrackEnded (qtauAudioSource* t) { retired.append(t); }
+
+void qtmmPlayer::onAllEffectsEnded() {} // each one is reported separately
+void qtmmPlayer::onAllTracksEnded()  { tracksEnded = true; }
+
+void qtmmPlayer::releaseRetired()
+{
+    if (!retired.isEmpty())
     {
-    case QAudio::ActiveState:    result = QStringLiteral("active");    break;
-    case QAudio::IdleState:      result = QStringLiteral("idle");      break;
-    case QAudio::StoppedState:   result = QStringLiteral("stopped");   break;
-    case QAudio::SuspendedState: result = QStringLiteral("suspended"); break;
-    default:
-        break;
-    }
+        for (auto &r: retired)
+            delete r;
 
-    return result;
+        retired.clear();
+        retired.reserve(c_retired_reserved);
+    }
 }
 
-void qtmmPlayer::onQtmmStateChanged(QAudio::State /*st*/)
+void qtmmPlayer::onHousekeeping()
 {
-//    qDebug() << "audio status:" << audioStatusToString(st);
+    mixer->deliverEvents(); // mixing thread only queues them, signals of ended sources are emitted here
+    releaseRetired();
+
+    SAudioStats cs = callbackStats.snapshot();
 
-//    switch (st)   // doesn't really matter now
-//    {
-//    case QAudio::ActiveState:
-//    case QAudio::SuspendedState:
-//        break;
+    if (cs.underruns > loggedUnderruns)
+    {
+        vsLog::d(QString("Audio underrun: mixing didn't keep up %1 times, %2% of block time at most")
+                 .arg(cs.underruns - loggedUnderruns).arg(qRound(mixStats.snapshot().maxLoad * 100)));
+        loggedUnderruns = cs.underruns;
+    }
 
-//    case QAudio::StoppedState:
-//    case QAudio::IdleState:
-//        mixer->clear();
-//        break;
+    if (tracksEnded)
+    {
+        tracksEnded = false;
+        emit playbackEnded();
+    }
 
-//    default:
-//        vsLog::e(QString("Unknown Qtmm Audio state: %1").arg(st));
-//        break;
-//    }
+    if (mixerDrained)
+    {
+        if (!stopTimer->isActive())
+            stopTimer->start(500);
+    }
+    else stopTimer->stop(); // got something to play again
 }
 
-void qtmmPlayer::onTick() { emit tick(audioOutput->processedUSecs()); }
+void qtmmPlayer::onTick() { emit tick(sink->processedUSecs()); }
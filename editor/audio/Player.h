@@ -4,18 +4,23 @@
 #define QTAU_AUDIO_PLAYER_H
 
 #include <QObject>
-#include <QAudio>
 #include <QIODevice>
+#include <atomic>
+#include "audio/Stats.h"
+#include "audio/Playhead.h"
 
-class QAudioOutput;
+class qtauAudioSink;
 class qtauAudioSource;
 class qtauSoundMixer;
+class qtauRenderAhead;
+class qtauLevelMeter;
 
 class QTimer;
 
 
 // player is designed to work in a separate thread to avoid audio glitches on playback
 // stores copies of audio sources, uses mixer to combine their data, adds zeros if asked for more data than mixer has
+// owns all sources given to it, they are deleted by housekeeping when mixer is done with them
 class qtmmPlayer : public QIODevice
 {
     Q_OBJECT
@@ -25,10 +30,10 @@ public:
     ~qtmmPlayer();
 
     bool   isSequential()   const override { return true;   }
-    qint64 pos()            const override { return 0;      }
-    bool   seek(qint64)           override { return false;  }
+    qint64 pos()            const override; // mixer timeline position, in bytes of output format
+    bool   seek(qint64 pos)       override; // posts timeline seek to mixer, safe from controller thread
     bool   atEnd()          const override { return bytesAvailable() == 0;   }
-    bool   reset()                override { return false;  }
+    bool   reset()                override { return seek(0); }
     qint64 bytesAvailable() const override { return size(); }
     qint64 size()           const override;
 
@@ -36,7 +41,7 @@ signals:
     void playbackEnded();
     void tick(qint64 mcsec);
 
-public slots: // all slots should be called indirectly with connect + emit because player is in separate thread
+public: // safe to call directly from controller thread (only from one), passed to mixer through its command queue
     void addEffect(qtauAudioSource *e, bool replace = false, bool smoothly = true, bool copy = true);
     void addTrack (qtauAudioSource *t, bool replace = false, bool smoothly = true, bool copy = true);
 
@@ -46,10 +51,34 @@ public slots: // all slots should be called indirectly with connect + emit becau
 
     void setVolume(int level); // 0..100
 
+    void seekFrame(qint64 frame); // sample-accurate, for mixer timeline
+    void seekPulse(qint64 pulse, int tempo);
+
+    // mixer jumps from end of region to its start without a gap, empty region stops looping
+    void setLoopPulses(qint64 startPulse, qint64 endPulse, int tempo);
+    bool isInLoop(qint64 startPulse, qint64 endPulse, int tempo) const; // if playback position is in that region
+
+    void setResampleQuality(int quality); // 0..2 (fast, medium, best), for sources added after this
+    void setCrossfade(int ms);            // length of smooth replacement of tracks and effects
+
+    // mixing this many short blocks ahead in a separate thread, 0 to mix in audio callback. Used on next start.
+    void setRenderAhead(int blocks);
+
+    // where audio goes, see makeSink() in Sink.h. Used by threadedInit, so should be set before audio thread starts
+    void setSink(const QString &description) { sinkDescription = description; }
+
+    // timing since last start from stopped state, safe to read from any thread while playing
+    SAudioStats getCallbackStats() const { return callbackStats.snapshot(); } // whole readData
+    SAudioStats getMixStats()      const { return mixStats.snapshot();      } // mixing, in callback or render-ahead
+
+    // what's heard now, updated by audio callback every block, for GUI to poll at its frame rate
+    const qtauPlayhead& getPlayhead() const { return playhead; }
+    const qtauLevelMeter& getLevels() const; // master levels of mixer, same way
+
+public slots:
     void threadedInit(); // should be called after instance is moved to a separate thread
 
 private slots:
-    void onQtmmStateChanged(QAudio::State);
     void onTick();
 
     void onEffectEnded(qtauAudioSource* e);
@@ -58,18 +87,44 @@ private slots:
     void onAllEffectsEnded();
     void onAllTracksEnded();
 
+    void onHousekeeping(); // does everything that audio callback shouldn't: deleting, signalling, stopping
+
+    void startDevice();   // device control is queued to audio thread by play/pause/stop
+    void suspendDevice();
+    void stopDevice();
+
 protected:
     qint64 readData(char *data, qint64 maxlen) override;
     qint64 writeData(const char *, qint64)     override { return 0; }
 
-    QList<qtauAudioSource*> tracks;  // copies are stored here to ensure playback if originals will change
-    QList<qtauAudioSource*> effects; // tracks and effects are read in a separate thread
+    QList<qtauAudioSource*> retired; // ended in audio callback, deleted later by housekeeping
 
-    QAudioOutput   *audioOutput;
+    qtauAudioSink  *sink;
+    QString         sinkDescription;
     qtauSoundMixer *mixer;
+    qtauRenderAhead *renderer;
     QTimer         *stopTimer;
+    QTimer         *housekeeping;
+
+    std::atomic<int> renderAheadBlocks;
+    bool rendering;     // render-ahead thread is running, audio callback reads its fifo
+
+    std::atomic<bool> mixerDrained; // set by audio callback (maybe sink's thread) when mixer gave nothing
+
+    qtauAudioStats callbackStats;
+    qtauAudioStats mixStats;
+    qint64  bytesPerSecond;   // of output format, for block durations
+    int     bytesPerFrame;
+    quint64 loggedUnderruns;  // reported by housekeeping so far
+
+    qtauPlayhead playhead;    // written only from audio thread: callback and device control
+    qint64  latencyNSec;      // of device buffer, measured when it starts
+    int     sampleRate;
+    std::atomic<bool> tracksEnded;  // set by audio callback when last track has ended
 
-    int volume;
+    void releaseRetired();
+    void stopRenderer();
+    void holdPlayhead(qint64 frame); // when device is paused or stopped
 
 };
 
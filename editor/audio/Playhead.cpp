@@ -0,0 +1,49 @@
+/* Playhead.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/Playhead.h"
+#include <QElapsedTimer>
+
+
+qtauPlayhead::qtauPlayhead()
+{
+    clockNSec(); // starts the clock before audio callback could
+}
+
+qint64 qtauPlayhead::clockNSec()
+{
+    static QElapsedTimer clock; // monotonic, initialized once in a thread-safe way
+    static bool started = (clock.start(), true);
+    Q_UNUSED(started)
+
+    return clock.nsecsElapsed();
+}
+
+void qtauPlayhead::publish(const SPlayheadSample &s)
+{
+    published.store(s);
+}
+
+SPlayheadSample qtauPlayhead::sample() const
+{
+    return published.load();
+}
+
+qint64 qtauPlayhead::frameAt(qint64 t) const
+{
+    const SPlayheadSample s = sample();
+    qint64 result = s.frame;
+
+    if (s.advance > 0)
+    {
+        // block starts to sound after output latency, and won't go past its end until next one is published
+        const qint64 heardNSec = t - s.nsec - s.latencyNSec;
+        result = qBound((qint64)0, s.frame + heardNSec * s.sampleRate / 1000000000, s.frame + s.advance);
+
+        // mixer jumped back to loop start at its end, blocks crossing it are counted as if it didn't;
+        // playback that is past loop end already isn't wrapped by mixer, but controller seeks into loop anyway
+        if (s.loopEnd > s.loopStart && s.frame >= s.loopStart && result >= s.loopEnd)
+            result = s.loopStart + (result - s.loopEnd) % (s.loopEnd - s.loopStart);
+    }
+
+    return result;
+}
@@ -0,0 +1,46 @@
+/* Playhead.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_PLAYHEAD_H
+#define QTAU_AUDIO_PLAYHEAD_H
+
+#include "audio/Seqlock.h"
+
+// what audio callback gave to device in one block, and when
+typedef struct SPlayheadSample {
+    qint64 frame;       // timeline frame of first sample in block
+    qint64 advance;     // timeline frames in block, 0 if timeline didn't move (effects only, paused)
+    qint64 loopStart;   // loop region, frame + advance wraps in it. Empty if not looping
+    qint64 loopEnd;
+    qint64 nsec;        // qtauPlayhead::clockNSec() when block was given to device
+    qint64 latencyNSec; // from giving a sample to device to hearing it
+    int    sampleRate;
+
+    SPlayheadSample() : frame(0), advance(0), loopStart(0), loopEnd(0), nsec(0), latencyNSec(0), sampleRate(44100) {}
+} SPlayheadSample;
+
+
+/* Position of playback on mixer timeline, published by audio callback every block and readable from any thread
+ * without locks or signals, through a seqlock (see qtauSeqlock). One writer only.
+ * GUI calls frameAt() at its own frame rate and gets a smooth playhead extrapolated from last block. */
+class qtauPlayhead
+{
+public:
+    qtauPlayhead();
+
+    // writer side, from audio callback
+    void publish(const SPlayheadSample &s);
+
+    // any thread
+    SPlayheadSample sample() const;
+    qint64 frameAt(qint64 nsec) const; // timeline frame that's heard at that time
+    qint64 frameNow() const { return frameAt(clockNSec()); }
+
+    static qint64 clockNSec(); // monotonic clock shared by writer and readers
+
+protected:
+    qtauSeqlock<SPlayheadSample> published;
+
+    Q_DISABLE_COPY(qtauPlayhead)
+};
+
+#endif // QTAU_AUDIO_PLAYHEAD_H
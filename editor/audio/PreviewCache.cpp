@@ -0,0 +1,121 @@
+/* PreviewCache.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/PreviewCache.h"
+#include "audio/Source.h"
+#include "PluginInterfaces.h"
+#include "Utils.h"
+
+#include <QElapsedTimer>
+
+
+qtauPreviewCache::qtauPreviewCache(ISynth *s, QMutex &synthLock, QObject *parent) :
+    QThread(parent), synth(s), lock(synthLock), firstKey(0), lastKey(-1)
+{
+    for (int i = 0; i < c_preview_keys; ++i)
+        keys[i].store(nullptr, std::memory_order_relaxed);
+}
+
+qtauPreviewCache::~qtauPreviewCache()
+{
+    clear();
+}
+
+void qtauPreviewCache::warm(int first, int last)
+{
+    requestInterruption();
+    wait();
+
+    firstKey = qBound(0, first, c_preview_keys - 1);
+    lastKey  = qBound(0, last,  c_preview_keys - 1);
+
+    start(QThread::LowPriority);
+}
+
+void qtauPreviewCache::clear()
+{
+    requestInterruption();
+    wait();
+
+    // player plays copies that share pcm, so cached sources can go right away
+    for (int i = 0; i < c_preview_keys; ++i)
+        delete keys[i].exchange(nullptr, std::memory_order_acq_rel);
+}
+
+qtauAudioSource* qtauPreviewCache::get(int key) const
+{
+    qtauAudioSource *result = nullptr;
+
+    if (key >= 0 && key < c_preview_keys)
+        result = keys[key].load(std::memory_order_acquire);
+
+    return result;
+}
+
+qtauAudioSource* qtauPreviewCache::render(int key)
+{
+    qtauAudioSource *result = get(key);
+
+    if (!result && key >= 0 && key < c_preview_keys)
+    {
+        QMutexLocker l(&lock);
+        result = renderKey(key);
+
+        if (!result)
+            vsLog::d(QString("Synth %1 could not render preview of key %2").arg(synth->name()).arg(key));
+    }
+
+    return result;
+}
+
+qtauAudioSource* qtauPreviewCache::renderKey(int key)
+{
+    qtauAudioSource *result = keys[key].load(std::memory_order_acquire);
+
+    if (!result) // may have been rendered while waiting for lock
+    {
+        ust u;
+        u.tempo = c_preview_tempo;
+        u.notes.append(ust_note(0, "a", 0, c_preview_pulses, key));
+
+        qtauAudioSource *a = new qtauAudioSource();
+
+        if (synth->setVocals(u) && synth->synthesize(*a) && a->size() > 0)
+        {
+            a->close(); // synth wrote it, player only reads copies
+            result = a;
+            keys[key].store(a, std::memory_order_release);
+        }
+        else
+            delete a;
+    }
+
+    return result;
+}
+
+void qtauPreviewCache::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+    int rendered = 0;
+    int failed   = 0;
+
+    // keys around the middle are pressed most, so they're ready first
+    const int middle = (firstKey + lastKey) / 2;
+
+    for (int i = 0; i <= 2 * (lastKey - firstKey) && !isInterruptionRequested(); ++i)
+    {
+        const int key = (i % 2) ? middle - (i + 1) / 2 : middle + i / 2;
+
+        if (key >= firstKey && key <= lastKey && !get(key))
+        {
+            QMutexLocker l(&lock); // one key at a time, so score synthesis doesn't wait for all of them
+
+            if (renderKey(key))
+                ++rendered;
+            else
+                ++failed;
+        }
+    }
+
+    emit warmed(rendered, failed, timer.elapsed());
+}
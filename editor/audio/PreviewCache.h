@@ -0,0 +1,55 @@
+/* PreviewCache.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_PREVIEWCACHE_H
+#define QTAU_AUDIO_PREVIEWCACHE_H
+
+#include <QThread>
+#include <QMutex>
+#include <atomic>
+
+class ISynth;
+class qtauAudioSource;
+
+const int c_preview_keys   = 128;     // MIDI note numbers
+const int c_preview_pulses = 480 * 3; // 3 quarter notes at 120bpm, 1.5 sec
+const int c_preview_tempo  = 120;
+
+
+/* Pre-rendered piano key previews for voicebank of a synth, so that pressing a key only posts a ready source
+ * to player. Warmed in its own thread, from the middle of key range outwards. Synth isn't thread-safe, so
+ * everything that uses it (this cache and controller) does it under same synthLock.
+ * Rendered sources are published atomically: get() is lock-free from any thread, and they don't change
+ * until clear(), which should be called when synth gets another voicebank. Worker doesn't log (vsLog isn't
+ * thread-safe), it reports with warmed() signal when it's done. */
+class qtauPreviewCache : public QThread
+{
+    Q_OBJECT
+
+public:
+    qtauPreviewCache(ISynth *s, QMutex &synthLock, QObject *parent = 0);
+    ~qtauPreviewCache();
+
+    void warm(int firstKey, int lastKey); // renders keys that aren't cached yet in background
+    void clear();                         // stops warming and drops everything rendered
+
+    qtauAudioSource* get(int key) const;  // nullptr if it isn't rendered yet
+    qtauAudioSource* render(int key);     // from cache, or rendered right away in caller's thread
+
+signals:
+    void warmed(int rendered, int failed, qint64 msec); // emitted from warming thread
+
+protected:
+    void run() override;
+
+    ISynth *synth;
+    QMutex &lock;
+    int     firstKey;
+    int     lastKey;
+
+    std::atomic<qtauAudioSource*> keys[c_preview_keys];
+
+    qtauAudioSource* renderKey(int key); // under lock
+
+};
+
+#endif // QTAU_AUDIO_PREVIEWCACHE_H
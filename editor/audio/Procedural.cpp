@@ -0,0 +1,316 @@
+/* Procedural.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/Procedural.h"
+#include "Utils.h"
+#include <string.h>
+#include <cmath>
+
+#ifdef QTAU_SSE2
+    #include <emmintrin.h>
+#endif
+
+const double c_two_pi = 6.283185307179586;
+
+
+void qtauOscillatorBank::clear()
+{
+    for (int i = 0; i < c_osc_partials; ++i)
+    {
+        re[i] = 1; im[i] = 0;
+        wr[i] = 1; wi[i] = 0;
+        amp[i]    = 0;
+        hz[i]     = 0;
+        phase0[i] = 0;
+    }
+
+    count = 0;
+}
+
+bool qtauOscillatorBank::addPartial(double freq, float amplitude, double phase)
+{
+    bool result = count < c_osc_partials;
+
+    if (result)
+    {
+        hz    [count] = freq;
+        amp   [count] = amplitude;
+        phase0[count] = phase;
+        ++count;
+    }
+
+    return result;
+}
+
+void qtauOscillatorBank::start(qint64 frame, int sampleRate)
+{
+    sampleRate = qMax(sampleRate, 1);
+
+    for (int i = 0; i < count; ++i)
+    {
+        // whole periods are dropped in integers first, so that phase stays exact far from timeline start
+        const double step   = hz[i] / sampleRate;
+        const double whole  = std::fmod(hz[i], 1.0) * (double)(frame / sampleRate); // full seconds
+        const double cycles = std::fmod(whole + step * (double)(frame % sampleRate), 1.0);
+        const double phase  = phase0[i] + c_two_pi * cycles;
+
+        re[i] = std::cos(phase);
+        im[i] = std::sin(phase);
+        wr[i] = std::cos(c_two_pi * step);
+        wi[i] = std::sin(c_two_pi * step);
+    }
+}
+
+void qtauOscillatorBank::render(float *dst, int frames)
+{
+    int f = 0;
+
+#ifdef QTAU_SSE2
+    const int v = c_osc_partials / 2; // each vector holds two partials
+    __m128d r[v], i[v], c[v], s[v], a[v];
+
+    for (int k = 0; k < v; ++k)
+    {
+        r[k] = _mm_loadu_pd(re  + k * 2);
+        i[k] = _mm_loadu_pd(im  + k * 2);
+        c[k] = _mm_loadu_pd(wr  + k * 2);
+        s[k] = _mm_loadu_pd(wi  + k * 2);
+        a[k] = _mm_loadu_pd(amp + k * 2);
+    }
+
+    for (; f < frames; ++f)
+    {
+        __m128d sum = _mm_setzero_pd();
+
+        for (int k = 0; k < v; ++k)
+        {
+            sum = _mm_add_pd(sum, _mm_mul_pd(i[k], a[k]));
+
+            // (re + i*im) *= (wr + i*wi)
+            const __m128d nr = _mm_sub_pd(_mm_mul_pd(r[k], c[k]), _mm_mul_pd(i[k], s[k]));
+            i[k] = _mm_add_pd(_mm_mul_pd(r[k], s[k]), _mm_mul_pd(i[k], c[k]));
+            r[k] = nr;
+        }
+
+        dst[f] = (float)_mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+    }
+
+    for (int k = 0; k < v; ++k)
+    {
+        _mm_storeu_pd(re + k * 2, r[k]);
+        _mm_storeu_pd(im + k * 2, i[k]);
+    }
+#endif
+
+    for (; f < frames; ++f)
+    {
+        double sum = 0;
+
+        for (int k = 0; k < c_osc_partials; ++k)
+        {
+            sum += im[k] * amp[k];
+
+            const double nr = re[k] * wr[k] - im[k] * wi[k];
+            im[k] = re[k] * wi[k] + im[k] * wr[k];
+            re[k] = nr;
+        }
+
+        dst[f] = (float)sum;
+    }
+
+    // rounding slowly changes phasor lengths, one Newton step pulls them back to 1
+    for (int k = 0; k < c_osc_partials; ++k)
+    {
+        const double n = 1.5 - 0.5 * (re[k] * re[k] + im[k] * im[k]);
+        re[k] *= n;
+        im[k] *= n;
+    }
+}
+
+//------------------------------------------------------------------
+
+qtauProceduralSource::qtauProceduralSource(qint64 lenMS, int sampleRate, QObject *parent) :
+    qtauAudioSource(parent), lengthMS(qMax(lenMS, (qint64)0)), length(0), frame(0), continues(-1)
+{
+    fmt.setByteOrder(QAudioFormat::LittleEndian);
+    fmt.setCodec("audio/pcm");
+    fmt.setChannelCount(2);
+    fmt.setSampleSize(32);
+    fmt.setSampleType(QAudioFormat::Float);
+
+    setSampleRate(sampleRate);
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+void qtauProceduralSource::setSampleRate(int rate)
+{
+    rate = qMax(rate, 1);
+
+    if (rate != fmt.sampleRate() || length == 0)
+    {
+        if (fmt.sampleRate() > 0)
+            frame = frame * rate / fmt.sampleRate();
+
+        fmt.setSampleRate(rate);
+        length    = lengthMS * rate / 1000;
+        continues = -1;
+    }
+}
+
+bool qtauProceduralSource::seek(qint64 pos)
+{
+    frame = qBound((qint64)0, pos / fmt.bytesPerFrame(), length);
+    return true;
+}
+
+qint64 qtauProceduralSource::render(float *busL, float *busR, qint64 frames, const SGainRamp &g, SBlockLevels *levels)
+{
+    const qint64 result = qBound((qint64)0, length - frame, frames);
+
+    if (result > 0 && !g.isSilent()) // muted one just moves on, like a muted PCM source is still read
+    {
+        float chunk[c_procedural_chunk];
+        const float stepL = (g.toL - g.fromL) / result;
+        const float stepR = (g.toR - g.fromR) / result;
+
+        if (frame != continues)
+            restart(frame);
+
+        for (qint64 done = 0; done < result; )
+        {
+            const int n = (int)qMin(result - done, (qint64)c_procedural_chunk);
+            synthesize(chunk, n, frame + done);
+
+            // part of block's ramp that falls on this chunk
+            const SGainRamp cg(g.fromL + stepL * done, g.fromR + stepR * done,
+                               g.fromL + stepL * (done + n), g.fromR + stepR * (done + n));
+            mixToBus(ESampleFormat::F32, reinterpret_cast<const char*>(chunk), 1, n,
+                     busL + done, busR + done, cg, levels);
+            done += n;
+        }
+
+        continues = frame + result;
+    }
+
+    frame += result;
+
+    return result;
+}
+
+qint64 qtauProceduralSource::readData(char *data, qint64 maxlen)
+{
+    const int frameBytes = fmt.bytesPerFrame();
+    qint64 frames = qBound((qint64)0, length - frame, maxlen / frameBytes);
+    float *out = reinterpret_cast<float*>(data);
+
+    if (frames > 0 && frame != continues)
+        restart(frame);
+
+    for (qint64 done = 0; done < frames; )
+    {
+        float chunk[c_procedural_chunk];
+        const int n = (int)qMin(frames - done, (qint64)c_procedural_chunk);
+        synthesize(chunk, n, frame + done);
+
+        for (int i = 0; i < n; ++i)
+            out[(done + i) * 2] = out[(done + i) * 2 + 1] = chunk[i];
+
+        done += n;
+    }
+
+    frame    += frames;
+    continues = frame;
+
+    return frames * frameBytes;
+}
+
+//------------------------------------------------------------------
+
+qtauToneSource::qtauToneSource(const SWavegenSetup &s, QObject *parent) :
+    qtauProceduralSource(s.lengthMS, s.sampleRate, parent)
+{
+    // lower octave harmonic makes tone less hurtful for ears, small phase shifts colorize the wave
+    const float maxAmplitude = 0.85f;
+
+    bank.addPartial(s.frequencyHz,     maxAmplitude * 0.70f, 0.1);
+    bank.addPartial(s.frequencyHz / 2, maxAmplitude * 0.15f, 0.2);
+    bank.addPartial(s.frequencyHz * 2, maxAmplitude * 0.08f, 0.0);
+    bank.addPartial(s.frequencyHz * 3, maxAmplitude * 0.07f, 0.25);
+}
+
+void qtauToneSource::synthesize(float *dst, int frames, qint64 first)
+{
+    bank.render(dst, frames);
+
+    // silence at both ends, linear fades next to it
+    const qint64 fade    = qMax((qint64)fmt.sampleRate() * c_tone_fade_ms / 1000, (qint64)1);
+    const qint64 toneEnd = length - c_tone_silence_frames;
+
+    for (int i = 0; i < frames; ++i)
+    {
+        const qint64 fr = first + i;
+        const qint64 edge = qMin(fr - c_tone_silence_frames, toneEnd - fr); // distance to nearest silence
+
+        if (edge < fade)
+            dst[i] *= (edge > 0) ? (float)edge / fade : 0.f;
+    }
+}
+
+//------------------------------------------------------------------
+
+qtauMetronomeSource::qtauMetronomeSource(int t, qint64 lengthMS, int bpb, int sampleRate, QObject *parent) :
+    qtauProceduralSource(lengthMS, sampleRate, parent), tempo(qMax(t, 1)), beatsPerBar(qMax(bpb, 1))
+{
+    //
+}
+
+qint64 qtauMetronomeSource::beatFrame(qint64 beat) const
+{
+    // same rounding as qtauSoundMixer::pulsesToFrames gives for beat * c_midi_ppq pulses
+    return beat * 60 * fmt.sampleRate() / tempo;
+}
+
+void qtauMetronomeSource::synthesize(float *dst, int frames, qint64 first)
+{
+    const int    rate      = fmt.sampleRate();
+    const qint64 clickLen  = (qint64)rate * c_click_ms / 1000;
+    const double decay     = std::exp(-1.0 / (0.006 * rate)); // per frame, ~6ms time constant
+    const qint64 end       = first + frames;
+
+    memset(dst, 0, frames * sizeof(float));
+
+    // last beat that started at or before first frame, its click may still be sounding
+    qint64 beat = first * tempo / (60LL * rate);
+
+    while (beat > 0 && beatFrame(beat) > first)  --beat;
+    while (beatFrame(beat + 1) <= first)          ++beat;
+
+    for (qint64 start = beatFrame(beat); start < end; start = beatFrame(++beat))
+    {
+        const qint64 from = qMax(start, first);
+        const qint64 to   = qMin(start + clickLen, end);
+
+        if (from < to)
+        {
+            const bool   accent = beat % beatsPerBar == 0;
+            const double w      = c_two_pi * (accent ? 1600.0 : 1000.0) / rate;
+            const double a      = accent ? 0.6 : 0.4;
+
+            // state at first frame in chunk is computed directly, then decaying phasor is turned frame by frame
+            const double t0 = (double)(from - start);
+            const double m  = a * std::pow(decay, t0);
+            double re = m * std::cos(w * t0);
+            double im = m * std::sin(w * t0);
+            const double cr = decay * std::cos(w);
+            const double ci = decay * std::sin(w);
+
+            for (qint64 f = from; f < to; ++f)
+            {
+                dst[f - first] += (float)im;
+
+                const double nr = re * cr - im * ci;
+                im = re * ci + im * cr;
+                re = nr;
+            }
+        }
+    }
+}
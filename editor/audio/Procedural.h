@@ -0,0 +1,140 @@
+/* Procedural.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_PROCEDURAL_H
+#define QTAU_AUDIO_PROCEDURAL_H
+
+#include "audio/Source.h"
+#include "audio/Kernels.h"
+
+const int c_procedural_chunk    = 256; // frames rendered at once on stack, mixer blocks are split in those
+const int c_osc_partials        = 8;   // oscillators in a bank, four SSE2 double vectors
+const int c_tone_silence_frames = 10;  // at both ends of a tone
+const int c_tone_fade_ms        = 50;
+const int c_click_ms            = 40;  // length of metronome click, it decays long before that
+
+
+typedef struct WavegenSetup {
+    qint64 lengthMS;
+    float  frequencyHz;
+    int    sampleRate;
+    bool   stereo; // ignored, procedural sources are always stereo
+
+    WavegenSetup(qint64 len, float freq, int sr, bool st = false) :
+        lengthMS(len), frequencyHz(freq), sampleRate(sr), stereo(st) {}
+} SWavegenSetup;
+
+
+/* Sum of up to c_osc_partials sine oscillators. Each one is a phasor turned by a complex multiplication
+ * every frame, so all of them cost a few vector multiply-adds per frame, with no table and no sin() calls.
+ * Phases are computed exactly from frame number in start(), magnitudes are renormalized after each render. */
+class qtauOscillatorBank
+{
+public:
+    qtauOscillatorBank() { clear(); }
+
+    void clear();
+    bool addPartial(double hz, float amplitude, double phase = 0); // false if bank is full
+
+    void start(qint64 frame, int sampleRate); // phases as if bank was running since frame 0
+    void render(float *dst, int frames);      // writes (doesn't add) sum of all partials
+
+    int size() const { return count; }
+
+protected:
+    // structure of arrays, unused partials have zero amplitude. Doubles, float phasors drift audibly in minutes
+    double re [c_osc_partials]; // cos of current phase
+    double im [c_osc_partials]; // sin of current phase, that's what is heard
+    double wr [c_osc_partials]; // cos and sin of phase step
+    double wi [c_osc_partials];
+    double amp[c_osc_partials];
+
+    double hz    [c_osc_partials];
+    double phase0[c_osc_partials];
+    int count;
+};
+
+
+/* Source without PCM buffer: mixer asks it to render every block right into its float bus, at mixer's
+ * sample rate, so nothing is stored and nothing is computed before playback. Position is in frames of that
+ * rate, like mixer it's a sequential device with its own pos/seek. Reading it as a plain device gives
+ * interleaved F32 stereo. Copying such source makes no sense, it should be passed to player as is. */
+class qtauProceduralSource : public qtauAudioSource
+{
+    Q_OBJECT
+
+public:
+    explicit qtauProceduralSource(qint64 lengthMS, int sampleRate = 44100, QObject *parent = 0);
+
+    bool   isProcedural() const override { return true; }
+    qint64 render(float *busL, float *busR, qint64 frames, const SGainRamp &g, SBlockLevels *levels = nullptr) override;
+
+    void   setSampleRate(int rate); // keeps position in time, not thread-safe - mixer calls it when preparing
+    qint64 framePos() const { return frame; }
+
+    //--- QIODevice interface functions ---------
+    bool   isSequential()   const override { return true; }
+    qint64 pos()            const override { return frame  * fmt.bytesPerFrame(); }
+    qint64 size()           const override { return length * fmt.bytesPerFrame(); }
+    bool   seek(qint64 pos)       override;
+    bool   reset()                override { return seek(0); }
+    bool   atEnd()          const override { return frame >= length; }
+    qint64 bytesAvailable() const override { return size() - pos(); }
+    qint64 bytesToWrite()   const override { return 0; }
+    //-------------------------------------------
+
+protected:
+    qint64 lengthMS;
+    qint64 length;    // in frames
+    qint64 frame;     // next frame to render
+    qint64 continues; // frame that follows last synthesized one, anything else is a jump
+
+    // writes "frames" mono frames starting from "first" to dst, frames never exceed c_procedural_chunk
+    virtual void synthesize(float *dst, int frames, qint64 first) = 0;
+    virtual void restart(qint64 first) = 0; // position jumped (or rate changed), called before synthesize
+
+    qint64 readData(char *data, qint64 maxlen) override;
+    qint64 writeData(const char *, qint64)     override { return 0; }
+
+};
+
+
+// periodic tone colored with a few harmonics, with smooth fade in and out, to test audio output
+class qtauToneSource : public qtauProceduralSource
+{
+    Q_OBJECT
+
+public:
+    explicit qtauToneSource(const SWavegenSetup &s, QObject *parent = 0);
+
+protected:
+    qtauOscillatorBank bank;
+
+    void synthesize(float *dst, int frames, qint64 first) override;
+    void restart(qint64 first) override { bank.start(first, fmt.sampleRate()); }
+
+};
+
+
+/* Decaying sine click on every beat at given tempo, first beat of each bar is higher and louder.
+ * Beat k starts exactly on the frame where mixer puts pulse k*c_midi_ppq, so clicks stay on timeline
+ * through seeks and loops. Starts at timeline start, should be added to mixer as a track. */
+class qtauMetronomeSource : public qtauProceduralSource
+{
+    Q_OBJECT
+
+public:
+    explicit qtauMetronomeSource(int tempo, qint64 lengthMS, int beatsPerBar = 4, int sampleRate = 44100,
+                                 QObject *parent = 0);
+
+protected:
+    int tempo;
+    int beatsPerBar;
+
+    qint64 beatFrame(qint64 beat) const;
+
+    void synthesize(float *dst, int frames, qint64 first) override;
+    void restart(qint64) override {} // every click is computed from its beat frame, nothing to keep
+
+};
+
+#endif // QTAU_AUDIO_PROCEDURAL_H
@@ -0,0 +1,122 @@
+/* RenderAhead.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/RenderAhead.h"
+#include "audio/Mixer.h"
+#include "audio/Stats.h"
+#include <QElapsedTimer>
+
+
+qtauRenderAhead::qtauRenderAhead(qtauSoundMixer *m, int blockBytes, int blocks, qtauAudioStats *stats,
+                                 QObject *parent) :
+    QThread(parent), mixer(m), stats(stats), fifo(blockBytes * blocks), positions(fifo.capacity() / blockBytes + 1),
+    blockBytes(blockBytes), blocks(blocks), fillBytes(blockBytes * blocks), blockRead(0), drained(false),
+    lastSeekCount(m->seekCount()), flushPos(0), flushBlock(0), flushCount(0), readFlushCount(0)
+{
+    block.resize(blockBytes);
+
+    const QAudioFormat &f = mixer->getAudioFormat();
+    frameBytes = qMax(1, f.bytesPerFrame());
+    blockUSec    = (qint64)blockBytes * 1000000 / qMax(1, f.bytesPerFrame() * f.sampleRate());
+    minSleepUSec = (int)qMax((qint64)500, blockUSec / 4);
+    blockNSec = blockUSec * 1000;
+}
+
+qint64 qtauRenderAhead::read(char *data, qint64 maxlen, qint64 *frame, qint64 *advance)
+{
+    const unsigned fc = flushCount.load(std::memory_order_acquire);
+
+    if (fc != readFlushCount)
+    {
+        readFlushCount = fc;
+        fifo.discardTo(flushPos.load(std::memory_order_relaxed));
+        positions.discardTo(flushBlock.load(std::memory_order_relaxed));
+        blockRead = 0;
+    }
+
+    qint64 result = fifo.read(data, (int)qMin(maxlen, (qint64)fifo.capacity()));
+
+    // following given bytes through blocks they belong to, positions of block are written before its data
+    SRenderedBlock b;
+    qint64 left = result;
+    qint64 moved = 0;
+    bool   first = true;
+
+    while (positions.peek(b))
+    {
+        if (first)
+        {
+            if (frame)
+                *frame = b.frame + qMin((qint64)blockRead / frameBytes, b.advance);
+
+            first = false;
+        }
+
+        if (left <= 0)
+            break;
+
+        const int taken = (int)qMin(left, (qint64)(b.bytes - blockRead));
+        moved += qMin((qint64)(blockRead + taken) / frameBytes, b.advance) - qMin((qint64)blockRead / frameBytes, b.advance);
+        blockRead += taken;
+        left      -= taken;
+
+        if (blockRead >= b.bytes)
+        {
+            positions.pop(b);
+            blockRead = 0;
+        }
+    }
+
+    if (advance)
+        *advance = moved;
+
+    return result;
+}
+
+void qtauRenderAhead::run()
+{
+    char *b = block.data();
+    QElapsedTimer timer;
+
+    while (!isInterruptionRequested())
+    {
+        // fill fifo up to "blocks" blocks, whole blocks only
+        while (fifo.readAvailable() + blockBytes <= fillBytes && fifo.writeAvailable() >= blockBytes &&
+               positions.writeAvailable() > 0 && !isInterruptionRequested())
+        {
+            timer.start();
+            mixer->applyCommands(); // so that block starts where a seek put it
+            const qint64 from = mixer->framePos();
+            const qint64 advancedBefore = mixer->advancedFrames(); // block may jump to loop start in the middle
+            qint64 got = mixer->read(b, blockBytes);
+
+            if (stats && got > 0)
+                stats->addBlock(timer.nsecsElapsed(), blockNSec);
+
+            if (mixer->seekCount() != lastSeekCount) // what's in fifo is from before the seek, reader should skip it
+            {
+                lastSeekCount = mixer->seekCount();
+                flushPos.store(fifo.writePosition(), std::memory_order_relaxed);
+                flushBlock.store(positions.writePosition(), std::memory_order_relaxed);
+                flushCount.fetch_add(1, std::memory_order_release);
+            }
+
+            if (got > 0)
+            {
+                positions.push(SRenderedBlock(from, mixer->advancedFrames() - advancedBefore, (int)got));
+                fifo.write(b, got);
+                drained.store(false, std::memory_order_release);
+            }
+            else
+            {
+                if (!mixer->isPaused())
+                    drained.store(true, std::memory_order_release);
+
+                break;
+            }
+        }
+
+        // half of what's queued is surely still there after that, reader is never waited for or woken up
+        const qint64 queuedUSec = (qint64)fifo.readAvailable() * blockUSec / qMax(blockBytes, 1);
+        usleep((unsigned long)qMax((qint64)minSleepUSec, queuedUSec / 2));
+    }
+}
@@ -0,0 +1,77 @@
+/* RenderAhead.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_RENDERAHEAD_H
+#define QTAU_AUDIO_RENDERAHEAD_H
+
+#include "audio/SpscRing.h"
+#include <QThread>
+#include <QByteArray>
+
+class qtauSoundMixer;
+class qtauAudioStats;
+
+// timeline position of one block in fifo, so that reader knows what it plays
+typedef struct SRenderedBlock {
+    qint64 frame;   // timeline frame of first sample
+    qint64 advance; // timeline frames in it, less than its size when tracks end or effects play alone.
+                    // Counted through loop jumps, so frame + advance may be past loop end
+    int    bytes;
+
+    SRenderedBlock(qint64 f = 0, qint64 a = 0, int b = 0) : frame(f), advance(a), bytes(b) {}
+} SRenderedBlock;
+
+
+/* Render-ahead mode of player: mixes up to "blocks" blocks in advance into a FIFO, audio callback only copies from it.
+ * Latency is blocks * block length, independent from device buffer size, and mixing can't stall the callback.
+ * While thread is running it's the only one reading mixer (and so applying its commands). */
+class qtauRenderAhead : public QThread
+{
+    Q_OBJECT
+
+public:
+    // stats get mixing time of each block, may be null
+    qtauRenderAhead(qtauSoundMixer *m, int blockBytes, int blocks, qtauAudioStats *stats = nullptr,
+                    QObject *parent = 0);
+
+    /* Audio callback side, gives what's rendered, up to maxlen bytes. Skips what was rendered before a seek.
+     * If asked, tells timeline frame of first given byte and how far timeline went in what was given. */
+    qint64 read(char *data, qint64 maxlen, qint64 *frame = nullptr, qint64 *advance = nullptr);
+
+    // true if mixer gave nothing when asked last time, and wasn't paused
+    bool isDrained() const { return drained.load(std::memory_order_acquire); }
+
+    // should be called only when thread is stopped
+    void flush() { fifo.discard(); positions.discard(); blockRead = 0; drained.store(false, std::memory_order_release); }
+
+    int getBlocks()     const { return blocks;     }
+    int getBlockBytes() const { return blockBytes; }
+
+protected:
+    void run() override;
+
+    qtauSoundMixer   *mixer;
+    qtauAudioStats   *stats;
+    qtauSpscRing<char> fifo;
+    qtauSpscRing<SRenderedBlock> positions; // one for each block in fifo, written before its data
+    QByteArray         block; // mixer output is written here before going to fifo
+
+    int blockBytes;
+    int blocks;
+    int frameBytes;
+    int fillBytes;  // blocks * blockBytes, fifo capacity is rounded up and may hold almost twice that
+    int blockRead;  // bytes of first block in positions that reader has already given out
+    int minSleepUSec; // when fifo is almost empty (or mixer has drained), checks a few times per block
+    qint64 blockUSec;
+    qint64 blockNSec;
+
+    std::atomic<bool> drained;
+
+    int lastSeekCount;                // mixer seeks seen by rendering thread
+    std::atomic<unsigned> flushPos;   // fifo position where audio after the last seek starts
+    std::atomic<unsigned> flushBlock; // same for positions
+    std::atomic<unsigned> flushCount; // incremented after flushPos is set
+    unsigned readFlushCount;          // last flushCount seen by reader
+
+};
+
+#endif // QTAU_AUDIO_RENDERAHEAD_H
@@ -3,286 +3,308 @@
 #include "Resampler.h"
 #include "Utils.h"
 
-#include <qendian.h>
+#include <qmath.h>
+
+#ifdef QTAU_SSE2
+    #include <emmintrin.h>
+#endif
 
 qtauResampler::qtauResampler(const QByteArray &srcData, const QAudioFormat &srcFmt, const QAudioFormat &dstFmt, QObject *parent) :
-    QObject(parent), srcD(srcData)
+    QObject(parent), map(EChannelMap::same), channels(srcFmt.channelCount()), convertible(true), srcD(srcData)
 {
-    sampleChange    = EResampFormat::none;
-    byteorderChange = EResampBSwap::none;
+    srcF    = sampleFormat(srcFmt, true);
+    dstF    = sampleFormat(dstFmt, true);
+    srcSwap = srcFmt.byteOrder() == QAudioFormat::BigEndian;
+    dstSwap = dstFmt.byteOrder() == QAudioFormat::BigEndian;
+
+    if (srcFmt.channelCount() == 1 && dstFmt.channelCount() == 2)
+        map = EChannelMap::monoToStereo;
+    else if (srcFmt.channelCount() == 2 && dstFmt.channelCount() == 1)
+    {
+        map = EChannelMap::stereoToMono;
+        channels = 1;
+    }
+    else if (srcFmt.channelCount() != dstFmt.channelCount())
+    {
+        vsLog::e(QString("Resampler can't change %1 channels to %2").arg(srcFmt.channelCount()).arg(dstFmt.channelCount()));
+        convertible = false;
+    }
 
-    bool hasData = !srcD.isEmpty();
-    bool differentSamples =
-            srcFmt.sampleSize() != dstFmt.sampleSize() ||
-            srcFmt.sampleType() != dstFmt.sampleType();
+    if (!srcD.isEmpty() && (srcF == ESampleFormat::unknown || dstF == ESampleFormat::unknown))
+        vsLog::e(QString("Resampler got an unknown audio format: %1 bit %2 to %3 bit %4")
+                 .arg(srcFmt.sampleSize()).arg(srcFmt.sampleType()).arg(dstFmt.sampleSize()).arg(dstFmt.sampleType()));
+}
+
+QByteArray qtauResampler::encode()
+{
+    QByteArray out;
 
-    bool differentByteOrder = srcFmt.byteOrder() != dstFmt.byteOrder();
+    const int inCh   = (map == EChannelMap::stereoToMono) ? 2 : channels;
+    const int outCh  = (map == EChannelMap::monoToStereo) ? 2 : ((map == EChannelMap::stereoToMono) ? 1 : channels);
+    const int frames = (srcF != ESampleFormat::unknown && inCh > 0) ? srcD.size() / (sampleBytes(srcF) * inCh) : 0;
 
-    if (hasData)
+    if (convertible && frames > 0 && dstF != ESampleFormat::unknown)
     {
-        switch (srcFmt.sampleType())
+        out.resize(frames * outCh * sampleBytes(dstF));
+
+        if (!convertPcm(srcD.constData(), srcF, srcSwap, out.data(), dstF, dstSwap, map, channels, frames))
         {
-        case QAudioFormat::UnSignedInt: // U8
-            if (differentSamples)
-            {
-                if      (dstFmt.sampleType() == QAudioFormat::SignedInt)   sampleChange = EResampFormat::U8toS16;
-                else if (dstFmt.sampleType() == QAudioFormat::Float)       sampleChange = EResampFormat::U8toF32;
-            }
-
-            if (differentByteOrder) byteorderChange = EResampBSwap::Swap8;
-            break;
-        case QAudioFormat::SignedInt:   // S16
-            if (differentSamples)
-            {
-                if      (dstFmt.sampleType() == QAudioFormat::UnSignedInt) sampleChange = EResampFormat::S16toU8;
-                else if (dstFmt.sampleType() == QAudioFormat::Float)       sampleChange = EResampFormat::S16toF32;
-            }
-
-            if (differentByteOrder) byteorderChange = EResampBSwap::Swap16;
-            break;
-        case QAudioFormat::Float:       // F32
-            if (differentSamples)
-            {
-                if      (dstFmt.sampleType() == QAudioFormat::UnSignedInt) sampleChange = EResampFormat::F32toU8;
-                else if (dstFmt.sampleType() == QAudioFormat::SignedInt)   sampleChange = EResampFormat::F32toS16;
-            }
-
-            if (differentByteOrder) byteorderChange = EResampBSwap::Swap32;
-            break;
-        default:
-            vsLog::e(QString("Resampler got an unknown source audio format %1").arg(srcFmt.sampleType()));
+            vsLog::e("Resampler can't convert between these audio formats");
+            out.clear();
         }
-
-        if ((differentSamples && sampleChange == EResampFormat::none) ||
-            (differentByteOrder && byteorderChange == EResampBSwap::none))
-            vsLog::e("Resampler encountered an error comparing audio formats! This won't end well.");
     }
+
+    return out;
 }
 
-template<typename T> inline void swapByteorder(const char* in, char* out, int size)
+//----- streaming rate converter ----------------------------------------------------------
+
+typedef struct SResampleSetup {
+    int   halfLen;
+    int   phases;
+    float beta;    // Kaiser window shape
+    float rolloff; // cutoff relative to lower Nyquist
+} SResampleSetup;
+
+static const SResampleSetup c_resample_presets[] = {
+    {  8,  64,  6.f, 0.90f }, // fast
+    { 16, 128,  8.f, 0.94f }, // medium
+    { 32, 256, 10.f, 0.97f }  // best
+};
+
+// zeroth order modified Bessel function of the first kind, for Kaiser window
+static double besselI0(double x)
 {
-    const T* srcT;
-    T* dstT;
+    double result = 1;
+    double term   = 1;
 
-    for (int i = 0; i < size; ++i)
+    for (int k = 1; k < 32; ++k)
     {
-        srcT = reinterpret_cast<const T*>(in + i);
-        dstT = reinterpret_cast<T*>(out + i);
-        *dstT = qbswap<T>(*srcT);
+        term   *= (x / (2 * k)) * (x / (2 * k));
+        result += term;
     }
+
+    return result;
 }
 
-QByteArray qtauResampler::encode()
+qtauRateConverter::qtauRateConverter(int srcRate, int dstRate, EResampleQuality q) :
+    srcRate(qMax(srcRate, 1)), dstRate(qMax(dstRate, 1)), quality(q), buffered(0), ipos(0), frac(0), realEnd(-1)
 {
-    QByteArray out;
-    const char* inData = srcD.data();
-    int bytes = srcD.size();
+    const SResampleSetup &rs = c_resample_presets[(int)q];
 
-    int i = 0, o = 0;
+    halfLen    = rs.halfLen;
+    taps       = halfLen * 2;
+    phases     = rs.phases;
+    phaseScale = (float)phases / this->dstRate;
 
-    switch (sampleChange) // pure Indian code here, sorry.
-    {                     // ps Indian for Endian - sounds interesting, doesn't it?
-    case EResampFormat::none:     // pps yes of course I thought about templates and inlines, but it still looks like this.
+    // lowpass at the lower of two Nyquist frequencies, in units of source sample rate
+    const double cutoff = qMin(1.0, (double)this->dstRate / this->srcRate) * rs.rolloff;
+    const double i0beta = besselI0(rs.beta);
+
+    table.resize((phases + 1) * taps);
+
+    for (int p = 0; p <= phases; ++p)
     {
-        if (byteorderChange != EResampBSwap::none)
+        float *row = table.data() + p * taps;
+        double f   = (double)p / phases;
+        double sum = 0;
+
+        for (int k = 0; k < taps; ++k)
         {
-            out.resize(srcD.size());
-            char *outData = out.data();
-
-            switch(byteorderChange)
-            {
-            case EResampBSwap::Swap8:  swapByteorder<quint8> (inData, outData, bytes); break;
-            case EResampBSwap::Swap16: swapByteorder<quint16>(inData, outData, bytes); break;
-            case EResampBSwap::Swap32: swapByteorder<quint32>(inData, outData, bytes); break; // treating float as a uint32
-            default:
-                vsLog::e(QString("Resampler can't encode data with unknown type of byteorder change: %1")
-                         .arg((char)byteorderChange));
-            }
+            double x = k - halfLen + 1 - f; // distance from output point, in source frames
+            double t = x / halfLen;
+            double w = (t <= -1 || t >= 1) ? 0 : besselI0(rs.beta * sqrt(1 - t * t)) / i0beta;
+            double s = (x == 0) ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+
+            row[k] = cutoff * s * w;
+            sum += row[k];
         }
-        else out = srcD;
 
-        break;
+        for (int k = 0; k < taps; ++k) // exact unity gain at DC for every phase
+            row[k] /= sum;
+    }
+
+    prepare(this->dstRate / 10);
+    reset();
+}
+
+void qtauRateConverter::ensureCapacity(int frames)
+{
+    if (histL.size() < frames)
+    {
+        histL.resize(frames);
+        histR.resize(frames);
+    }
+}
+
+void qtauRateConverter::prepare(int maxOutFrames)
+{
+    // one block of source frames + filter length + rounding, keeps what's in history
+    int maxIn = (int)((qint64)maxOutFrames * srcRate / dstRate) + taps + 2;
+    ensureCapacity(maxIn + taps);
+}
+
+void qtauRateConverter::reset(qint64 startFrac, int lead)
+{
+    // history starts with half a filter of silence, so that first output point is at first source frame
+    // after lead ones - those are pushed over the end of silence, as if source had been playing before
+    buffered = halfLen - 1 - qBound(0, lead, halfLen - 1);
+    ipos     = halfLen - 1;
+    frac     = qBound((qint64)0, startFrac, (qint64)dstRate - 1);
+    realEnd  = -1;
+
+    memset(histL.data(), 0, buffered * sizeof(float));
+    memset(histR.data(), 0, buffered * sizeof(float));
+}
+
+int qtauRateConverter::framesNeeded(int outFrames) const
+{
+    int result = 0;
+
+    if (outFrames > 0 && realEnd < 0)
+    {
+        qint64 lastPos = ipos + (frac + (qint64)(outFrames - 1) * srcRate) / dstRate;
+        qint64 needed  = lastPos + halfLen + 1 - buffered;
+        result = (int)qBound((qint64)0, needed, (qint64)(histL.size() - buffered - halfLen - 1)); // room for zero tail
     }
-    case EResampFormat::U8toS16:
+
+    return result;
+}
+
+void qtauRateConverter::push(ESampleFormat f, const char *pcm, int channels, int frames)
+{
+    frames = qMin(frames, histL.size() - buffered);
+
+    if (frames > 0 && realEnd < 0)
     {
-        out.resize(srcD.size() * 2);
-        char* outData = out.data(); // can't point to earlier it because resize may relocate it
-
-        int bytes   = srcD.size();
-        int smpSize   = 1;
-        int dstSSize  = 2;
-        quint8 *srcSmp;
-        qint16  dstSmp = 0;
-
-        if (byteorderChange == EResampBSwap::none)
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                srcSmp = (quint8*)&inData[i];
-                dstSmp = ((float)*srcSmp - 128.0) / 127.0 * 32767.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-        else
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                srcSmp = (quint8*)&inData[i];
-                dstSmp = ((float)qbswap<quint8>(*srcSmp) - 128.0) / 127.0 * 32767.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-
-        break;
+        memset(histL.data() + buffered, 0, frames * sizeof(float));
+        memset(histR.data() + buffered, 0, frames * sizeof(float));
+        mixToBus(f, pcm, channels, frames, histL.data() + buffered, histR.data() + buffered);
+
+        buffered += frames;
     }
-    case EResampFormat::U8toF32:
+}
+
+void qtauRateConverter::pushEnd()
+{
+    if (realEnd < 0)
     {
-        out.resize(srcD.size() * 4);
-        char* outData = out.data();
-
-        int smpSize   = 1;
-        int dstSSize  = 4;
-        quint8* srcSmp;
-        float   dstSmp = 0;
-
-        if (byteorderChange == EResampBSwap::none)
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                srcSmp = (quint8*)&inData[i];
-                dstSmp = ((float)*srcSmp - 128.0) / 127.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-        else
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                srcSmp = (quint8*)&inData[i];
-                dstSmp = ((float)qbswap<quint8>(*srcSmp) - 128.0) / 127.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-
-        break;
+        int pad = qMin(halfLen + 1, histL.size() - buffered);
+        memset(histL.data() + buffered, 0, pad * sizeof(float));
+        memset(histR.data() + buffered, 0, pad * sizeof(float));
+
+        realEnd   = buffered;
+        buffered += pad;
     }
-    case EResampFormat::S16toU8:
+}
+
+// one output frame for both channels, coefficients interpolated between two neighbour phases
+static inline void convolve(const float *c0, const float *c1, float w, const float *l, const float *r, int taps,
+                            float &outL, float &outR)
+{
+    int k = 0;
+    float sumL = 0;
+    float sumR = 0;
+
+#ifdef QTAU_SSE2
+    const __m128 vw = _mm_set1_ps(w);
+    __m128 accL = _mm_setzero_ps();
+    __m128 accR = _mm_setzero_ps();
+
+    for (; k + 4 <= taps; k += 4)
     {
-        out.resize(srcD.size() / 2);
-        char* outData = out.data();
-
-        int smpSize   = 2;
-        int dstSSize  = 1;
-        qint16 *srcSmp;
-        quint8  dstSmp = 0;
-
-        if (byteorderChange == EResampBSwap::none)
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                srcSmp = (qint16*)&inData[i];
-                dstSmp = ((float)*srcSmp / 32767.0) * 127.0 + 128.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-        else
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                srcSmp = (qint16*)&inData[i];
-                dstSmp = ((float)qbswap<qint16>(*srcSmp) / 32767.0) * 127.0 + 128.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-
-        break;
+        __m128 a = _mm_loadu_ps(c0 + k);
+        __m128 c = _mm_add_ps(a, _mm_mul_ps(vw, _mm_sub_ps(_mm_loadu_ps(c1 + k), a)));
+
+        accL = _mm_add_ps(accL, _mm_mul_ps(c, _mm_loadu_ps(l + k)));
+        accR = _mm_add_ps(accR, _mm_mul_ps(c, _mm_loadu_ps(r + k)));
     }
-    case EResampFormat::S16toF32:
+
+    // horizontal sums
+    accL = _mm_add_ps(accL, _mm_movehl_ps(accL, accL));
+    accR = _mm_add_ps(accR, _mm_movehl_ps(accR, accR));
+    accL = _mm_add_ss(accL, _mm_shuffle_ps(accL, accL, 1));
+    accR = _mm_add_ss(accR, _mm_shuffle_ps(accR, accR, 1));
+    sumL = _mm_cvtss_f32(accL);
+    sumR = _mm_cvtss_f32(accR);
+#endif
+
+    for (; k < taps; ++k)
     {
-        out.resize(srcD.size() * 2);
-        char* outData = out.data();
-
-        int smpSize   = 2;
-        int dstSSize  = 4;
-        qint16 *srcSmp;
-        float   dstSmp = 0;
-
-        if (byteorderChange == EResampBSwap::none)
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                srcSmp = (qint16*)&inData[i];
-                dstSmp = (float)*srcSmp / 32767.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-        else
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                srcSmp = (qint16*)&inData[i];
-                dstSmp = (float)qbswap<qint16>(*srcSmp) / 32767.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-
-        break;
+        float c = c0[k] + w * (c1[k] - c0[k]);
+        sumL += c * l[k];
+        sumR += c * r[k];
     }
-    case EResampFormat::F32toU8:
+
+    outL = sumL;
+    outR = sumR;
+}
+
+int qtauRateConverter::mixTo(float *busL, float *busR, int outFrames, const SGainRamp &g, SBlockLevels *levels)
+{
+    int result = 0;
+    float peakL = 0, peakR = 0, sumSqL = 0, sumSqR = 0;
+    const bool  ramp  = !g.isUnity();
+    const float stepL = ramp ? (g.toL - g.fromL) / qMax(outFrames, 1) : 0.f;
+    const float stepR = ramp ? (g.toR - g.fromR) / qMax(outFrames, 1) : 0.f;
+    const float *l = histL.constData();
+    const float *r = histR.constData();
+
+    while (result < outFrames && ipos + halfLen < buffered && (realEnd < 0 || ipos < realEnd))
     {
-        out.resize(srcD.size() / 4);
-        char* outData = out.data();
-
-        int smpSize   = 4;
-        int dstSSize  = 1;
-        quint8 dstSmp = 0;
-
-        union fiU {
-            float   *smpF;
-            quint32 *smpI;
-        };
-
-        fiU src;
-
-        if (byteorderChange == EResampBSwap::none)
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                src.smpF = (float*)&inData[i];
-                dstSmp = *src.smpF * 127.0 + 128.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-        else
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                src.smpF = (float*)&inData[i];
-                *src.smpI = qbswap<quint32>(*src.smpI);
-                dstSmp = *src.smpF * 127.0 + 128.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-
-        break;
+        float ph = frac * phaseScale;
+        int   p  = qMin((int)ph, phases - 1);
+        const float *c0 = table.constData() + p * taps;
+        float outL, outR;
+
+        convolve(c0, c0 + taps, ph - p, l + ipos - halfLen + 1, r + ipos - halfLen + 1, taps, outL, outR);
+
+        if (ramp)
+        {
+            outL *= g.fromL + stepL * (result + 1);
+            outR *= g.fromR + stepR * (result + 1);
+        }
+
+        if (levels)
+        {
+            peakL = qMax(peakL, qAbs(outL));
+            peakR = qMax(peakR, qAbs(outR));
+            sumSqL += outL * outL;
+            sumSqR += outR * outR;
+        }
+
+        busL[result] += outL;
+        busR[result] += outR;
+        ++result;
+
+        frac += srcRate;
+        ipos += (int)(frac / dstRate);
+        frac %= dstRate;
     }
-    case EResampFormat::F32toS16:
+
+    // dropping history that won't be needed anymore
+    int consumed = qMin(ipos - halfLen + 1, buffered);
+
+    if (consumed > 0)
     {
-        out.resize(srcD.size() / 2);
-        char* outData = out.data();
-
-        int smpSize   = 4;
-        int dstSSize  = 2;
-        qint16 dstSmp = 0;
-
-        union fiU {
-            float   *smpF;
-            quint32 *smpI;
-        };
-
-        fiU src;
-
-        if (byteorderChange == EResampBSwap::none)
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                src.smpF = (float*)&inData[i];
-                dstSmp = *src.smpF * 32767.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-        else
-            for (; i < bytes; i += smpSize, o += dstSSize)
-            {
-                src.smpF = (float*)&inData[i];
-                *src.smpI = qbswap<quint32>(*src.smpI);
-                dstSmp = *src.smpF * 32767.0;
-                memcpy(outData + o, (char*)&dstSmp, dstSSize);
-            }
-
-        break;
+        buffered -= consumed;
+        ipos     -= consumed;
+
+        if (realEnd >= 0)
+            realEnd = qMax(0, realEnd - consumed);
+
+        memmove(histL.data(), l + consumed, buffered * sizeof(float));
+        memmove(histR.data(), r + consumed, buffered * sizeof(float));
     }
-    default:
-        vsLog::e(QString("Unknown conversion type in resampler: %1").arg((char)sampleChange));
+
+    if (levels)
+    {
+        levels->peakL   = qMax(levels->peakL, peakL);
+        levels->peakR   = qMax(levels->peakR, peakR);
+        levels->sumSqL += sumSqL;
+        levels->sumSqR += sumSqR;
+        levels->frames += result;
     }
 
-    return out;
+    return result;
 }
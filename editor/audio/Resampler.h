@@ -5,6 +5,8 @@
 
 #include <QObject>
 #include <QAudioFormat>
+#include <QVector>
+#include "audio/Kernels.h"
 
 
 class qtauResampler : public QObject
@@ -14,30 +16,80 @@ class qtauResampler : public QObject
 public:
     explicit qtauResampler(const QByteArray &srcData, const QAudioFormat &srcFmt, const QAudioFormat &dstFmt, QObject *parent = 0);
 
+    // sample format, byte order and mono<->stereo changes, sample rate stays the same. Empty if they can't be done
     QByteArray encode();
     
 protected:
-    enum class EResampFormat : char {
-        none,
-        U8toS16, // to S16
-        F32toS16,
-        U8toF32, // to F32
-        S16toF32,
-        S16toU8, // to U8
-        F32toU8
-    };
-
-    enum class EResampBSwap : char {
-        none,
-        Swap8,
-        Swap16,
-        Swap32
-    };
-
-    EResampFormat sampleChange;
-    EResampBSwap  byteorderChange;
+    ESampleFormat srcF;
+    ESampleFormat dstF;
+    bool          srcSwap; // big-endian
+    bool          dstSwap;
+    EChannelMap   map;
+    int           channels;
+    bool          convertible; // channel counts can be mapped
     QByteArray    srcD;
     
 };
 
+
+enum class EResampleQuality : char {
+    fast,   // 16 taps,  ~60dB stopband
+    medium, // 32 taps,  ~80dB
+    best    // 64 taps, ~100dB
+};
+
+/* Streaming sample rate converter: polyphase windowed-sinc (Kaiser), with linear interpolation between phases.
+ * Source PCM is pushed in as it's read, converted frames are added to planar float bus of mixer.
+ * Always works in stereo (mono is duplicated by decoding kernel), keeps only a filter length of history.
+ * Output frame N is aligned with source frame N * srcRate / dstRate, so it needs a half-filter of lookahead. */
+class qtauRateConverter
+{
+public:
+    qtauRateConverter(int srcRate, int dstRate, EResampleQuality q = EResampleQuality::medium);
+
+    void prepare(int maxOutFrames); // allocates history for blocks up to maxOutFrames, outside of real-time
+                                    // made ready for blocks of 1/10 second in constructor
+    void reset(qint64 startFrac = 0, int lead = 0); // forgets everything pushed, to be used after seeking the source;
+                                      // startFrac is subsample position of first output point, in 1/dstRate,
+                                      // lead is how many frames before that point source was seeked to (filter history)
+    int historyFrames() const { return halfLen - 1; } // largest useful lead
+
+    int framesNeeded(int outFrames) const; // how many source frames to push to get outFrames converted
+
+    // decodes source frames into history, should fit in what was prepared
+    void push(ESampleFormat f, const char *pcm, int channels, int frames);
+    void pushEnd(); // source has ended, remaining frames will be given out with zero tail
+
+    // adds converted frames to bus with gain ramp over outFrames, returns how many
+    int  mixTo(float *busL, float *busR, int outFrames, const SGainRamp &g = SGainRamp(), SBlockLevels *levels = nullptr);
+    bool isEnded() const { return realEnd >= 0 && ipos >= realEnd; }
+
+    int  getSrcRate() const { return srcRate; }
+    int  getDstRate() const { return dstRate; }
+    EResampleQuality getQuality() const { return quality; }
+
+protected:
+    int srcRate;
+    int dstRate;
+    EResampleQuality quality;
+
+    int halfLen; // taps on each side of output point
+    int taps;
+    int phases;
+    float phaseScale; // frac to phase
+
+    QVector<float> table; // (phases + 1) rows of taps coefficients
+    QVector<float> histL; // source frames, planar
+    QVector<float> histR;
+
+    int    buffered; // frames in history
+    int    ipos;     // history frame of current output point
+    qint64 frac;     // subsample position of output point, in 1/dstRate
+    int    realEnd;  // frames of real (not padding) data in history when source has ended, -1 otherwise
+
+    void ensureCapacity(int frames);
+
+    Q_DISABLE_COPY(qtauRateConverter)
+};
+
 #endif // RESAMPLER_H
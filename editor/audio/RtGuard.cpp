@@ -0,0 +1,67 @@
+/* RtGuard.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/RtGuard.h"
+
+#ifdef QTAU_RT_ALLOC_GUARD
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+static thread_local int rtDepth = 0;   // >0 while current thread is inside of a real-time scope
+static std::atomic<int> rtCalls(0);
+
+qtauRtScope::qtauRtScope()  { ++rtDepth; }
+qtauRtScope::~qtauRtScope() { --rtDepth; }
+
+int  rtHeapCalls()      { return rtCalls.load(std::memory_order_relaxed); }
+void rtResetHeapCalls() { rtCalls.store(0, std::memory_order_relaxed);    }
+
+// can't log from here - logging allocates, so just counting
+inline void rtCheck() { if (rtDepth > 0) rtCalls.fetch_add(1, std::memory_order_relaxed); }
+
+#ifdef __GLIBC__
+// Qt containers use malloc directly, so with glibc catching those too
+extern "C" {
+    void* __libc_malloc (size_t);
+    void* __libc_calloc (size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+    void  __libc_free   (void*);
+
+    void* malloc (size_t s)           { rtCheck(); return __libc_malloc(s);     }
+    void* calloc (size_t n, size_t s) { rtCheck(); return __libc_calloc(n, s);  }
+    void* realloc(void *p, size_t s)  { rtCheck(); return __libc_realloc(p, s); }
+    void  free   (void *p)            { if (p) rtCheck(); __libc_free(p);       }
+}
+#define rtMalloc malloc
+#define rtFree   free
+#else
+inline void* rtMalloc(size_t s) { rtCheck(); return malloc(s); }
+inline void  rtFree  (void *p)  { if (p) rtCheck(); free(p);   }
+#endif
+
+void* operator new(size_t s)
+{
+    void *p = rtMalloc(s ? s : 1);
+
+    if (!p)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void* operator new[](size_t s)                          { return operator new(s);  }
+void* operator new  (size_t s, const std::nothrow_t&) noexcept { return rtMalloc(s ? s : 1); }
+void* operator new[](size_t s, const std::nothrow_t&) noexcept { return rtMalloc(s ? s : 1); }
+
+void operator delete  (void *p) noexcept                        { rtFree(p); }
+void operator delete[](void *p) noexcept                        { rtFree(p); }
+void operator delete  (void *p, const std::nothrow_t&) noexcept { rtFree(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { rtFree(p); }
+
+#else
+
+int  rtHeapCalls()      { return 0; }
+void rtResetHeapCalls() {}
+
+#endif // QTAU_RT_ALLOC_GUARD
@@ -0,0 +1,25 @@
+/* RtGuard.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_RTGUARD_H
+#define QTAU_AUDIO_RTGUARD_H
+
+/* Marks code that runs in the audio callback and must not touch the heap.
+ * In builds with QTAU_RT_ALLOC_GUARD (debug ones by default) every allocation or release made
+ * on that thread while a scope is alive is counted, so player can complain about it after playback.
+ * In other builds it's empty and costs nothing. */
+class qtauRtScope
+{
+public:
+#ifdef QTAU_RT_ALLOC_GUARD
+    qtauRtScope();
+    ~qtauRtScope();
+#else
+    qtauRtScope() {}
+#endif
+};
+
+// number of heap calls made inside of real-time scopes since last reset, always 0 if guard isn't compiled in
+int  rtHeapCalls();
+void rtResetHeapCalls();
+
+#endif // QTAU_AUDIO_RTGUARD_H
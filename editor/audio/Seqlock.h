@@ -0,0 +1,66 @@
+/* Seqlock.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_SEQLOCK_H
+#define QTAU_AUDIO_SEQLOCK_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <string.h>
+
+/* Value published by one writer thread and readable from any thread without locks: it's kept in relaxed atomic
+ * words guarded by a sequence counter that's odd while writer changes them, reader retries if counter changed
+ * while it was reading. Writer never waits, so it's fine for audio callback. T should be a plain struct
+ * (copyable with memcpy), nothing is allocated. */
+template<typename T> class qtauSeqlock
+{
+public:
+    qtauSeqlock() : seq(0) { store(T()); }
+
+    // writer side, one thread only
+    void store(const T &v)
+    {
+        quint32 w[c_words] = {};
+        memcpy(w, &v, sizeof(T));
+
+        const unsigned c = seq.load(std::memory_order_relaxed);
+        seq.store(c + 1, std::memory_order_relaxed); // odd: being written
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (int i = 0; i < c_words; ++i)
+            words[i].store(w[i], std::memory_order_relaxed);
+
+        seq.store(c + 2, std::memory_order_release);
+    }
+
+    // any thread
+    T load() const
+    {
+        quint32 w[c_words];
+        unsigned before, after;
+
+        do {
+            before = seq.load(std::memory_order_acquire);
+
+            for (int i = 0; i < c_words; ++i)
+                w[i] = words[i].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        T result;
+        memcpy(&result, w, sizeof(T));
+
+        return result;
+    }
+
+protected:
+    static const int c_words = (int)((sizeof(T) + sizeof(quint32) - 1) / sizeof(quint32));
+
+    std::atomic<unsigned> seq;
+    std::atomic<quint32>  words[c_words];
+
+    Q_DISABLE_COPY(qtauSeqlock)
+};
+
+#endif // QTAU_AUDIO_SEQLOCK_H
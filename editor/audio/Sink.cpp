@@ -0,0 +1,332 @@
+/* Sink.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/Sink.h"
+#include "audio/Codec.h"
+#include "Utils.h"
+
+#include <QAudioOutput>
+#include <QAudioDeviceInfo>
+#include <QElapsedTimer>
+
+const qint64 c_sink_max_lag_ns = 1000000000; // real-time null sink doesn't catch up on more than that
+const int    c_sink_suspended_ms = 5;        // how often suspended pulling thread checks if it should go on
+const int    c_sink_park_poll_us = 200;      // how often suspend() checks if pulling thread has stopped reading
+
+
+qtauDeviceSink::qtauDeviceSink(QObject *parent) :
+    qtauAudioSink(parent), output(nullptr)
+{
+    //
+}
+
+bool qtauDeviceSink::setFormat(const QAudioFormat &f)
+{
+    QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
+    bool result = !info.isNull() && info.isFormatSupported(f);
+
+    delete output;
+    output = nullptr;
+
+    if (result)
+    {
+        output = new QAudioOutput(info, f, this);
+        output->setVolume(1); // volume is applied by mixer
+        connect(output, &QAudioOutput::notify, this, &qtauAudioSink::notify);
+    }
+
+    return result;
+}
+
+void qtauDeviceSink::start(QIODevice *source)
+{
+    if (output)
+    {
+        output->reset();
+        output->start(source);
+    }
+}
+
+void qtauDeviceSink::suspend() { if (output) output->suspend(); }
+void qtauDeviceSink::resume()  { if (output) output->resume();  }
+void qtauDeviceSink::stop()    { if (output) output->stop();    }
+
+ESinkState qtauDeviceSink::state() const
+{
+    ESinkState result = ESinkState::stopped;
+
+    if (output)
+        switch (output->state())
+        {
+        case QAudio::ActiveState:
+        case QAudio::IdleState:      result = ESinkState::active;    break; // idle is an underrun, still playing
+        case QAudio::SuspendedState: result = ESinkState::suspended; break;
+        default:
+            break;
+        }
+
+    return result;
+}
+
+qint64 qtauDeviceSink::bufferBytes()    const { return output ? output->bufferSize()     : 0; }
+qint64 qtauDeviceSink::processedUSecs() const { return output ? output->processedUSecs() : 0; }
+
+QString qtauDeviceSink::name() const
+{
+    return QString("audio device \"%1\"").arg(QAudioDeviceInfo::defaultOutputDevice().deviceName());
+}
+
+//------------------------------------------------------------------
+
+void qtauSinkThread::run() { sink->pull(); }
+
+qtauNullSink::qtauNullSink(bool rt, QObject *parent) :
+    qtauAudioSink(parent), realTime(rt), source(nullptr), sinkState(ESinkState::stopped), puller(this),
+    processedBytes(0), suspended(false), suspendCount(0), parkedCount(0)
+{
+    //
+}
+
+qtauNullSink::~qtauNullSink()
+{
+    stop();
+}
+
+bool qtauNullSink::setFormat(const QAudioFormat &f)
+{
+    bool result = f.isValid() && sinkState == ESinkState::stopped;
+
+    if (result)
+    {
+        fmt = f;
+        block.fill(0, qMax(f.sampleRate() / c_sink_block_divider, 1) * f.bytesPerFrame());
+    }
+
+    return result;
+}
+
+void qtauNullSink::start(QIODevice *s)
+{
+    if (s && sinkState == ESinkState::stopped && !block.isEmpty() && beginConsuming())
+    {
+        source = s;
+        processedBytes = 0;
+        suspended = false;
+        parkedCount.store(suspendCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        sinkState = ESinkState::active;
+
+        puller.start(realTime ? QThread::TimeCriticalPriority : QThread::NormalPriority);
+    }
+}
+
+void qtauNullSink::suspend()
+{
+    if (sinkState == ESinkState::active)
+    {
+        suspended.store(true, std::memory_order_relaxed);
+        const unsigned asked = suspendCount.load(std::memory_order_relaxed) + 1;
+        suspendCount.store(asked, std::memory_order_release); // "suspended" is seen by whoever sees this
+
+        while (parkedCount.load(std::memory_order_acquire) != asked && puller.isRunning())
+            QThread::usleep(c_sink_park_poll_us);
+
+        sinkState = ESinkState::suspended;
+    }
+}
+
+void qtauNullSink::resume()
+{
+    if (sinkState == ESinkState::suspended)
+    {
+        suspended.store(false, std::memory_order_release);
+        sinkState = ESinkState::active;
+    }
+}
+
+void qtauNullSink::stop()
+{
+    if (sinkState != ESinkState::stopped)
+    {
+        puller.requestInterruption();
+        puller.wait();
+
+        endConsuming();
+        source = nullptr;
+        sinkState = ESinkState::stopped;
+    }
+}
+
+qint64 qtauNullSink::processedUSecs() const
+{
+    const qint64 bytesPerSecond = qMax((qint64)fmt.bytesPerFrame() * fmt.sampleRate(), (qint64)1);
+    return processedBytes.load(std::memory_order_relaxed) * 1000000 / bytesPerSecond;
+}
+
+QString qtauNullSink::name() const
+{
+    return realTime ? QStringLiteral("null sink") : QStringLiteral("unthrottled null sink");
+}
+
+void qtauNullSink::pull()
+{
+    const qint64 bytesPerSecond = qMax((qint64)fmt.bytesPerFrame() * fmt.sampleRate(), (qint64)1);
+    const qint64 blockNSec      = (qint64)block.size() * 1000000000 / bytesPerSecond;
+    const qint64 notifyBytes    = bytesPerSecond * c_sink_notify_ms / 1000;
+    const qint64 notifyNSec     = (qint64)c_sink_notify_ms * 1000000;
+
+    QElapsedTimer clock;
+    clock.start();
+
+    qint64 bytes      = 0;
+    qint64 due        = 0; // when next block should be pulled, as a device would ask for it
+    qint64 notifiedAt = 0; // bytes and clock of last notify, both should pass its interval
+    qint64 notifiedNs = 0;
+    qint64 pausedNs   = 0; // time spent suspended isn't counted for throughput
+
+    while (!puller.isInterruptionRequested())
+    {
+        const unsigned asked = suspendCount.load(std::memory_order_acquire);
+
+        if (suspended.load(std::memory_order_acquire))
+        {
+            parkedCount.store(asked, std::memory_order_release); // won't read until resumed
+            const qint64 before = clock.nsecsElapsed();
+            QThread::msleep(c_sink_suspended_ms);
+            pausedNs += clock.nsecsElapsed() - before;
+            due = clock.nsecsElapsed();
+            continue;
+        }
+
+        if (realTime)
+        {
+            const qint64 now = clock.nsecsElapsed();
+
+            if (due > now)
+                QThread::usleep((unsigned long)((due - now) / 1000));
+            else if (now - due > c_sink_max_lag_ns)
+                due = now; // thread wasn't scheduled for a long time, like a device it just goes on
+        }
+
+        const qint64 got = source->read(block.data(), block.size());
+
+        if (got > 0)
+        {
+            consume(block.constData(), got);
+            bytes += got;
+            processedBytes.store(bytes, std::memory_order_relaxed);
+        }
+
+        due += blockNSec;
+
+        // unthrottled one produces hours of audio in a minute, signals are limited by wall clock too
+        const qint64 now = clock.nsecsElapsed();
+
+        if (bytes - notifiedAt >= notifyBytes && now - notifiedNs >= notifyNSec)
+        {
+            notifiedAt = bytes;
+            notifiedNs = now;
+            emit notify();
+        }
+    }
+
+    const double audioSec = (double)bytes / bytesPerSecond;
+    const double wallSec  = qMax((double)(clock.nsecsElapsed() - pausedNs) / 1e9, 1e-9);
+
+    if (bytes > 0)
+        vsLog::i(QString("%1 pulled %2 s of audio in %3 s, %4x real time")
+                 .arg(name()).arg(audioSec, 0, 'f', 2).arg(wallSec, 0, 'f', 2).arg(audioSec / wallSec, 0, 'f', 1));
+}
+
+//------------------------------------------------------------------
+
+qtauWavFileSink::qtauWavFileSink(const QString &fileName, bool rt, QObject *parent) :
+    qtauNullSink(rt, parent), file(fileName), codec(nullptr), failed(false)
+{
+    //
+}
+
+qtauWavFileSink::~qtauWavFileSink()
+{
+    stop(); // while endConsuming is still this class' one
+}
+
+QString qtauWavFileSink::name() const
+{
+    return QString("WAV file sink \"%1\"").arg(file.fileName());
+}
+
+bool qtauWavFileSink::beginConsuming()
+{
+    bool result = false;
+
+    if (file.open(QFile::WriteOnly | QFile::Truncate))
+    {
+        codec = codecForExt("wav", file);
+
+        if (codec)
+        {
+            codec->setAudioFormat(fmt);
+            result = codec->beginStream();
+        }
+        else
+            vsLog::e("No WAV codec registered, file sink can't write");
+
+        if (!result)
+        {
+            delete codec;
+            codec = nullptr;
+            file.close();
+        }
+    }
+    else
+        vsLog::e(QString("Could not open file %1 to write played audio").arg(file.fileName()));
+
+    failed = false;
+
+    return result;
+}
+
+void qtauWavFileSink::consume(const char *pcm, qint64 bytes)
+{
+    if (!failed && !codec->writeStream(pcm, bytes))
+        failed = true;
+}
+
+void qtauWavFileSink::endConsuming()
+{
+    if (codec)
+    {
+        if (!codec->endStream() || failed)
+            vsLog::e(QString("Writing played audio to %1 failed").arg(file.fileName()));
+
+        delete codec;
+        codec = nullptr;
+    }
+
+    file.close();
+}
+
+//------------------------------------------------------------------
+
+qtauAudioSink* makeSink(const QString &description, QObject *parent)
+{
+    qtauAudioSink *result = nullptr;
+    const QString d = description.trimmed();
+
+    if (d == "null")
+        result = new qtauNullSink(true, parent);
+    else if (d == "null-unthrottled")
+        result = new qtauNullSink(false, parent);
+    else if (d.startsWith("wav:"))
+        result = new qtauWavFileSink(d.mid(4), false, parent);
+    else if (d.startsWith("wav-rt:"))
+        result = new qtauWavFileSink(d.mid(7), true, parent);
+    else
+    {
+        if (!d.isEmpty() && d != "device")
+            vsLog::e(QString("Unknown audio sink \"%1\", using audio device").arg(d));
+
+        result = new qtauDeviceSink(parent);
+    }
+
+    return result;
+}
@@ -0,0 +1,170 @@
+/* Sink.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_SINK_H
+#define QTAU_AUDIO_SINK_H
+
+#include <QObject>
+#include <QThread>
+#include <QAudioFormat>
+#include <QFile>
+#include <QByteArray>
+#include <atomic>
+
+class QIODevice;
+class QAudioOutput;
+class qtauAudioCodec;
+
+const int c_sink_block_divider = 100; // threaded sinks pull 1/100 of a second at once
+const int c_sink_notify_ms     = 100; // how often sinks signal that audio went on
+
+enum class ESinkState : char {
+    stopped,
+    active,
+    suspended
+};
+
+
+/* Where player's audio goes. Sink pulls PCM from a device (player) at its own pace, from its own thread
+ * or from the one it lives in - so source's readData should be ready for that, as audio callback is.
+ * Everything except what's marked is called from thread of the sink object (player's audio thread). */
+class qtauAudioSink : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit qtauAudioSink(QObject *parent = 0) : QObject(parent) {}
+
+    virtual bool setFormat(const QAudioFormat &f) = 0; // false if sink can't play it, then it can't be started
+    virtual void start(QIODevice *source) = 0;          // from stopped state, starts pulling
+    virtual void suspend() = 0;
+    virtual void resume()  = 0;
+    virtual void stop()    = 0;                         // source isn't read anymore when it returns
+
+    virtual ESinkState state()  const = 0;
+    virtual qint64 bufferBytes()    const = 0; // pulled from source, but not heard yet at most
+    virtual qint64 processedUSecs() const = 0; // of audio, since start. Any thread
+    virtual QString name()          const = 0;
+
+signals:
+    void notify(); // about every c_sink_notify_ms of played audio
+
+};
+
+
+// default output device of QtMultimedia
+class qtauDeviceSink : public qtauAudioSink
+{
+    Q_OBJECT
+
+public:
+    explicit qtauDeviceSink(QObject *parent = 0);
+
+    bool setFormat(const QAudioFormat &f) override;
+    void start(QIODevice *source) override;
+    void suspend() override;
+    void resume()  override;
+    void stop()    override;
+
+    ESinkState state()  const override;
+    qint64 bufferBytes()    const override;
+    qint64 processedUSecs() const override;
+    QString name()          const override;
+
+protected:
+    QAudioOutput *output;
+
+};
+
+
+class qtauNullSink;
+
+class qtauSinkThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit qtauSinkThread(qtauNullSink *s) : sink(s) {}
+
+protected:
+    qtauNullSink *sink;
+    void run() override;
+
+};
+
+/* Plays to nowhere, for machines without sound hardware: pulls blocks in its own thread, either at real-time
+ * pace (each block waits until previous one would have been heard) or unthrottled, as fast as source gives
+ * them - that's a benchmark of whole playback path. Reports how fast it went when stopped.
+ * Subclasses get every pulled block in consume(). */
+class qtauNullSink : public qtauAudioSink
+{
+    Q_OBJECT
+    friend class qtauSinkThread;
+
+public:
+    explicit qtauNullSink(bool realTime = true, QObject *parent = 0);
+    ~qtauNullSink();
+
+    bool setFormat(const QAudioFormat &f) override;
+    void start(QIODevice *source) override;
+    void suspend() override;
+    void resume()  override;
+    void stop()    override;
+
+    ESinkState state()  const override { return sinkState; }
+    qint64 bufferBytes()    const override { return 0; } // pulled block is "heard" right away
+    qint64 processedUSecs() const override;
+    QString name()          const override;
+
+protected:
+    bool          realTime;
+    QAudioFormat  fmt;
+    QIODevice    *source;
+    QByteArray    block;
+    ESinkState    sinkState;
+
+    qtauSinkThread       puller;
+    std::atomic<qint64>  processedBytes;
+
+    // suspend() waits until pulling thread stops reading source, so that caller may use what it writes:
+    // it asks by number, pulling thread answers with that number when it has seen "suspended" and won't read
+    std::atomic<bool>     suspended;
+    std::atomic<unsigned> suspendCount;
+    std::atomic<unsigned> parkedCount;
+
+    virtual bool beginConsuming() { return true; }
+    virtual void consume(const char *, qint64) {} // from pulling thread
+    virtual void endConsuming() {}
+
+    void pull(); // loop of pulling thread
+
+};
+
+
+// writes everything played to a WAV file, rewritten on each start
+class qtauWavFileSink : public qtauNullSink
+{
+    Q_OBJECT
+
+public:
+    explicit qtauWavFileSink(const QString &fileName, bool realTime = false, QObject *parent = 0);
+    ~qtauWavFileSink();
+
+    QString name() const override;
+
+protected:
+    QFile file;
+    qtauAudioCodec *codec;
+    bool failed; // writing stopped, pulling goes on
+
+    bool beginConsuming() override;
+    void consume(const char *pcm, qint64 bytes) override;
+    void endConsuming() override;
+
+};
+
+
+/* Sink by its description: "device" (default), "null", "null-unthrottled" or "wav:<file>" (unthrottled),
+ * "wav-rt:<file>" to write file at real-time pace. */
+qtauAudioSink* makeSink(const QString &description, QObject *parent = 0);
+
+#endif // QTAU_AUDIO_SINK_H
@@ -6,34 +6,57 @@
 #include <QIODevice>
 #include <QBuffer>
 #include <QAudioBuffer>
+#include <QSharedPointer>
+#include <atomic>
+#include "audio/Levels.h"
 
 class vsLog;
+class qtauRateConverter;
+struct SGainRamp;
+struct SBlockLevels;
 
 
-typedef struct WavegenSetup {
-    qint64 lengthMS;
-    float  frequencyHz;
-    int    sampleRate;
-    bool   stereo;
+/* Mixing parameters of a source, shared with its copies (player mixes copies of session sources),
+ * so GUI can change them while source is playing. Mixer ramps to new values during one block,
+ * and measures what source adds to the mix (after gain and pan) into its level meter. */
+class qtauMixParams
+{
+public:
+    qtauMixParams() : gain(1), pan(0), muted(false) {}
+
+    std::atomic<float> gain;  // linear, 1 is unchanged
+    std::atomic<float> pan;   // -1 is left only, 1 is right only, 0 is both sides at full level
+    std::atomic<bool>  muted;
+
+    qtauLevelMeter levels; // written by one mixer that meters, see qtauSoundMixer::setMetering
+};
+
+/* Gains that mixer used for source in last block, so that next one can ramp from them,
+ * and crossfade envelope when it's replaced smoothly. Mixing thread only. */
+typedef struct SMixRamp {
+    float gainL;
+    float gainR;
+    float fade;     // 0..1, multiplies gains
+    float fadeStep; // per frame, >0 fading in, <0 fading out to be removed
+    bool  started;
 
-    WavegenSetup(qint64 len, float freq, int sr, bool st = false) :
-        lengthMS(len), frequencyHz(freq), sampleRate(sr), stereo(st) {}
-} SWavegenSetup;
+    SMixRamp() : gainL(0), gainR(0), fade(1), fadeStep(0), started(false) {}
+} SMixRamp;
 
 
+/* PCM data is an implicitly shared QByteArray: sources made from data of another one (or codec buffers
+ * assigned from it) point to the same memory until someone writes to his buffer, which gets a copy then.
+ * Read through data() or readPcm() to avoid detaching, buffer() and write() are for writers only. */
 class qtauAudioSource : public QBuffer
 {
     Q_OBJECT
 
 public:
     explicit qtauAudioSource(QObject *parent = 0);
-    explicit qtauAudioSource(const QByteArray& data, const QAudioFormat &f, QObject *parent = 0);
-
-    // generates tonal periodic wave
-    explicit qtauAudioSource(const SWavegenSetup &s, QObject *parent = 0);
+    explicit qtauAudioSource(const QByteArray& data, const QAudioFormat &f, QObject *parent = 0); // shares data
     ~qtauAudioSource();
 
-    QAudioBuffer getAudioBuffer() { return QAudioBuffer(this->buffer(), fmt); }
+    QAudioBuffer getAudioBuffer() { return QAudioBuffer(this->data(), fmt); }
     QAudioFormat getAudioFormat() { return fmt; }
 
     // use if rewriting buffer data completely
@@ -45,8 +68,43 @@ public:
     // should save all buffered pcm data to iodevice in appropriate format
     virtual bool saveToDevice() { return false; }
 
+    // real-time read: gives pointer to unread PCM and moves position forward, nothing is copied or allocated
+    virtual const char* readPcm(qint64 maxBytes, qint64 &gotBytes);
+
+    // hint from reading thread that source will be seeked to pos again and again (loop start), so that
+    // a source which can't seek instantly may get ready for that
+    virtual void prefetch(qint64 pos) { Q_UNUSED(pos); }
+
+    /* Another source of the same audio with its own position, for player or exporter: shares PCM with this one
+     * (streamed sources open their file again, realTime ones decode ahead so audio callback never waits).
+     * Timeline start is copied, mix params are left for caller to share or copy. */
+    virtual qtauAudioSource* duplicate(bool realTime = false) const;
+
+    /* Procedural sources (see Procedural.h) have no PCM to read, mixer has them render each block into
+     * its bus instead. Render adds up to "frames" frames with gain ramp and returns how many were there. */
+    virtual bool   isProcedural() const { return false; }
+    virtual qint64 render(float *, float *, qint64, const SGainRamp &, SBlockLevels * = nullptr) { return 0; }
+
+    // converter to sample rate of mixer that plays this source, made by whoever passes source to mixer
+    qtauRateConverter* getRateConverter() { return converter; }
+    void setRateConverter(qtauRateConverter *c); // takes ownership
+
+    QSharedPointer<qtauMixParams> getMixParams() const { return mixParams; }
+    void setMixParams(const QSharedPointer<qtauMixParams> &p) { if (p) mixParams = p; } // to follow another source
+
+    // where source starts on mixer timeline, negative to skip its beginning. Tracks only
+    qint64 getTimelineStartMS() const   { return timelineStartMS; }
+    void   setTimelineStartMS(qint64 ms) { timelineStartMS = ms; }
+
+    SMixRamp& getMixRamp() { return ramp; }
+
 protected:
     QAudioFormat fmt; // format of that raw PCM data
+    qtauRateConverter *converter;
+
+    QSharedPointer<qtauMixParams> mixParams;
+    qint64   timelineStartMS;
+    SMixRamp ramp;
 
 };
 
@@ -0,0 +1,154 @@
+/* SpscRing.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_SPSCRING_H
+#define QTAU_AUDIO_SPSCRING_H
+
+#include <QVector>
+#include <atomic>
+#include <algorithm>
+
+/* Wait-free ring for one producer thread and one consumer thread, all memory is allocated in constructor.
+ * Capacity is rounded up to a power of two, one slot is always kept empty to tell full ring from empty one. */
+template<typename T> class qtauSpscRing
+{
+public:
+    explicit qtauSpscRing(int capacity) : head(0), tail(0)
+    {
+        int size = 2;
+
+        while (size < capacity + 1)
+            size <<= 1;
+
+        storage.resize(size);
+        items = storage.data(); // detached once here, both threads use plain pointer
+        mask  = size - 1;
+    }
+
+    // producer side
+    bool push(const T &item)
+    {
+        const unsigned h    = head.load(std::memory_order_relaxed);
+        const unsigned next = (h + 1) & mask;
+
+        if (next == tail.load(std::memory_order_acquire))
+            return false; // full
+
+        items[h] = item;
+        head.store(next, std::memory_order_release);
+
+        return true;
+    }
+
+    // consumer side
+    bool pop(T &item)
+    {
+        const unsigned t = tail.load(std::memory_order_relaxed);
+
+        if (t == head.load(std::memory_order_acquire))
+            return false; // empty
+
+        item = items[t];
+        tail.store((t + 1) & mask, std::memory_order_release);
+
+        return true;
+    }
+
+    // consumer side, gives next item without taking it
+    bool peek(T &item) const
+    {
+        const unsigned t = tail.load(std::memory_order_relaxed);
+
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+
+        item = items[t];
+
+        return true;
+    }
+
+    bool isEmpty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+    int capacity() const { return (int)mask; }
+
+    // producer side, copies up to "count" items and returns how many were written
+    int write(const T *src, int count)
+    {
+        const unsigned h = head.load(std::memory_order_relaxed);
+        const unsigned t = tail.load(std::memory_order_acquire);
+        const int n = std::min(count, (int)((t - h - 1) & mask));
+
+        if (n > 0)
+        {
+            const int first = std::min(n, (int)(mask + 1 - h)); // up to the end of storage, rest from the start
+            std::copy(src, src + first, items + h);
+            std::copy(src + first, src + n, items);
+
+            head.store((h + n) & mask, std::memory_order_release);
+        }
+
+        return std::max(n, 0);
+    }
+
+    // consumer side, copies up to "count" items and returns how many were read
+    int read(T *dst, int count)
+    {
+        const unsigned t = tail.load(std::memory_order_relaxed);
+        const unsigned h = head.load(std::memory_order_acquire);
+        const int n = std::min(count, (int)((h - t) & mask));
+
+        if (n > 0)
+        {
+            const int first = std::min(n, (int)(mask + 1 - t));
+            std::copy(items + t, items + t + first, dst);
+            std::copy(items, items + n - first, dst + first);
+
+            tail.store((t + n) & mask, std::memory_order_release);
+        }
+
+        return std::max(n, 0);
+    }
+
+    // consumer side, drops up to "count" items without copying them
+    int skip(int count)
+    {
+        const unsigned t = tail.load(std::memory_order_relaxed);
+        const unsigned h = head.load(std::memory_order_acquire);
+        const int n = std::min(count, (int)((h - t) & mask));
+
+        if (n > 0)
+            tail.store((t + n) & mask, std::memory_order_release);
+
+        return std::max(n, 0);
+    }
+
+    int readAvailable()  const { return (head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed)) & mask; }
+    int writeAvailable() const { return (tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed) - 1) & mask; }
+
+    // consumer side, drops everything written so far
+    void discard() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+
+    // producer side, position that can be given to discardTo later to drop everything written before it
+    unsigned writePosition() const { return head.load(std::memory_order_relaxed); }
+
+    // consumer side, does nothing if reading went past that position already
+    void discardTo(unsigned p)
+    {
+        const unsigned t = tail.load(std::memory_order_relaxed);
+        const unsigned h = head.load(std::memory_order_acquire);
+
+        if (((p - t) & mask) <= ((h - t) & mask))
+            tail.store(p & mask, std::memory_order_release);
+    }
+
+protected:
+    QVector<T> storage;
+    T         *items;
+    unsigned   mask;
+
+    std::atomic<unsigned> head; // next slot to write, changed only by producer
+    std::atomic<unsigned> tail; // next slot to read,  changed only by consumer
+
+    Q_DISABLE_COPY(qtauSpscRing)
+};
+
+#endif // QTAU_AUDIO_SPSCRING_H
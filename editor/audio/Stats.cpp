@@ -0,0 +1,79 @@
+/* Stats.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/Stats.h"
+#include <QStringList>
+
+SAudioStats::SAudioStats() : blocks(0), late(0), underruns(0), paddedFrames(0), maxLoad(0)
+{
+    for (int i = 0; i < c_stats_buckets; ++i)
+        histogram[i] = 0;
+}
+
+QString SAudioStats::toString() const
+{
+    QStringList buckets;
+
+    for (int i = 0; i < c_stats_buckets; ++i)
+        if (histogram[i] > 0)
+            buckets << QString("%1%2%: %3").arg(i == c_stats_buckets - 1 ? QStringLiteral(">=") : QStringLiteral("<"))
+                                           .arg(i == c_stats_buckets - 1 ? i * 10 : (i + 1) * 10)
+                                           .arg(histogram[i]);
+
+    return QString("%1 blocks, %2 late, %3 underruns, %4 frames of silence padding, max load %5% (%6)")
+            .arg(blocks).arg(late).arg(underruns).arg(paddedFrames).arg(qRound(maxLoad * 100))
+            .arg(buckets.join(", "));
+}
+
+void qtauAudioStats::addBlock(qint64 nsecs, qint64 blockNsecs)
+{
+    if (blockNsecs <= 0)
+        return;
+
+    const int permille = (int)qMin(nsecs * 1000 / blockNsecs, (qint64)1000000);
+    const int bucket   = qMin(permille / 100, c_stats_buckets - 1);
+
+    // single writer, so plain load + store is enough and cheaper than read-modify-write
+    blocks.store(blocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    histogram[bucket].store(histogram[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (permille > 1000)
+        late.store(late.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (permille > maxLoadPermille.load(std::memory_order_relaxed))
+        maxLoadPermille.store(permille, std::memory_order_relaxed);
+}
+
+void qtauAudioStats::addPadding(qint64 frames, bool underrun)
+{
+    paddedFrames.store(paddedFrames.load(std::memory_order_relaxed) + frames, std::memory_order_relaxed);
+
+    if (underrun)
+        underruns.store(underruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+SAudioStats qtauAudioStats::snapshot() const
+{
+    SAudioStats result;
+    result.blocks       = blocks      .load(std::memory_order_relaxed);
+    result.late         = late        .load(std::memory_order_relaxed);
+    result.underruns    = underruns   .load(std::memory_order_relaxed);
+    result.paddedFrames = paddedFrames.load(std::memory_order_relaxed);
+    result.maxLoad      = maxLoadPermille.load(std::memory_order_relaxed) / 1000.f;
+
+    for (int i = 0; i < c_stats_buckets; ++i)
+        result.histogram[i] = histogram[i].load(std::memory_order_relaxed);
+
+    return result;
+}
+
+void qtauAudioStats::reset()
+{
+    blocks         .store(0, std::memory_order_relaxed);
+    late           .store(0, std::memory_order_relaxed);
+    underruns      .store(0, std::memory_order_relaxed);
+    paddedFrames   .store(0, std::memory_order_relaxed);
+    maxLoadPermille.store(0, std::memory_order_relaxed);
+
+    for (int i = 0; i < c_stats_buckets; ++i)
+        histogram[i].store(0, std::memory_order_relaxed);
+}
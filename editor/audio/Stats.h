@@ -0,0 +1,51 @@
+/* Stats.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_STATS_H
+#define QTAU_AUDIO_STATS_H
+
+#include <QString>
+#include <atomic>
+
+const int c_stats_buckets = 16; // 10% of block duration each, last one is for 150% and more
+
+typedef struct SAudioStats {
+    quint64 blocks;
+    quint64 late;         // took longer than block duration
+    quint64 underruns;    // padded with silence while there was still something to play
+    quint64 paddedFrames; // all silence padding, end of playback included
+    float   maxLoad;      // worst time/duration ratio
+    quint64 histogram[c_stats_buckets];
+
+    SAudioStats();
+    QString toString() const; // one line for log
+} SAudioStats;
+
+
+/* Timing of real-time blocks against their duration, written by one thread (audio callback or render-ahead),
+ * readable from any. Counters are separate relaxed atomics, so a snapshot may have some of them
+ * one block behind the others - never torn values though. Nothing here allocates or locks. */
+class qtauAudioStats
+{
+public:
+    qtauAudioStats() { reset(); }
+
+    // writer side
+    void addBlock(qint64 nsecs, qint64 blockNsecs);
+    void addPadding(qint64 frames, bool underrun);
+
+    // any thread
+    SAudioStats snapshot() const;
+    void reset(); // shouldn't race with writer, call when it's stopped
+
+protected:
+    std::atomic<quint64> blocks;
+    std::atomic<quint64> late;
+    std::atomic<quint64> underruns;
+    std::atomic<quint64> paddedFrames;
+    std::atomic<int>     maxLoadPermille;
+    std::atomic<quint64> histogram[c_stats_buckets];
+
+    Q_DISABLE_COPY(qtauAudioStats)
+};
+
+#endif // QTAU_AUDIO_STATS_H
@@ -0,0 +1,353 @@
+/* Stream.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "audio/Stream.h"
+#include "audio/Codec.h"
+#include "audio/Kernels.h"
+#include "Utils.h"
+
+#include <QFileInfo>
+#include <string.h>
+
+
+void qtauStreamDecoder::run() { source->decode(); }
+
+qtauStreamSource::qtauStreamSource(const QString &name, bool rt, QObject *parent) :
+    qtauAudioSource(parent), fileName(name), file(name), codec(nullptr), realTime(rt), frameBytes(1),
+    length(0), frame(0), mapped(false), cached(false), silence(0), ring(nullptr), decoder(nullptr), ringFrame(0), seekedTo(0),
+    seeks(0), taken(0), seekCount(0), seekTarget(0), answeredCount(0), answeredPos(0), underruns(0), readFrame(0),
+    padStart(0), padAsks(0), inPad(false), padCount(0), padTarget(0), padAnswered(0), padFrames(0)
+{
+    if (file.open(QFile::ReadOnly))
+    {
+        codec = codecForContent(file, QFileInfo(name).suffix()); // mislabelled files are still read by right codec
+
+        if (codec && codec->openStream())
+        {
+            fmt        = codec->getAudioFormat();
+            frameBytes = qMax(fmt.bytesPerFrame(), 1);
+            length     = codec->frameCount();
+            silence    = (sampleFormat(fmt) == ESampleFormat::U8) ? (char)0x80 : 0;
+
+            const QByteArray pcm = codec->mapPcm(); // zero-copy, file is what's played
+
+            if (!pcm.isEmpty())
+            {
+                setData(pcm);
+                mapped = true;
+            }
+            else
+                cached = length > 0 && codec->data().size() >= length * frameBytes;
+        }
+        else
+        {
+            vsLog::e((codec ? "Could not decode audio file " : "Audio format isn't supported: ") + name);
+            delete codec;
+            codec = nullptr;
+            file.close();
+        }
+    }
+    else vsLog::e("Could not open audio file " + name);
+
+    if (mapped && realTime)
+    {
+        decoder = new qtauStreamDecoder(this);
+        decoder->start(QThread::HighPriority);
+    }
+    else if (codec && realTime)
+    {
+        const qint64 ahead = qMax((qint64)fmt.sampleRate() * c_stream_ahead_ms / 1000, (qint64)c_stream_chunk_frames);
+
+        // everything is allocated here, audio callback only copies
+        ring = new qtauSpscRing<char>((int)(ahead * frameBytes));
+        block.resize(ring->capacity() / frameBytes * frameBytes);
+        chunk.resize(c_stream_chunk_frames * frameBytes);
+        pad  .resize(qMax((qint64)fmt.sampleRate() * c_stream_pad_ms / 1000, (qint64)c_stream_chunk_frames) * frameBytes);
+
+        decoder = new qtauStreamDecoder(this);
+        decoder->start(QThread::HighPriority);
+    }
+
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+qtauStreamSource::~qtauStreamSource()
+{
+    if (decoder)
+    {
+        decoder->requestInterruption();
+        decoder->wait();
+        delete decoder;
+
+        if (underruns > 0)
+            vsLog::d(QString("Decoding of %1 didn't keep up with playback %2 times").arg(fileName).arg(underruns));
+    }
+
+    setData(QByteArray()); // mapped memory is gone with the file
+    delete ring;
+    delete codec;
+}
+
+qtauAudioSource* qtauStreamSource::duplicate(bool rt) const
+{
+    qtauAudioSource *result = cached ? new qtauAudioSource(codec->data(), fmt) // already in memory
+                                     : new qtauStreamSource(fileName, rt);
+    result->setTimelineStartMS(timelineStartMS);
+
+    return result;
+}
+
+bool qtauStreamSource::seek(qint64 pos)
+{
+    const qint64 to = qBound((qint64)0, pos / frameBytes, length);
+
+    if (ring)
+    {
+        takeAnswer();
+
+        // inside what's decoded already, readRing just drops audio before it. Else decoding thread has to jump,
+        // to the end of pad if target is in it - pad is played until ring has what follows
+        const bool decoded = taken == seeks && to >= ringFrame && to <= ringFrame + ring->readAvailable() / frameBytes;
+        inPad = !decoded && padHas(to);
+
+        if (!decoded)
+        {
+            seekedTo = inPad ? padStart + padFrames.load(std::memory_order_relaxed) : to;
+            seekTarget.store(seekedTo, std::memory_order_relaxed);
+            seekCount.store(++seeks, std::memory_order_release);
+        }
+    }
+
+    frame = to;
+    readFrame.store(frame, std::memory_order_relaxed);
+
+    return true;
+}
+
+void qtauStreamSource::prefetch(qint64 pos)
+{
+    const qint64 to = qBound((qint64)0, pos / frameBytes, length);
+
+    if (ring && (padAsks == 0 || to != padStart))
+    {
+        if (inPad) // pad is rewritten, ring should go on from where reader is instead of pad's end
+        {
+            inPad    = false;
+            seekedTo = frame;
+            seekTarget.store(frame, std::memory_order_relaxed);
+            seekCount.store(++seeks, std::memory_order_release);
+        }
+
+        padStart = to;
+        padTarget.store(to, std::memory_order_relaxed);
+        padCount.store(++padAsks, std::memory_order_release);
+    }
+}
+
+bool qtauStreamSource::padHas(qint64 at) const
+{
+    return padAsks > 0 && padAnswered.load(std::memory_order_acquire) == padAsks &&
+           at >= padStart && at < padStart + padFrames.load(std::memory_order_relaxed);
+}
+
+void qtauStreamSource::takeAnswer()
+{
+    if (taken != seeks && answeredCount.load(std::memory_order_acquire) == seeks)
+    {
+        ring->discardTo(answeredPos.load(std::memory_order_relaxed));
+        ringFrame = seekedTo;
+        taken     = seeks;
+    }
+}
+
+const char* qtauStreamSource::readPcm(qint64 maxBytes, qint64 &gotBytes)
+{
+    qint64 frames = qMax(maxBytes / frameBytes, (qint64)0);
+
+    if (mapped) // same as buffered source
+    {
+        const char *result = data().constData() + frame * frameBytes;
+        gotBytes = qBound((qint64)0, length - frame, frames) * frameBytes;
+        frame   += gotBytes / frameBytes;
+        readFrame.store(frame, std::memory_order_relaxed);
+
+        return result;
+    }
+
+    if (ring)
+        frames = qMin(frames, (qint64)block.size() / frameBytes); // c_stream_ahead_ms at most
+    else if (block.size() < frames * frameBytes)
+        block.resize(frames * frameBytes); // not real-time, may allocate
+
+    gotBytes = (ring ? readRing(block.data(), frames) : readDirect(block.data(), frames)) * frameBytes;
+
+    return block.constData();
+}
+
+qint64 qtauStreamSource::readRing(char *dst, qint64 frames)
+{
+    const qint64 result = qBound((qint64)0, length - frame, frames);
+    qint64 got = 0;
+
+    takeAnswer();
+
+    if (inPad && result > 0)
+    {
+        const qint64 padEnd = padStart + padFrames.load(std::memory_order_relaxed);
+        got = qBound((qint64)0, padEnd - frame, result);
+        memcpy(dst, pad.constData() + (frame - padStart) * frameBytes, got * frameBytes);
+        inPad = frame + got < padEnd;
+    }
+
+    const qint64 at = frame + got; // first frame that comes from ring
+
+    if (got < result && taken == seeks)
+    {
+        if (ringFrame < at) // after a short seek forwards, or what was played as silence when decoding fell behind
+            ringFrame += ring->skip((int)qMin((at - ringFrame) * frameBytes, (qint64)ring->capacity())) / frameBytes;
+
+        if (ringFrame == at)
+        {
+            const qint64 n = ring->read(dst + got * frameBytes, (int)((result - got) * frameBytes)) / frameBytes;
+            ringFrame += n;
+            got       += n;
+        }
+    }
+
+    if (got < result) // keeps its place on timeline, audio comes back when decoding catches up
+    {
+        memset(dst + got * frameBytes, silence, (result - got) * frameBytes);
+        underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    frame += result;
+
+    return result;
+}
+
+qint64 qtauStreamSource::readDirect(char *dst, qint64 frames)
+{
+    const qint64 result = qBound((qint64)0, length - frame, frames);
+
+    if (result > 0)
+    {
+        qint64 got = 0;
+        qint64 n   = 0;
+
+        if (codec->streamPos() != frame)
+            codec->seekFrame(frame);
+
+        while (got < result && (n = codec->readFrames(dst + got * frameBytes, result - got)) > 0)
+            got += n;
+
+        if (got < result) // file is shorter than its header said
+            memset(dst + got * frameBytes, silence, (result - got) * frameBytes);
+
+        frame += result;
+    }
+
+    return result;
+}
+
+qint64 qtauStreamSource::readData(char *data, qint64 maxlen)
+{
+    qint64 got = 0;
+    const char *pcm = readPcm(maxlen, got);
+    memcpy(data, pcm, got);
+
+    return got;
+}
+
+void qtauStreamSource::pageIn()
+{
+    const int    page  = 4096;
+    const qint64 ahead = (qint64)fmt.sampleRate() * c_stream_ahead_ms / 1000 * frameBytes;
+    const char  *pcm   = data().constData();
+    const qint64 bytes = length * frameBytes;
+    qint64 from    = 0; // pages from here up to "touched" were read
+    qint64 touched = 0;
+    volatile char sum = 0;
+
+    while (!decoder->isInterruptionRequested())
+    {
+        const qint64 at  = readFrame.load(std::memory_order_relaxed) * frameBytes;
+        const qint64 end = qMin(at + ahead, bytes);
+
+        if (at < from || at > touched) // reader jumped
+            touched = at;
+
+        from = at;
+
+        for (; touched < end; touched += page)
+            sum = sum + pcm[touched]; // reading a byte of page is enough for system to load it
+
+        idle(touched - at);
+    }
+}
+
+void qtauStreamSource::idle(qint64 aheadBytes)
+{
+    // reader won't need this thread for a quarter of what it has ready, only a seek may come sooner
+    const qint64 aheadUSec = aheadBytes / qMax(frameBytes, 1) * 1000000 / qMax(fmt.sampleRate(), 1);
+    QThread::usleep((unsigned long)qBound((qint64)c_stream_idle_min_usec, aheadUSec / 4, (qint64)c_stream_idle_max_usec));
+}
+
+void qtauStreamSource::decode()
+{
+    if (mapped)
+    {
+        pageIn();
+        return;
+    }
+
+    unsigned answered   = 0;
+    unsigned padAnswers = 0;
+    char *c = chunk.data();
+
+    while (!decoder->isInterruptionRequested())
+    {
+        const unsigned asked = seekCount.load(std::memory_order_acquire);
+
+        if (asked != answered) // everything written after this is from new position
+        {
+            codec->seekFrame(seekTarget.load(std::memory_order_relaxed));
+            answeredPos.store(ring->writePosition(), std::memory_order_relaxed);
+            answeredCount.store(asked, std::memory_order_release);
+            answered = asked;
+        }
+
+        const unsigned padAsked = padCount.load(std::memory_order_acquire);
+
+        if (padAsked != padAnswers) // reader doesn't touch pad until it's answered
+        {
+            const qint64 back = codec->streamPos();
+            const qint64 room = pad.size() / frameBytes;
+            qint64 n   = 0;
+            qint64 got = 0;
+
+            codec->seekFrame(padTarget.load(std::memory_order_relaxed));
+
+            while (n < room && (got = codec->readFrames(pad.data() + n * frameBytes, room - n)) > 0)
+                n += got;
+
+            codec->seekFrame(back); // ring goes on from where it was
+            padFrames.store(n, std::memory_order_relaxed);
+            padAnswered.store(padAsked, std::memory_order_release);
+            padAnswers = padAsked;
+        }
+
+        qint64 got = 0;
+
+        if (ring->writeAvailable() >= chunk.size())
+        {
+            got = codec->readFrames(c, c_stream_chunk_frames);
+
+            if (got > 0)
+                ring->write(c, (int)(got * frameBytes));
+        }
+
+        if (got == 0 && ring->writeAvailable() >= chunk.size()) // file has ended, there's nothing to do until a seek
+            QThread::usleep(c_stream_idle_max_usec);
+        else if (got <= 0) // ring is full
+            idle(ring->readAvailable());
+    }
+}
@@ -0,0 +1,125 @@
+/* Stream.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef QTAU_AUDIO_STREAM_H
+#define QTAU_AUDIO_STREAM_H
+
+#include "audio/Source.h"
+#include "audio/SpscRing.h"
+#include <QThread>
+#include <QFile>
+
+class qtauAudioCodec;
+
+const int c_stream_ahead_ms     = 2000; // what real-time stream keeps decoded, also its longest single read
+const int c_stream_chunk_frames = 4096; // decoded at once
+const int c_stream_idle_min_usec = 2000;  // decoding thread sleeps a fraction of what's decoded ahead, in these bounds,
+const int c_stream_idle_max_usec = 25000; // upper one is how late it may answer a seek
+const int c_stream_pad_ms       = 500;  // decoded ahead at a prefetched position, played while ring catches up
+
+
+class qtauStreamSource;
+
+class qtauStreamDecoder : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit qtauStreamDecoder(qtauStreamSource *s) : source(s) {}
+
+protected:
+    qtauStreamSource *source;
+    void run() override;
+
+};
+
+/* Source that decodes its file while it's read instead of caching it whole: opening takes only the header,
+ * and memory doesn't depend on length. Position is in frames of its format, like procedural source it's
+ * a sequential device with own pos/seek, and has no PCM in data().
+ * Plain one decodes in readPcm, for GUI and exporter. Real-time one (see duplicate()) has a thread that keeps
+ * c_stream_ahead_ms decoded in a ring, readPcm only copies from it and gives silence if decoding fell behind,
+ * and seek doesn't wait - audio right after it is silent until the thread catches up. Unless it's a seek to
+ * prefetched position (loop start): thread keeps c_stream_pad_ms decoded there, and that's played meanwhile.
+ * If codec can map its PCM (see qtauAudioCodec::mapPcm), nothing is decoded: data() is the mapped file and readPcm
+ * gives pointers into it, real-time one's thread only touches pages ahead of reader so callback won't wait for disk.
+ * If codec had to decode whole file to open it, copies are plain sources sharing that PCM instead of decoding again. */
+class qtauStreamSource : public qtauAudioSource
+{
+    Q_OBJECT
+    friend class qtauStreamDecoder;
+
+public:
+    explicit qtauStreamSource(const QString &fileName, bool realTime = false, QObject *parent = 0);
+    ~qtauStreamSource();
+
+    bool isValid() const { return codec != nullptr; } // file is open and codec has read its header
+
+    const char*      readPcm(qint64 maxBytes, qint64 &gotBytes) override;
+    qtauAudioSource* duplicate(bool realTime = false) const     override;
+    void             prefetch(qint64 pos)                       override;
+
+    //--- QIODevice interface functions ---------
+    bool   isSequential()   const override { return true; }
+    qint64 pos()            const override { return frame  * frameBytes; }
+    qint64 size()           const override { return length * frameBytes; }
+    bool   seek(qint64 pos)       override;
+    bool   reset()                override { return seek(0); }
+    bool   atEnd()          const override { return frame >= length; }
+    qint64 bytesAvailable() const override { return size() - pos(); }
+    qint64 bytesToWrite()   const override { return 0; }
+    //-------------------------------------------
+
+protected:
+    QString fileName;
+    QFile   file;
+    qtauAudioCodec *codec;
+    bool    realTime;
+
+    int    frameBytes;
+    qint64 length; // in frames
+    qint64 frame;  // reader's position
+    bool   mapped; // data() is file's PCM
+    bool   cached; // codec can't decode incrementally and has all PCM in its buffer, copies share it
+
+    QByteArray block; // what readPcm gives
+
+    char   silence; // byte that silent samples are made of
+
+    // real-time mode: reader asks for seeks by number, decoding thread answers with where new audio starts in ring
+    qtauSpscRing<char>   *ring;
+    qtauStreamDecoder    *decoder;
+    QByteArray            chunk;
+    qint64                ringFrame;     // frame of first byte in ring, valid when last seek is answered
+    qint64                seekedTo;      // reader's side of last seek
+    unsigned              seeks;         // asked by reader
+    unsigned              taken;         // answers that reader has applied
+    std::atomic<unsigned> seekCount;
+    std::atomic<qint64>   seekTarget;
+    std::atomic<unsigned> answeredCount;
+    std::atomic<unsigned> answeredPos;   // ring position where audio from seekTarget starts
+    std::atomic<quint64>  underruns;     // blocks that weren't decoded in time
+    std::atomic<qint64>   readFrame;     // reader's position, for thread that pages mapped file in
+
+    // pad: audio decoded at prefetched position, reader asks for it by number like for seeks
+    QByteArray            pad;
+    qint64                padStart;      // reader's side of last request
+    unsigned              padAsks;
+    bool                  inPad;         // reader plays from pad, ring is being filled from its end
+    std::atomic<unsigned> padCount;
+    std::atomic<qint64>   padTarget;
+    std::atomic<unsigned> padAnswered;   // pad is written only while this differs from padCount
+    std::atomic<qint64>   padFrames;     // decoded into pad
+
+    void   decode();   // loops of decoding thread
+    void   pageIn();
+    void   idle(qint64 aheadBytes); // sleep of decoding thread when reader has that much ready
+    void   takeAnswer();
+    bool   padHas(qint64 at) const; // frame is in pad that answers last request
+    qint64 readRing  (char *dst, qint64 frames);
+    qint64 readDirect(char *dst, qint64 frames);
+
+    qint64 readData(char *data, qint64 maxlen) override;
+    qint64 writeData(const char *, qint64)     override { return 0; }
+
+};
+
+#endif // QTAU_AUDIO_STREAM_H
@@ -2,6 +2,7 @@
 
 #include "audio/codecs/AIFF.h"
 #include "audio/Resampler.h"
+#include "audio/Kernels.h"
 #include "Utils.h"
 
 #include <QDataStream>
@@ -216,7 +217,7 @@ qtauAIFFCodec::qtauAIFFCodec(QIODevice &d, QObject *parent) :
 }
 
 
-bool qtauAIFFCodec::cacheAll()
+bool qtauAIFFCodec::readHeader()
 {
     bool result = false;
 
@@ -237,24 +238,87 @@ bool qtauAIFFCodec::cacheAll()
 
     if (result)
     {
-        if (!dev->isSequential())
-            dev->seek(_data_chunk_location); // else it should already be there
-
         fmt.setCodec("audio/pcm");
         fmt.setByteOrder(QAudioFormat::BigEndian);
         fmt.setSampleType(QAudioFormat::SignedInt);
+    }
+
+    return result;
+}
+
+bool qtauAIFFCodec::cacheAll()
+{
+    bool result = readHeader();
+
+    if (result)
+    {
+        if (!dev->isSequential())
+            dev->seek(_data_chunk_location); // else it should already be there
 
         QAudioFormat preferredFmt = fmt;
         preferredFmt.setByteOrder(QAudioFormat::LittleEndian);
         preferredFmt.setSampleSize(16);
         preferredFmt.setSampleType(QAudioFormat::SignedInt);
 
-        qtauResampler rsmp(dev->read(_data_chunk_length * fmt.sampleSize() / 8 * fmt.channelCount()), fmt, preferredFmt);
+        const QByteArray raw = dev->read(_data_chunk_length * fmt.sampleSize() / 8 * fmt.channelCount());
+        const QByteArray pcm = qtauResampler(raw, fmt, preferredFmt).encode();
         fmt = preferredFmt;
 
         open(QIODevice::ReadWrite);
-        write(rsmp.encode());
+        write(pcm);
         close();
+
+        result = raw.isEmpty() || !pcm.isEmpty(); // resampler has logged why
+    }
+
+    return result;
+}
+
+bool qtauAIFFCodec::openStream()
+{
+    bool result = false;
+
+    if (dev->isSequential())
+        result = qtauAudioCodec::openStream();
+    else if (readHeader())
+    {
+        const qint64 inFile = (dev->size() - (qint64)_data_chunk_location) / qMax(fmt.bytesPerFrame(), 1);
+
+        fmt.setByteOrder(QAudioFormat::LittleEndian); // what readFrames gives
+        streamFrames = qBound((qint64)0, _data_chunk_length, inFile);
+        streamFrame  = 0;
+        result       = sampleFormat(fmt) != ESampleFormat::unknown && dev->seek(_data_chunk_location);
+
+        if (sampleFormat(fmt) == ESampleFormat::unknown)
+            vsLog::e(QString("AIFF codec can't decode %1-bit samples").arg(fmt.sampleSize()));
+    }
+
+    return result;
+}
+
+qint64 qtauAIFFCodec::readFrames(char *pcm, qint64 frames)
+{
+    if (dev->isSequential())
+        return qtauAudioCodec::readFrames(pcm, frames);
+
+    const int frameBytes = fmt.bytesPerFrame();
+    qint64 result = 0;
+    frames = qBound((qint64)0, streamFrames - streamFrame, frames);
+
+    if (frames > 0 && frameBytes > 0)
+    {
+        const qint64 at = (qint64)_data_chunk_location + streamFrame * frameBytes;
+
+        if (streamBlock.size() < frames * frameBytes)
+            streamBlock.resize(frames * frameBytes);
+
+        if (dev->pos() == at || dev->seek(at))
+            result = qMax(dev->read(streamBlock.data(), frames * frameBytes), (qint64)0) / frameBytes;
+
+        const ESampleFormat f = sampleFormat(fmt);
+        convertPcm(streamBlock.constData(), f, true, pcm, f, false, EChannelMap::same, fmt.channelCount(), result);
+
+        streamFrame += result;
     }
 
     return result;
@@ -269,10 +333,21 @@ bool qtauAIFFCodec::saveToDevice()
     AIFFCommon aiffC(fmt, size());
     AIFFData   aiffD(size());
 
+    QAudioFormat aiffSaveFormat; // always saving aiff as S16 BE whatever buffer may hold
+    aiffSaveFormat.setByteOrder(QAudioFormat::BigEndian);
+    aiffSaveFormat.setChannelCount(fmt.channelCount());
+    aiffSaveFormat.setSampleRate(fmt.sampleRate());
+    aiffSaveFormat.setSampleSize(16);
+    aiffSaveFormat.setSampleType(QAudioFormat::SignedInt);
+
+    const QByteArray pcm = qtauResampler(buffer(), fmt, aiffSaveFormat).encode();
+
     if (!dev->isWritable())
         dev->open(QIODevice::WriteOnly);
 
-    if (dev->isWritable())
+    if (pcm.isEmpty() && size() > 0)
+        vsLog::e("AIFF codec could not convert audio to save it, saving cancelled.");
+    else if (dev->isWritable())
     {
         if (!dev->isSequential())
             dev->reset();
@@ -283,15 +358,7 @@ bool qtauAIFFCodec::saveToDevice()
         aiffC.write(writer);
         aiffD.write(writer);
 
-        QAudioFormat aiffSaveFormat; // always saving aiff as S16 BE whatever buffer may hold
-        aiffSaveFormat.setByteOrder(QAudioFormat::BigEndian);
-        aiffSaveFormat.setChannelCount(fmt.channelCount());
-        aiffSaveFormat.setSampleRate(fmt.sampleRate());
-        aiffSaveFormat.setSampleSize(16);
-        aiffSaveFormat.setSampleType(QAudioFormat::SignedInt);
-
-        qtauResampler rsmp(buffer(), fmt, aiffSaveFormat);
-        dev->write(rsmp.encode()); // don't close device because who knows what is it - could end badly if it was a socket
+        dev->write(pcm); // don't close device because who knows what is it - could end badly if it was a socket
 
         result = true;
     }
@@ -17,14 +17,21 @@ public:
     bool cacheAll()     override;
     bool saveToDevice() override;
 
+    // reads sound chunk straight from device and swaps it to little-endian, in its own sample size
+    bool   openStream()                        override;
+    qint64 readFrames(char *pcm, qint64 frames) override;
+
 protected:
     qtauAIFFCodec(QIODevice &d, QObject *parent = 0);
 
+    bool readHeader(); // everything up to audio data, sets fmt as it is in file (big-endian)
     bool findCommonChunk(QDataStream &reader);
     bool findSoundChunk(QDataStream &reader);
 
     quint64 _data_chunk_location;  // bytes
-    int     _data_chunk_length;    // in frames
+    qint64  _data_chunk_length;    // in frames
+
+    QByteArray streamBlock; // big-endian frames before swapping
 
 };
 
@@ -42,6 +49,15 @@ public:
     {
         return new qtauAIFFCodec(d, parent);
     }
+
+    int probe(const QByteArray &head) const override
+    {
+        if (!head.startsWith("FORM"))
+            return 0;
+
+        // compressed AIFF-C can't be decoded, but nothing else will claim it
+        return (head.mid(8, 4) == "AIFF") ? c_probe_sure : (head.mid(8, 4) == "AIFC") ? c_probe_sure / 2 : 0;
+    }
 };
 
 #endif // QTAU_CODEC_AIFF_H
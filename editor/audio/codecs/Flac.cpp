@@ -1,14 +1,880 @@
 /* Flac.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
 
 #include "audio/codecs/Flac.h"
+#include "audio/Kernels.h"
 #include "Utils.h"
+#include "FLAC/stream_encoder.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QDataStream>
+#include <qendian.h>
+#include <limits.h>
+
+extern "C" {
+#include "private/crc.h"
+
+// exported by libFLAC 1.3.0, but declared only in its protected headers
+FLAC_API FLAC__bool FLAC__stream_encoder_set_do_md5(FLAC__StreamEncoder *encoder, FLAC__bool value);
+}
+
+const qint64 c_flac_cache_frames = 1 << 20; // how much cache grows by when file doesn't say its length
+
+
+// left-aligns samples of a planar FLAC block in a wider container, interleaved little-endian
+template<int Bytes> inline void interleave(const FLAC__int32 *const *src, qint64 from, qint64 frames,
+                                           int channels, int shift, char *dst)
+{
+    for (qint64 i = from; i < from + frames; ++i)
+        for (int c = 0; c < channels; ++c, dst += Bytes)
+        {
+            const quint32 s = (quint32)src[c][i] << shift;
+
+            dst[0] = (char)s;
+            dst[1] = (char)(s >> 8);
+            if (Bytes > 2) dst[2] = (char)(s >> 16);
+            if (Bytes > 3) dst[3] = (char)(s >> 24);
+        }
+}
+
+
+// one block of audio to be encoded by thread pool
+class qtauFlacEncodeJob : public QRunnable
+{
+public:
+    qtauFlacEncodeJob(qtauFlacCodec *c, int index, const QByteArray &pcm, qint64 firstFrame) :
+        owner(c), index(index), pcm(pcm), firstFrame(firstFrame) {}
+
+    void run() override
+    {
+        owner->jobDone(index, owner->encodeBlock(pcm, firstFrame));
+    }
+
+protected:
+    qtauFlacCodec *owner;
+    int        index;
+    QByteArray pcm;
+    qint64     firstFrame;
+};
+
 
 qtauFlacCodec::qtauFlacCodec(QIODevice &d, QObject *parent) :
-    qtauAudioCodec(d, parent)
+    qtauAudioCodec(d, parent), decoder(nullptr), fileBits(0), fileFrames(0), decodeErrors(0), ogg(false), oggSerial(0),
+    pending(nullptr), pendingStart(0), pendingFrames(0), pendingUsed(0), jobFill(0), submittedFrames(0), submitted(0), written(0),
+    ahead(1), pool(nullptr), streamOk(false), md5(QCryptographicHash::Md5), metadataBytes(0), encodedBytes(0),
+    minFrameBytes(0), maxFrameBytes(0)
 {
     if (!d.isOpen())
         vsLog::e("Flac codec got a closed io device!");
 }
 
-bool qtauFlacCodec::cacheAll() { return false; }
-bool qtauFlacCodec::saveToDevice() { return false; }
+qtauFlacCodec::~qtauFlacCodec()
+{
+    closeDecoder();
+
+    if (pool) // stream wasn't ended, jobs still use this
+    {
+        pool->waitForDone();
+        delete pool;
+    }
+
+    if (decodeErrors > 0)
+        vsLog::d(QString("Flac codec skipped %1 broken frames or failed seeks").arg(decodeErrors));
+}
+
+bool qtauFlacCodec::openDecoder()
+{
+    bool result = false;
+    const bool seekable = !dev->isSequential();
+
+    closeDecoder();
+    fileBits   = 0;
+    fileFrames = 0;
+    seekIndex.clear();
+    seekTable.clear();
+
+    if (seekable)
+        dev->reset();
+
+    // Ogg page starts with its magic, and has serial number of its stream at 14
+    char head[18];
+    ogg       = dev->peek(head, sizeof(head)) == sizeof(head) && !memcmp(head, "OggS", 4);
+    oggSerial = ogg ? qFromLittleEndian<qint32>(reinterpret_cast<const uchar*>(head) + 14) : 0;
+
+    decoder = FLAC__stream_decoder_new();
+
+    if (decoder)
+    {
+        FLAC__stream_decoder_set_metadata_respond(decoder, FLAC__METADATA_TYPE_SEEKTABLE);
+
+        // sequential devices can't seek, decoder should know that to not try
+        const FLAC__StreamDecoderInitStatus init = (ogg ? FLAC__stream_decoder_init_ogg_stream
+                                                        : FLAC__stream_decoder_init_stream)(decoder, readCallback,
+                                                   seekable ? seekCallback   : nullptr,
+                                                   seekable ? tellCallback   : nullptr,
+                                                   seekable ? lengthCallback : nullptr,
+                                                   eofCallback, writeCallback, metadataCallback, errorCallback, this);
+
+        result = init == FLAC__STREAM_DECODER_INIT_STATUS_OK &&
+                 FLAC__stream_decoder_process_until_end_of_metadata(decoder) && fileBits > 0;
+    }
+
+    if (result && seekable)
+    {
+        FLAC__uint64 first = 0;
+
+        if (ogg) // first audio packet is on a page of its own, after headers (with granule position 0)
+        {
+            const qint64 decoding = dev->pos();
+            qint64 granule = 0;
+            qint64 bytes   = 0;
+
+            for (qint64 at = 0; readPage(at, granule, bytes); at += bytes)
+                if (granule != 0)
+                {
+                    seekIndex.insert(0, at);
+                    break;
+                }
+
+            dev->seek(decoding);
+        }
+        else if (FLAC__stream_decoder_get_decode_position(decoder, &first))
+        {
+            // offsets of seek points are from first frame
+            seekIndex.insert(0, (qint64)first);
+
+            for (int i = 0; i + 1 < seekTable.size(); i += 2)
+                seekIndex.insert((qint64)seekTable[i], (qint64)(first + seekTable[i + 1]));
+        }
+
+        seekTable.clear();
+    }
+
+    if (!result)
+    {
+        vsLog::e(ogg ? "Flac codec found no FLAC in Ogg stream (Vorbis isn't supported)"
+                     : "Flac codec couldn't read stream info");
+        closeDecoder();
+    }
+
+    return result;
+}
+
+void qtauFlacCodec::closeDecoder()
+{
+    if (decoder)
+    {
+        FLAC__stream_decoder_finish(decoder);
+        FLAC__stream_decoder_delete(decoder);
+        decoder = nullptr;
+    }
+
+    pending       = nullptr;
+    pendingFrames = 0;
+    pendingUsed   = 0;
+}
+
+qint64 qtauFlacCodec::decode(char *pcm, qint64 frames)
+{
+    const int channels   = fmt.channelCount();
+    const int shift      = fmt.sampleSize() - fileBits;
+    const int frameBytes = fmt.bytesPerFrame();
+    qint64 result = 0;
+
+    while (result < frames)
+    {
+        if (pendingUsed < pendingFrames)
+        {
+            const qint64 n   = qMin(frames - result, pendingFrames - pendingUsed);
+            char        *dst = pcm + result * frameBytes;
+
+            switch (fmt.sampleSize())
+            {
+            case 16: interleave<2>(pending, pendingUsed, n, channels, shift, dst); break;
+            case 24: interleave<3>(pending, pendingUsed, n, channels, shift, dst); break;
+            default: interleave<4>(pending, pendingUsed, n, channels, shift, dst); break;
+            }
+
+            pendingUsed += n;
+            result      += n;
+        }
+        else
+        {
+            pendingFrames = 0; // decoder reuses its buffers
+            pendingUsed   = 0;
+
+            if (FLAC__stream_decoder_get_state(decoder) >= FLAC__STREAM_DECODER_END_OF_STREAM ||
+                !FLAC__stream_decoder_process_single(decoder))
+                break;
+        }
+    }
+
+    return result;
+}
+
+bool qtauFlacCodec::cacheAll()
+{
+    bool result = openDecoder();
+
+    if (result)
+    {
+        // decoded right into buffer, it only grows if file doesn't say how long it is
+        const int frameBytes = fmt.bytesPerFrame();
+        QByteArray &pcm = buffer();
+        qint64 room   = (qint64)fileFrames;
+        qint64 frames = 0;
+
+        do
+        {
+            if (fileFrames == 0)
+                room += c_flac_cache_frames;
+
+            if (room * frameBytes > INT_MAX)
+            {
+                vsLog::e("Flac file is too long to be cached");
+                result = false;
+                break;
+            }
+
+            pcm.resize((int)(room * frameBytes));
+            frames += decode(pcm.data() + frames * frameBytes, room - frames);
+        }
+        while (frames == room && fileFrames == 0);
+
+        pcm.resize(result ? (int)(frames * frameBytes) : 0);
+        closeDecoder(); // readFrames and seekFrame go to buffer then
+    }
+
+    return result;
+}
+
+bool qtauFlacCodec::openStream()
+{
+    bool result = false;
+
+    if (dev->isSequential())
+        result = qtauAudioCodec::openStream();
+    else if (openDecoder())
+    {
+        if (fileFrames > 0)
+        {
+            streamFrames = fileFrames;
+            streamFrame  = 0;
+            result       = true;
+        }
+        else
+            result = qtauAudioCodec::openStream(); // length is known only after decoding all of it
+    }
+
+    return result;
+}
+
+qint64 qtauFlacCodec::readFrames(char *pcm, qint64 frames)
+{
+    if (!decoder)
+        return qtauAudioCodec::readFrames(pcm, frames);
+
+    frames = qBound((qint64)0, streamFrames - streamFrame, frames);
+    const qint64 result = (frames > 0) ? decode(pcm, frames) : 0;
+    streamFrame += result;
+
+    return result;
+}
+
+bool qtauFlacCodec::seekFrame(qint64 frame)
+{
+    if (!decoder)
+        return qtauAudioCodec::seekFrame(frame);
+
+    const qint64 to = qBound((qint64)0, frame, streamFrames);
+    bool result = true;
+
+    pendingFrames = 0;
+    pendingUsed   = 0;
+
+    if (to < streamFrames)
+    {
+        if (ogg)
+            bisectPages(to);
+
+        // nearest known frame before target, if it's close then decoding from it is cheaper than searching
+        QMap<qint64, qint64>::const_iterator p = seekIndex.upperBound(to);
+
+        result = p != seekIndex.constBegin() && (ogg || to - (p - 1).key() <= c_flac_seek_scan_frames) &&
+                 decodeFrom((p - 1).value(), to);
+
+        // decoder gives the frame it landed in to writeCallback, starting right at target
+        if (!result)
+            result = FLAC__stream_decoder_flush(decoder) && FLAC__stream_decoder_seek_absolute(decoder, (FLAC__uint64)to);
+
+        if (!result)
+        {
+            FLAC__stream_decoder_flush(decoder); // it can't go on after failed seek without that
+            ++decodeErrors;
+        }
+    }
+
+    streamFrame = result ? to : streamFrames; // where decoder is isn't known, nothing is read until next seek
+
+    return result && to == frame;
+}
+
+bool qtauFlacCodec::decodeFrom(qint64 offset, qint64 frame)
+{
+    bool result = dev->seek(offset) && FLAC__stream_decoder_flush(decoder);
+
+    while (result)
+    {
+        pendingFrames = 0;
+        pendingUsed   = 0;
+
+        result = FLAC__stream_decoder_get_state(decoder) < FLAC__STREAM_DECODER_END_OF_STREAM &&
+                 FLAC__stream_decoder_process_single(decoder);
+
+        if (result && pendingFrames > 0)
+        {
+            if (pendingStart > frame)
+                result = false; // index was wrong
+            else if (pendingStart + pendingFrames > frame)
+            {
+                pendingUsed = frame - pendingStart;
+                break;
+            }
+        }
+    }
+
+    if (!result)
+        pendingFrames = 0;
+
+    return result;
+}
+
+bool qtauFlacCodec::readPage(qint64 &at, qint64 &granule, qint64 &bytes)
+{
+    // only header is read, page body may be tens of KB: capture pattern, version 0 and serial of the stream
+    // are enough to tell a page from audio data that happens to look like one
+    const int  header = 27;
+    bool       result = false;
+    qint64     pos    = at; // of buf's first byte
+    QByteArray buf;
+
+    if (dev->seek(at))
+        while (!result && pos - at < c_ogg_page_search_bytes)
+        {
+            const QByteArray more = dev->read(4096);
+
+            if (more.isEmpty())
+                break;
+
+            buf.append(more);
+            int i = 0;
+
+            for (; i + header <= buf.size(); ++i)
+            {
+                const uchar *h = reinterpret_cast<const uchar*>(buf.constData()) + i;
+
+                if (memcmp(h, "OggS", 4) || h[4] != 0 || qFromLittleEndian<qint32>(h + 14) != oggSerial)
+                    continue;
+
+                const int segments = h[26];
+
+                if (i + header + segments > buf.size())
+                    break; // segment table is in next read
+
+                bytes = header + segments;
+
+                for (int s = 0; s < segments; ++s)
+                    bytes += h[header + s];
+
+                at      = pos + i;
+                granule = qFromLittleEndian<qint64>(h + 6); // -1 if no packet ends on page
+                result  = true;
+                break;
+            }
+
+            if (!result) // keeps what may be start of a header
+            {
+                buf.remove(0, i);
+                pos += i;
+            }
+        }
+
+    return result;
+}
+
+void qtauFlacCodec::bisectPages(qint64 frame)
+{
+    // known pages around target, page with granule position g is indexed by g + 1: decoding from its start
+    // gets a packet that begins not later than that, one that went on from previous page is dropped
+    QMap<qint64, qint64>::const_iterator above = seekIndex.upperBound(frame);
+
+    if (above == seekIndex.constBegin())
+        return; // audio start isn't known
+
+    qint64 lo      = (above - 1).value();
+    qint64 loFrame = (above - 1).key();
+    qint64 hi      = (above == seekIndex.constEnd()) ? dev->size()  : above.value();
+    qint64 hiFrame = (above == seekIndex.constEnd()) ? streamFrames : above.key();
+    qint64 at      = 0;
+    qint64 granule = 0;
+    qint64 bytes   = 0;
+    qint64 loEnd   = lo;    // where page at lo ends, if it's known
+    bool   halve   = false; // guess by bitrate, unless last guess didn't cut range at least in half
+
+    while (hi - lo > c_ogg_bisect_bytes && loEnd < hi)
+    {
+        const qint64 range = hi - lo;
+        const qint64 guess = halve ? lo + range / 2
+                                   : qBound(lo + 1, lo + (qint64)((double)range * (frame - loFrame) / qMax(hiFrame - loFrame, (qint64)1))
+                                                    - c_ogg_bisect_bytes, hi - 1); // page search goes forward
+        at = guess;
+
+        if (!readPage(at, granule, bytes) || at >= hi)
+            hi = guess; // no page starts after guess
+        else
+        {
+            if (granule > 0)
+                seekIndex.insert(granule + 1, at);
+
+            if (granule >= 0 && granule < frame)
+            {
+                lo      = at;
+                loEnd   = at + bytes;
+                loFrame = granule + 1;
+            }
+            else
+            {
+                hi      = at; // page without position may be after target too
+                hiFrame = (granule >= 0) ? granule + 1 : hiFrame;
+            }
+        }
+
+        halve = !halve && hi - lo > range / 2;
+    }
+
+    for (at = loEnd; readPage(at, granule, bytes) && at < hi; at += bytes)
+        if (granule > 0)
+            seekIndex.insert(granule + 1, at);
+}
+
+//-------------------------------------------------------
+
+bool qtauFlacCodec::saveToDevice()
+{
+    const QByteArray &pcm = data();
+    return beginStream() && writeStream(pcm.constData(), pcm.size()) && endStream();
+}
+
+bool qtauFlacCodec::beginStream()
+{
+    const ESampleFormat srcF = sampleFormat(fmt, true);
+    const bool wide = srcF == ESampleFormat::S24 || srcF == ESampleFormat::S32 || srcF == ESampleFormat::F32;
+
+    saveFmt = fmt;
+    saveFmt.setCodec("audio/pcm");
+    saveFmt.setByteOrder(QAudioFormat::LittleEndian);
+    saveFmt.setSampleType(QAudioFormat::SignedInt);
+    saveFmt.setSampleSize(wide ? 24 : 16);
+
+    streamOk        = false;
+    jobFill         = 0;
+    submittedFrames = 0;
+    submitted       = 0;
+    written         = 0;
+    encodedBytes    = 0;
+    minFrameBytes   = 0;
+    maxFrameBytes   = 0;
+    frameOffsets.clear();
+    encoded.clear();
+    md5.reset();
+
+    if (!dev->isWritable())
+        dev->open(QIODevice::WriteOnly);
+
+    if (srcF == ESampleFormat::unknown || fmt.channelCount() < 1 || fmt.channelCount() > 8)
+        vsLog::e("Flac codec can't save this audio format");
+    else if (dev->isWritable())
+    {
+        if (!dev->isSequential())
+            dev->reset();
+
+        writeMetadata(false);
+
+        delete pool;
+        pool = new QThreadPool();
+        pool->setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+        ahead = pool->maxThreadCount() * c_flac_jobs_per_thread;
+
+        jobPcm.resize(c_flac_job_frames * saveFmt.bytesPerFrame());
+        streamOk = true;
+    }
+    else vsLog::e("Flac codec could not open iodevice for writing, saving cancelled.");
+
+    return streamOk;
+}
+
+bool qtauFlacCodec::writeStream(const char *pcm, qint64 bytes)
+{
+    const ESampleFormat srcF = sampleFormat(fmt, true);
+    const ESampleFormat dstF = sampleFormat(saveFmt);
+    const bool srcBE      = fmt.byteOrder() == QAudioFormat::BigEndian;
+    const int  srcBytes   = fmt.bytesPerFrame();
+    const int  frameBytes = saveFmt.bytesPerFrame();
+    qint64 frames = (streamOk && srcBytes > 0) ? bytes / srcBytes : 0;
+
+    // converted in place where next job collects its audio, MD5 is of what's saved
+    while (streamOk && frames > 0)
+    {
+        const qint64 n   = qMin(frames, c_flac_job_frames - jobFill);
+        char        *dst = jobPcm.data() + jobFill * frameBytes;
+
+        streamOk = convertPcm(pcm, srcF, srcBE, dst, dstF, false, EChannelMap::same, fmt.channelCount(), (int)n);
+        md5.addData(dst, (int)(n * frameBytes));
+
+        pcm     += n * srcBytes;
+        frames  -= n;
+        jobFill += n;
+
+        if (jobFill == c_flac_job_frames)
+        {
+            submitJob();
+            writeEncoded(ahead);
+        }
+    }
+
+    return streamOk;
+}
+
+bool qtauFlacCodec::endStream()
+{
+    if (pool)
+    {
+        if (streamOk && jobFill > 0)
+            submitJob();
+
+        writeEncoded(0);
+        pool->waitForDone();
+        delete pool;
+        pool = nullptr;
+
+        if (streamOk && !dev->isSequential()) // header is rewritten, device isn't closed - it's not codec's
+        {
+            const qint64 end = dev->pos();
+            dev->seek(0);
+            writeMetadata(true);
+            dev->seek(end);
+        }
+    }
+
+    jobPcm = QByteArray();
+    encoded.clear();
+
+    return streamOk;
+}
+
+void qtauFlacCodec::submitJob()
+{
+    jobPcm.resize((int)(jobFill * saveFmt.bytesPerFrame()));
+    pool->start(new qtauFlacEncodeJob(this, submitted++, jobPcm, submittedFrames / c_flac_blocksize));
+
+    submittedFrames += jobFill;
+    jobFill = 0;
+    jobPcm  = QByteArray(); // job has the only reference now, so new one won't be a copy of it
+    jobPcm.resize(c_flac_job_frames * saveFmt.bytesPerFrame());
+}
+
+void qtauFlacCodec::jobDone(int index, const SFlacEncoded &e)
+{
+    QMutexLocker l(&encodedLock);
+    encoded[index] = e;
+    encodedReady.wakeAll();
+}
+
+void qtauFlacCodec::writeEncoded(int keepPending)
+{
+    while (written < submitted)
+    {
+        SFlacEncoded e;
+        {
+            QMutexLocker l(&encodedLock);
+
+            while (!encoded.contains(written) && submitted - written > keepPending)
+                encodedReady.wait(&encodedLock);
+
+            if (!encoded.contains(written))
+                break;
+
+            e = encoded.take(written);
+        }
+
+        ++written;
+
+        if (streamOk)
+        {
+            streamOk = e.ok && dev->write(e.frames) == e.frames.size();
+
+            foreach (quint32 s, e.sizes)
+            {
+                frameOffsets.append(encodedBytes);
+                encodedBytes += s;
+                minFrameBytes = (minFrameBytes == 0) ? s : qMin(minFrameBytes, s);
+                maxFrameBytes = qMax(maxFrameBytes, s);
+            }
+
+            if (!streamOk)
+                vsLog::e("Flac codec could not encode or write audio, saving cancelled.");
+        }
+    }
+}
+
+void qtauFlacCodec::writeMetadata(bool final)
+{
+    // STREAMINFO and SEEKTABLE of c_flac_seek_points, first one without length and MD5 (0 is "unknown" for both)
+    const quint64 frames   = final ? (quint64)submittedFrames : 0;
+    const quint64 spacing  = qMax((quint64)saveFmt.sampleRate() * c_flac_seek_spacing_sec,
+                                  (frames + c_flac_seek_points - 1) / c_flac_seek_points);
+    const QByteArray sum   = final ? md5.result() : QByteArray(16, 0);
+    const quint64    bits  = ((quint64)saveFmt.sampleRate() << 44) | ((quint64)(saveFmt.channelCount() - 1) << 41) |
+                             ((quint64)(saveFmt.sampleSize() - 1) << 36) | (frames & 0xFFFFFFFFFULL);
+
+    QByteArray meta;
+    QDataStream writer(&meta, QIODevice::WriteOnly); // big-endian, as FLAC is
+
+    writer.writeRawData("fLaC", 4);
+    writer << (quint32)(34);                          // not last, type 0
+    writer << (quint16)c_flac_blocksize << (quint16)c_flac_blocksize;
+    writer << (quint8)(minFrameBytes >> 16) << (quint16)minFrameBytes;
+    writer << (quint8)(maxFrameBytes >> 16) << (quint16)maxFrameBytes;
+    writer << bits;
+    writer.writeRawData(sum.constData(), 16);
+
+    writer << (quint32)(0x80000000 | (3 << 24) | (18 * c_flac_seek_points)); // last, type 3
+    int points = 0;
+
+    for (quint64 at = 0; at < frames && points < c_flac_seek_points; at += spacing, ++points)
+    {
+        const qint64  f      = qMin((qint64)(at / c_flac_blocksize), (qint64)frameOffsets.size() - 1);
+        const quint64 sample = (quint64)f * c_flac_blocksize;
+
+        writer << sample << (quint64)frameOffsets[f] << (quint16)qMin(frames - sample, (quint64)c_flac_blocksize);
+    }
+
+    for (; points < c_flac_seek_points; ++points)
+        writer << (quint64)0xFFFFFFFFFFFFFFFFULL << (quint64)0 << (quint16)0; // placeholder
+
+    metadataBytes = meta.size();
+
+    if (dev->write(meta) != meta.size())
+    {
+        vsLog::e("Flac codec could not write stream header");
+        streamOk = false;
+    }
+}
+
+//-------------------------------------------------------
+
+// frame number as FLAC frame header has it, in UTF-8 way of coding
+static void appendFrameNumber(QByteArray &out, quint64 n)
+{
+    if (n < 0x80)
+        out.append((char)n);
+    else
+    {
+        int more = 1; // continuation bytes, 6 bits each
+
+        while (more < 6 && n >= (1ULL << (6 * more + 6 - more)))
+            ++more;
+
+        out.append((char)((0xFF00 >> (more + 1)) | (n >> (6 * more))));
+
+        for (int i = more - 1; i >= 0; --i)
+            out.append((char)(0x80 | ((n >> (6 * i)) & 0x3F)));
+    }
+}
+
+// collects frames that encoder writes, with numbers made as in whole file
+typedef struct SFlacCollector {
+    SFlacEncoded *out;
+    qint64        firstFrame;
+} SFlacCollector;
+
+static FLAC__StreamEncoderWriteStatus collectFrame(const FLAC__StreamEncoder*, const FLAC__byte buffer[], size_t bytes,
+                                                   unsigned samples, unsigned frame, void *c)
+{
+    if (samples == 0 || bytes < 8) // metadata, whole file's one is written by codec
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+
+    SFlacCollector *col = static_cast<SFlacCollector*>(c);
+    QByteArray &out = col->out->frames;
+    const int start = out.size();
+
+    // header is sync, block size and sample rate codes, channels and bits, frame number, optional size/rate, CRC-8
+    int numBytes = 1;
+
+    while (numBytes < 7 && (buffer[4] & (0x80 >> (numBytes - 1))) && (buffer[4] & (0x80 >> numBytes)))
+        ++numBytes;
+
+    const int sizeCode = buffer[2] >> 4;
+    const int rateCode = buffer[2] & 0x0F;
+    const int extra    = ((sizeCode == 6) ? 1 : (sizeCode == 7) ? 2 : 0) +
+                         ((rateCode == 12) ? 1 : (rateCode == 13 || rateCode == 14) ? 2 : 0);
+    const int headerEnd = 4 + numBytes + extra; // where CRC-8 is
+
+    out.append(reinterpret_cast<const char*>(buffer), 4);
+    appendFrameNumber(out, (quint64)(col->firstFrame + frame));
+    out.append(reinterpret_cast<const char*>(buffer) + 4 + numBytes, extra);
+    out.append((char)FLAC__crc8(reinterpret_cast<const FLAC__byte*>(out.constData()) + start, out.size() - start));
+    out.append(reinterpret_cast<const char*>(buffer) + headerEnd + 1, (int)bytes - headerEnd - 1 - 2);
+
+    const unsigned crc = FLAC__crc16(reinterpret_cast<const FLAC__byte*>(out.constData()) + start, out.size() - start);
+    out.append((char)(crc >> 8));
+    out.append((char)(crc & 0xFF));
+
+    col->out->sizes.append(out.size() - start);
+
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+SFlacEncoded qtauFlacCodec::encodeBlock(const QByteArray &pcm, qint64 firstFrame) const
+{
+    SFlacEncoded result;
+    const int    channels = saveFmt.channelCount();
+    const int    bytes    = saveFmt.sampleSize() / 8;
+    const qint64 frames   = pcm.size() / saveFmt.bytesPerFrame();
+
+    // libFLAC takes samples as 32-bit ints
+    QVector<FLAC__int32> samples(frames * channels);
+    const uchar *src = reinterpret_cast<const uchar*>(pcm.constData());
+
+    if (bytes == 2)
+        for (int i = 0; i < samples.size(); ++i, src += 2)
+            samples[i] = (qint16)(src[0] | (src[1] << 8));
+    else
+        for (int i = 0; i < samples.size(); ++i, src += 3)
+            samples[i] = (qint32)((src[0] << 8) | (src[1] << 16) | ((quint32)src[2] << 24)) >> 8;
+
+    result.frames.reserve(pcm.size());
+
+    FLAC__StreamEncoder *e = FLAC__stream_encoder_new();
+    SFlacCollector col = { &result, firstFrame };
+
+    if (e)
+    {
+        FLAC__stream_encoder_set_channels        (e, channels);
+        FLAC__stream_encoder_set_bits_per_sample (e, saveFmt.sampleSize());
+        FLAC__stream_encoder_set_sample_rate     (e, saveFmt.sampleRate());
+        FLAC__stream_encoder_set_compression_level(e, c_flac_compression);
+        FLAC__stream_encoder_set_blocksize       (e, c_flac_blocksize);
+        FLAC__stream_encoder_set_total_samples_estimate(e, frames);
+        FLAC__stream_encoder_set_do_md5          (e, false); // of whole file is counted by codec
+
+        result.ok = FLAC__stream_encoder_init_stream(e, collectFrame, nullptr, nullptr, nullptr, &col) ==
+                        FLAC__STREAM_ENCODER_INIT_STATUS_OK &&
+                    FLAC__stream_encoder_process_interleaved(e, samples.constData(), (unsigned)frames);
+
+        result.ok = FLAC__stream_encoder_finish(e) && result.ok; // last frame is written here
+        FLAC__stream_encoder_delete(e);
+    }
+
+    return result;
+}
+
+//-------------------------------------------------------
+
+FLAC__StreamDecoderReadStatus qtauFlacCodec::readCallback(const FLAC__StreamDecoder*, FLAC__byte buf[], size_t *bytes, void *c)
+{
+    QIODevice *d = static_cast<qtauFlacCodec*>(c)->dev;
+    const qint64 got = (*bytes > 0) ? d->read(reinterpret_cast<char*>(buf), *bytes) : -1;
+    FLAC__StreamDecoderReadStatus result = FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+
+    if (got > 0)
+        result = FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+    else if (got == 0)
+        result = FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+
+    *bytes = (size_t)qMax(got, (qint64)0);
+
+    return result;
+}
+
+FLAC__StreamDecoderSeekStatus qtauFlacCodec::seekCallback(const FLAC__StreamDecoder*, FLAC__uint64 offset, void *c)
+{
+    return static_cast<qtauFlacCodec*>(c)->dev->seek((qint64)offset) ? FLAC__STREAM_DECODER_SEEK_STATUS_OK
+                                                                       : FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+}
+
+FLAC__StreamDecoderTellStatus qtauFlacCodec::tellCallback(const FLAC__StreamDecoder*, FLAC__uint64 *offset, void *c)
+{
+    *offset = (FLAC__uint64)static_cast<qtauFlacCodec*>(c)->dev->pos();
+    return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+FLAC__StreamDecoderLengthStatus qtauFlacCodec::lengthCallback(const FLAC__StreamDecoder*, FLAC__uint64 *length, void *c)
+{
+    *length = (FLAC__uint64)static_cast<qtauFlacCodec*>(c)->dev->size();
+    return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
+FLAC__bool qtauFlacCodec::eofCallback(const FLAC__StreamDecoder*, void *c)
+{
+    return static_cast<qtauFlacCodec*>(c)->dev->atEnd();
+}
+
+FLAC__StreamDecoderWriteStatus qtauFlacCodec::writeCallback(const FLAC__StreamDecoder *d, const FLAC__Frame *frame,
+                                                            const FLAC__int32 *const buffer[], void *c)
+{
+    // samples aren't copied, decode() reads decoder's buffers before asking for next frame. Pointers to them are:
+    // after a seek into middle of a frame, libFLAC gives an array from its own stack, offset to target
+    qtauFlacCodec *f = static_cast<qtauFlacCodec*>(c);
+
+    for (unsigned ch = 0; ch < frame->header.channels; ++ch)
+        f->pendingCh[ch] = buffer[ch];
+
+    f->pending       = f->pendingCh;
+    f->pendingStart  = (qint64)frame->header.number.sample_number;
+    f->pendingFrames = frame->header.blocksize;
+    f->pendingUsed   = 0;
+
+    // where next frame starts, so seeking back to what was played is exact. Ogg and sequential devices can't say
+    FLAC__uint64 next = 0;
+
+    if (FLAC__stream_decoder_get_decode_position(d, &next))
+        f->seekIndex.insert(f->pendingStart + f->pendingFrames, (qint64)next);
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+void qtauFlacCodec::metadataCallback(const FLAC__StreamDecoder*, const FLAC__StreamMetadata *meta, void *c)
+{
+    qtauFlacCodec *f = static_cast<qtauFlacCodec*>(c);
+
+    if (meta->type == FLAC__METADATA_TYPE_SEEKTABLE)
+    {
+        for (unsigned i = 0; i < meta->data.seek_table.num_points; ++i)
+        {
+            const FLAC__StreamMetadata_SeekPoint &p = meta->data.seek_table.points[i];
+
+            if (p.sample_number != FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER && p.frame_samples > 0)
+                f->seekTable << p.sample_number << p.stream_offset;
+        }
+    }
+    else if (meta->type == FLAC__METADATA_TYPE_STREAMINFO)
+    {
+        const FLAC__StreamMetadata_StreamInfo &si = meta->data.stream_info;
+
+        f->fileBits   = si.bits_per_sample;
+        f->fileFrames = si.total_samples;
+
+        f->fmt.setCodec("audio/pcm");
+        f->fmt.setByteOrder(QAudioFormat::LittleEndian);
+        f->fmt.setSampleType(QAudioFormat::SignedInt);
+        f->fmt.setSampleSize((si.bits_per_sample <= 16) ? 16 : (si.bits_per_sample <= 24) ? 24 : 32);
+        f->fmt.setChannelCount(si.channels);
+        f->fmt.setSampleRate(si.sample_rate);
+    }
+}
+
+void qtauFlacCodec::errorCallback(const FLAC__StreamDecoder*, FLAC__StreamDecoderErrorStatus, void *c)
+{
+    ++static_cast<qtauFlacCodec*>(c)->decodeErrors; // decoder resyncs by itself, may be called from decoding thread
+}
@@ -4,19 +4,135 @@
 #define QTAU_CODEC_FLAC_H
 
 #include "audio/Codec.h"
+#include "FLAC/stream_decoder.h"
 
+#include <QMutex>
+#include <QWaitCondition>
+#include <QMap>
+#include <QVector>
+#include <QCryptographicHash>
+
+class QThreadPool;
+
+const int c_flac_blocksize        = 4096;                  // frames in each FLAC frame that's written
+const int c_flac_job_frames       = 64 * c_flac_blocksize; // encoded by one pool job
+const int c_flac_jobs_per_thread  = 2;                     // how far encoding may go ahead of writing
+const int c_flac_compression      = 8;                     // slowest libFLAC preset, it's parallel anyway
+const int c_flac_seek_points      = 256;                   // reserved in SEEKTABLE, spread over whole file
+const int c_flac_seek_spacing_sec = 10;                    // but not denser than that
+const int c_flac_seek_scan_frames = 2 * c_flac_blocksize;  // decoded forward from a known frame, farther is libFLAC's search
+const int c_ogg_bisect_bytes      = 1 << 16;               // bisection of Ogg pages stops there, rest is read page by page
+const int c_ogg_page_search_bytes = 1 << 18;               // how far next page of stream is looked for, pages are 64K at most
+
+
+// FLAC frames of one encoded block of audio, numbered as in whole file
+typedef struct SFlacEncoded {
+    QByteArray       frames;
+    QVector<quint32> sizes; // of each frame
+    bool             ok;
+
+    SFlacEncoded() : ok(false) {}
+} SFlacEncoded;
+
+/* Decodes with libFLAC's stream decoder reading the device through callbacks. Samples go from decoder's own
+ * buffers straight to caller's PCM, interleaved as S16, S24 or S32 little-endian (smallest that holds file's
+ * bit depth), a frame that didn't fit is kept in decoder until next readFrames. Seekable devices are decoded
+ * as they're read, sequential ones are cached whole.
+ * FLAC in Ogg container is decoded too. Seeking jumps to nearest frame that's known to start before target and
+ * decodes forward: known are SEEKTABLE points and every frame decoded so far, and for Ogg, pages that bisection by
+ * granule positions found around targets - each seek makes index denser. Targets far from native FLAC's
+ * known frames are left to libFLAC's own seek, which uses SEEKTABLE too.
+ * Encoding cuts audio into blocks of c_flac_job_frames, each compressed by its own libFLAC encoder on a thread pool.
+ * FLAC frames don't depend on each other, so the only thing to fix is frame number in their headers; frames are
+ * written in order, and STREAMINFO (with MD5 of all audio) and SEEKTABLE are rewritten at the end if device
+ * is seekable - else they say that length and MD5 are unknown. Saves 16-bit samples, or 24-bit if fmt has more. */
 class qtauFlacCodec : public qtauAudioCodec
 {
     Q_OBJECT
     friend class qtauFlacCodecFactory;
 
 public:
+    ~qtauFlacCodec();
+
     bool cacheAll()     override;
     bool saveToDevice() override;
 
+    bool beginStream()                              override;
+    bool writeStream(const char *pcm, qint64 bytes) override;
+    bool endStream()                                override;
+
+    bool   openStream()                         override;
+    qint64 readFrames(char *pcm, qint64 frames) override;
+    bool   seekFrame(qint64 frame)              override;
+
+    SFlacEncoded encodeBlock(const QByteArray &pcm, qint64 firstFrame) const; // any thread
+    void         jobDone(int index, const SFlacEncoded &e);                  // called by pool jobs
+
 protected:
     qtauFlacCodec(QIODevice &d, QObject *parent = 0);
 
+    FLAC__StreamDecoder *decoder;
+    int      fileBits;    // of samples in file, format has them in a wider container
+    quint64  fileFrames;  // from STREAMINFO, 0 if encoder didn't know it
+    quint64  decodeErrors;
+    bool     ogg;         // FLAC in Ogg container
+    int      oggSerial;   // of its logical stream
+
+    // frame that decoder wrote last, valid until it's asked to decode again
+    const FLAC__int32 *const *pending;
+    const FLAC__int32 *pendingCh[FLAC__MAX_CHANNELS]; // what pending points to, callback's array may be gone
+    qint64 pendingStart;  // its first sample
+    qint64 pendingFrames;
+    qint64 pendingUsed;
+
+    // byte offsets that decoding can start from, by first sample that's surely decoded from there
+    QMap<qint64, qint64>   seekIndex;
+    QVector<FLAC__uint64>  seekTable; // sample and offset of each SEEKTABLE point, until first frame's offset is known
+
+    bool   openDecoder(); // reads metadata, sets fmt
+    void   closeDecoder();
+    qint64 decode(char *pcm, qint64 frames);
+    bool   decodeFrom(qint64 offset, qint64 frame); // flushes decoder at offset, pending is frame then
+    bool   readPage(qint64 &at, qint64 &granule, qint64 &bytes); // next Ogg page of stream at or after "at"
+    void   bisectPages(qint64 frame);                              // indexes pages around it
+
+    // encoding
+    QAudioFormat saveFmt;         // S16 or S24 LE, with channels and rate of fmt
+    QByteArray   jobPcm;          // in saveFmt, collected for next pool job
+    qint64       jobFill;         // frames in it
+    qint64       submittedFrames;
+    int          submitted;       // jobs
+    int          written;
+    int          ahead;           // jobs that may be encoded but not written yet
+    QThreadPool *pool;
+    bool         streamOk;
+
+    QMutex                  encodedLock;
+    QWaitCondition          encodedReady;
+    QMap<int, SFlacEncoded> encoded; // by job, not written yet
+
+    QCryptographicHash md5;           // of all saved PCM, as STREAMINFO has it
+    qint64             metadataBytes; // before first frame
+    qint64             encodedBytes;  // of frames
+    QVector<qint64>    frameOffsets;  // of each written frame from first one, for SEEKTABLE
+    quint32            minFrameBytes;
+    quint32            maxFrameBytes;
+
+    void submitJob();
+    void writeEncoded(int keepPending); // writes finished jobs in order, waits while more than that are left
+    void writeMetadata(bool final);     // at device start, final one has length, MD5 and seek points
+
+    // libFLAC decoder callbacks, client data is codec
+    static FLAC__StreamDecoderReadStatus   readCallback  (const FLAC__StreamDecoder*, FLAC__byte buf[], size_t *bytes, void *c);
+    static FLAC__StreamDecoderSeekStatus   seekCallback  (const FLAC__StreamDecoder*, FLAC__uint64 offset, void *c);
+    static FLAC__StreamDecoderTellStatus   tellCallback  (const FLAC__StreamDecoder*, FLAC__uint64 *offset, void *c);
+    static FLAC__StreamDecoderLengthStatus lengthCallback(const FLAC__StreamDecoder*, FLAC__uint64 *length, void *c);
+    static FLAC__bool                      eofCallback   (const FLAC__StreamDecoder*, void *c);
+    static FLAC__StreamDecoderWriteStatus  writeCallback (const FLAC__StreamDecoder*, const FLAC__Frame *frame,
+                                                          const FLAC__int32 *const buffer[], void *c);
+    static void metadataCallback(const FLAC__StreamDecoder*, const FLAC__StreamMetadata *meta, void *c);
+    static void errorCallback   (const FLAC__StreamDecoder*, FLAC__StreamDecoderErrorStatus, void *c);
+
 };
 
 class qtauFlacCodecFactory : public qtauAudioCodecFactory
@@ -33,6 +149,12 @@ public:
     {
         return new qtauFlacCodec(d, parent);
     }
+
+    int probe(const QByteArray &head) const override
+    {
+        // libFLAC skips ID3v2 tag before stream, but it's just as likely to be followed by MP3
+        return head.startsWith("fLaC") ? c_probe_sure : head.startsWith("ID3") ? c_probe_sure / 4 : 0;
+    }
 };
 
 #endif // QTAU_CODEC_FLAC_H
@@ -4,11 +4,17 @@
 #include "Utils.h"
 
 qtauOggCodec::qtauOggCodec(QIODevice &d, QObject *parent) :
-    qtauAudioCodec(d, parent)
+    qtauFlacCodec(d, parent)
+{}
+
+bool qtauOggCodec::saveToDevice()
 {
-    if (!d.isOpen())
-        vsLog::e("Ogg codec got a closed io device!");
+    vsLog::e("Ogg codec can't save, use FLAC");
+    return false;
 }
 
-bool qtauOggCodec::cacheAll()  { return false; }
-bool qtauOggCodec::saveToDevice()  { return false; }
+bool qtauOggCodec::beginStream()
+{
+    vsLog::e("Ogg codec can't save, use FLAC");
+    return false;
+}
@@ -3,16 +3,18 @@
 #ifndef QTAU_CODEC_OGG_H
 #define QTAU_CODEC_OGG_H
 
-#include "audio/Codec.h"
+#include "audio/codecs/Flac.h"
 
-class qtauOggCodec : public qtauAudioCodec
+/* Ogg container, only with FLAC in it: decoding and seeking are FLAC codec's, which tells Ogg by its first page.
+ * Vorbis needs libvorbis, which isn't bundled, and saving writes native FLAC only - both fail with an error. */
+class qtauOggCodec : public qtauFlacCodec
 {
     Q_OBJECT
     friend class qtauOggCodecFactory;
 
 public:
-    bool cacheAll()     override;
     bool saveToDevice() override;
+    bool beginStream()  override;
 
 protected:
     qtauOggCodec(QIODevice &d, QObject *parent = 0);
@@ -26,13 +28,24 @@ public:
     {
         _ext  = "ogg";
         _mime = "audio/ogg";
-        _desc = "Ogg Vorbis lossy audio";
+        _desc = "Ogg FLAC lossless audio";
     }
 
     qtauAudioCodec* make(QIODevice &d, QObject *parent = 0) override
     {
         return new qtauOggCodec(d, parent);
     }
+
+    int probe(const QByteArray &head) const override
+    {
+        if (!head.startsWith("OggS") || head.size() < 27)
+            return 0;
+
+        // first packet follows page's segment table, FLAC mapping starts it with 0x7F "FLAC"
+        const int packet = 27 + (uchar)head[26];
+
+        return (head.mid(packet, 5) == "\x7f" "FLAC") ? c_probe_sure : c_probe_sure / 4; // Vorbis, codec will say it can't decode it
+    }
 };
 
 #endif // QTAU_CODEC_OGG_H
@@ -1,10 +1,12 @@
 /* Wav.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
 
 #include "audio/codecs/Wav.h"
-#include "audio/Resampler.h"
+#include "audio/Kernels.h"
 #include "Utils.h"
 #include <qendian.h>
 #include <QDataStream>
+#include <QFileDevice>
+#include <limits.h>
 
 
 //----- WAV PCM RIFF header parts -----------------------
@@ -174,7 +176,7 @@ typedef struct SWavData {
 //-------------------------------------------------------
 
 
-bool qtauWavCodec::cacheAll()
+bool qtauWavCodec::readHeader()
 {
     bool result = false;
 
@@ -193,30 +195,135 @@ bool qtauWavCodec::cacheAll()
     }
     else vsLog::e("Audio Wav: empty data");
 
+    if (result)
+    {
+        fmt.setCodec("audio/pcm");
+        fmt.setByteOrder(QAudioFormat::LittleEndian);
+    }
+
+    return result;
+}
+
+bool qtauWavCodec::cacheAll()
+{
+    bool result = readHeader();
+
     if (result)
     {
         if (!dev->isSequential())
             dev->seek(_data_chunk_location); // else it should already be there
 
-        fmt.setCodec("audio/pcm");
-        fmt.setByteOrder(QAudioFormat::LittleEndian);
+        // read right into buffer, no temporary copy of whole data chunk. Size in header may be more than file has
+        // (0xFFFFFFFF in streamed recordings), and buffer can't be bigger than INT_MAX
+        const qint64 frameBytes = qMax(fmt.bytesPerFrame(), 1);
+        qint64 bytes = _data_chunk_length * frameBytes;
+
+        if (!dev->isSequential())
+            bytes = qMin(bytes, dev->size() - (qint64)_data_chunk_location);
+
+        bytes = qMax(qMin(bytes, (qint64)INT_MAX) / frameBytes * frameBytes, (qint64)0);
+
+        QByteArray &pcm = buffer();
+        pcm.resize((int)bytes);
+        pcm.resize((int)qMax(dev->read(pcm.data(), pcm.size()), (qint64)0));
+    }
 
-        open(QIODevice::WriteOnly);
-        write(dev->read(_data_chunk_length * fmt.sampleSize() / 8 * fmt.channelCount()));
-        close();
+    return result;
+}
+
+bool qtauWavCodec::openStream()
+{
+    bool result = false;
+
+    if (dev->isSequential())
+        result = qtauAudioCodec::openStream();
+    else if (readHeader())
+    {
+        // header of an unfinished recording may claim more than there is
+        const qint64 inFile = (dev->size() - (qint64)_data_chunk_location) / qMax(fmt.bytesPerFrame(), 1);
+
+        streamFrames = qBound((qint64)0, _data_chunk_length, inFile);
+        streamFrame  = 0;
+        result       = dev->seek(_data_chunk_location);
+    }
+
+    return result;
+}
+
+qint64 qtauWavCodec::readFrames(char *pcm, qint64 frames)
+{
+    if (dev->isSequential())
+        return qtauAudioCodec::readFrames(pcm, frames);
+
+    const int frameBytes = fmt.bytesPerFrame();
+    qint64 result = 0;
+    frames = qBound((qint64)0, streamFrames - streamFrame, frames);
+
+    if (frames > 0 && frameBytes > 0)
+    {
+        // wav pcm is already what mixer reads, no conversion
+        const qint64 at = (qint64)_data_chunk_location + streamFrame * frameBytes;
+
+        if (dev->pos() == at || dev->seek(at))
+            result = qMax(dev->read(pcm, frames * frameBytes), (qint64)0) / frameBytes;
+
+        streamFrame += result;
     }
 
     return result;
 }
 
 
+QByteArray qtauWavCodec::mapPcm()
+{
+    QByteArray result;
+    QFileDevice *fd = qobject_cast<QFileDevice*>(dev);
+    const qint64 bytes = streamFrames * fmt.bytesPerFrame();
+
+    // wav pcm is little-endian, so mixer reads any of its formats as is. QByteArray can't be longer than 2GB
+    if (fd && bytes > 0 && bytes <= INT_MAX && sampleFormat(fmt) != ESampleFormat::unknown)
+    {
+        uchar *m = fd->map(_data_chunk_location, bytes);
+
+        if (m)
+            result = QByteArray::fromRawData(reinterpret_cast<const char*>(m), (int)bytes);
+    }
+
+    return result;
+}
+
 bool qtauWavCodec::saveToDevice()
 {
-    bool result = false;
+    const QByteArray &pcm = data();
+    return beginStream() && writeStream(pcm.constData(), pcm.size()) && endStream();
+}
 
-    wavRIFF wavR(size());
-    wavFmt  wavF(fmt);
-    wavData wavD(size());
+// streaming doesn't know final size, so header gets biggest one until it's rewritten
+const qint64 c_wav_unknown_size = 0xFFFFFFFF - 36;
+
+void qtauWavCodec::writeHeader(qint64 dataBytes)
+{
+    wavRIFF wavR(dataBytes);
+    wavFmt  wavF(saveFmt);
+    wavData wavD(dataBytes);
+
+    QDataStream writer(dev);
+
+    wavR.write(writer);
+    wavF.write(writer);
+    wavD.write(writer);
+}
+
+bool qtauWavCodec::beginStream()
+{
+    streamOk      = false;
+    streamedBytes = 0;
+
+    saveFmt = fmt; // always saving wav as S16 LE whatever buffer may hold
+    saveFmt.setCodec("audio/pcm");
+    saveFmt.setByteOrder(QAudioFormat::LittleEndian);
+    saveFmt.setSampleSize(16);
+    saveFmt.setSampleType(QAudioFormat::SignedInt);
 
     if (!dev->isWritable())
         dev->open(QIODevice::WriteOnly);
@@ -226,32 +333,69 @@ bool qtauWavCodec::saveToDevice()
         if (!dev->isSequential())
             dev->reset();
 
-        QDataStream writer(dev);
+        writeHeader(c_wav_unknown_size);
+        streamOk = true;
+    }
+    else vsLog::e("Wav codec could not open iodevice for writing, saving cancelled.");
+
+    return streamOk;
+}
+
+bool qtauWavCodec::writeStream(const char *pcm, qint64 bytes)
+{
+    ESampleFormat srcF = sampleFormat(fmt, true);
+    bool srcBE  = fmt.byteOrder() == QAudioFormat::BigEndian;
+    int  frames = (srcF != ESampleFormat::unknown) ? bytes / (sampleBytes(srcF) * fmt.channelCount()) : 0;
+
+    if (streamOk && frames > 0)
+    {
+        if (srcF == ESampleFormat::S16 && !srcBE)
+            streamOk = dev->write(pcm, bytes) == bytes; // already in wav format
+        else
+        {
+            const qint64 outBytes = (qint64)frames * saveFmt.bytesPerFrame();
 
-        wavR.write(writer);
-        wavF.write(writer);
-        wavD.write(writer);
+            if (streamBlock.size() < outBytes)
+                streamBlock.resize(outBytes);
 
-        QAudioFormat wavSaveFormat; // always saving wav as S16 LE whatever buffer may hold
-        wavSaveFormat.setByteOrder(QAudioFormat::LittleEndian);
-        wavSaveFormat.setChannelCount(fmt.channelCount());
-        wavSaveFormat.setSampleRate(fmt.sampleRate());
-        wavSaveFormat.setSampleSize(16);
-        wavSaveFormat.setSampleType(QAudioFormat::SignedInt);
+            streamOk = convertPcm(pcm, srcF, srcBE, streamBlock.data(), ESampleFormat::S16, false,
+                                  EChannelMap::same, fmt.channelCount(), frames) &&
+                       dev->write(streamBlock.constData(), outBytes) == outBytes;
+            bytes = outBytes;
+        }
 
-        qtauResampler rsmp(buffer(), fmt, wavSaveFormat);
-        dev->write(rsmp.encode()); // don't close device because who knows what is it - could end badly if it was a socket
+        streamedBytes += bytes;
 
-        result = true;
+        if (!streamOk)
+            vsLog::e("Wav codec could not write audio data, saving cancelled.");
+    }
+    else if (srcF == ESampleFormat::unknown)
+    {
+        vsLog::e("Wav codec can't save this sample format");
+        streamOk = false;
     }
-    else vsLog::e("Wav codec could not open iodevice for writing, saving cancelled.");
 
-    return result;
+    return streamOk;
+}
+
+bool qtauWavCodec::endStream()
+{
+    if (streamOk && !dev->isSequential()) // don't close device because who knows what is it - could end badly if it was a socket
+    {
+        const qint64 end = dev->pos();
+        dev->seek(0);
+        writeHeader(streamedBytes);
+        dev->seek(end);
+    }
+
+    streamBlock = QByteArray();
+
+    return streamOk;
 }
 
 
 qtauWavCodec::qtauWavCodec(QIODevice &d, QObject *parent) :
-    qtauAudioCodec(d, parent)
+    qtauAudioCodec(d, parent), streamedBytes(0), streamOk(false)
 {
     if (!d.isOpen())
         vsLog::e("Wav codec got a closed io device!");
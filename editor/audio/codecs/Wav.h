@@ -16,14 +16,31 @@ public:
     bool cacheAll()     override;
     bool saveToDevice() override;
 
+    // writes straight to device, sizes in header are fixed by endStream if device is seekable
+    bool beginStream()                                override;
+    bool writeStream(const char *pcm, qint64 bytes)   override;
+    bool endStream()                                  override;
+
+    // reads data chunk straight from device, which should be seekable - sequential ones are cached whole
+    bool   openStream()                        override;
+    qint64 readFrames(char *pcm, qint64 frames) override;
+    QByteArray mapPcm()                         override;
+
 protected:
     qtauWavCodec(QIODevice &d, QObject *parent = 0);
 
+    bool readHeader(); // everything up to audio data, sets fmt
     bool findFormatChunk(QDataStream &reader);
     bool findDataChunk(QDataStream &reader);
+    void writeHeader(qint64 dataBytes);
 
     quint64 _data_chunk_location;  // bytes
-    int     _data_chunk_length;    // in frames
+    qint64  _data_chunk_length;    // in frames
+
+    QAudioFormat saveFmt;       // always S16 LE, with channels and rate of fmt
+    QByteArray   streamBlock;   // encoded block
+    qint64       streamedBytes; // of encoded audio data
+    bool         streamOk;
 
 };
 
@@ -41,6 +58,11 @@ public:
     {
         return new qtauWavCodec(d, parent);
     }
+
+    int probe(const QByteArray &head) const override
+    {
+        return (head.startsWith("RIFF") && head.mid(8, 4) == "WAVE") ? c_probe_sure : 0;
+    }
 };
 
 #endif // QTAU_CODEC_WAV_H
@@ -31,6 +31,18 @@ SOURCES += \
     audio/codecs/Flac.cpp \
     audio/codecs/Ogg.cpp \
     audio/Resampler.cpp \
+    audio/Kernels.cpp \
+    audio/RtGuard.cpp \
+    audio/RenderAhead.cpp \
+    audio/Stats.cpp \
+    audio/Mixdown.cpp \
+    audio/Playhead.cpp \
+    audio/PreviewCache.cpp \
+    audio/Procedural.cpp \
+    audio/Levels.cpp \
+    audio/Sink.cpp \
+    audio/Stream.cpp \
+    ui/levelBar.cpp
 
 HEADERS  += \
     mainwindow.h \
@@ -50,13 +62,27 @@ HEADERS  += \
     audio/Source.h \
     audio/Player.h \
     audio/Mixer.h \
+    audio/SpscRing.h \
+    audio/Seqlock.h \
     audio/Codec.h \
     ../tools/utauloid/ust.h \
     audio/codecs/Wav.h \
     audio/codecs/AIFF.h \
     audio/codecs/Flac.h \
     audio/codecs/Ogg.h \
-    audio/Resampler.h
+    audio/Resampler.h \
+    audio/Kernels.h \
+    audio/RtGuard.h \
+    audio/RenderAhead.h \
+    audio/Stats.h \
+    audio/Mixdown.h \
+    audio/Playhead.h \
+    audio/PreviewCache.h \
+    audio/Procedural.h \
+    audio/Levels.h \
+    audio/Sink.h \
+    audio/Stream.h \
+    ui/levelBar.h
 
 FORMS += ui/mainwindow.ui
 
@@ -66,6 +92,12 @@ windows:RC_FILE = res/qtau_win.rc
 
 QMAKE_CXXFLAGS += -Wall -std=c++11
 
+# mixer kernels use SSE2 always on x86, configure with CONFIG+=avx2 to let them use AVX2 too
+avx2:QMAKE_CXXFLAGS += -mavx2
+
+# debug builds count heap usage inside of audio callback, see audio/RtGuard.h
+CONFIG(debug, debug|release):DEFINES += QTAU_RT_ALLOC_GUARD
+
 #--------------------------------------------
 CONFIG(debug, debug|release) {
     DESTDIR = $${OUT_PWD}/../debug
@@ -20,17 +20,24 @@
 #include <QTextEdit>
 #include <QComboBox>
 #include <QDial>
+#include <QToolButton>
+#include <QStatusBar>
 
 #include <QFileDialog>
+#include <QProgressDialog>
 
 #include "ui/Config.h"
 #include "ui/piano.h"
 #include "ui/dynDrawer.h"
 #include "ui/noteEditor.h"
 #include "ui/meter.h"
+#include "ui/levelBar.h"
 #include "ui/waveform.h"
 
 #include "audio/Codec.h"
+#include "audio/Playhead.h"
+#include "audio/Stats.h"
+#include "audio/Source.h"
 
 const int cdef_bars             = 128; // 128 bars "is enough for everyone" // TODO: make dynamic
 
@@ -40,6 +47,9 @@ const int c_meter_min_height    = 20;
 const int c_waveform_min_height = 50;
 const int c_drawzone_min_height = 100;
 const int c_dynbuttons_num      = 10;
+const int c_track_levels_height = 8;
+const int c_playhead_update_ms  = 16;  // about display refresh rate
+const int c_stats_update_ms     = 500; // readable, counters don't need more
 
 const QString c_dynlbl_css_off = QString("QLabel { color : %1; }").arg(cdef_color_dynbtn_off);
 const QString c_dynlbl_css_bg  = QString("QLabel { color : %1; }").arg(cdef_color_dynbtn_bg);
@@ -73,8 +83,8 @@ const QString c_icon_pause      = QStringLiteral(":/images/b_pause.png");
 
 
 MainWindow::MainWindow(QWidget *parent) :
-    QMainWindow(parent), ui(new Ui::MainWindow),
-    logNewMessages(0), logHasErrors(false), showNewLogNumber(true)
+    QMainWindow(parent), ui(new Ui::MainWindow), doc(nullptr), exportDlg(nullptr), playhead(nullptr),
+    controller(nullptr), logNewMessages(0), logHasErrors(false), showNewLogNumber(true)
 {
     ui->setupUi(this);
 
@@ -152,6 +162,47 @@ MainWindow::MainWindow(QWidget *parent) :
     waveControls->setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Expanding);
     waveControls->setFrameStyle(QFrame::Panel | QFrame::Raised);
 
+    // mute button, volume and pan sliders of each track, applied by mixer while playing, and its level meter
+    QGridLayout *waveControlsL = new QGridLayout();
+    waveControlsL->setContentsMargins(2,2,2,2);
+    waveControlsL->setSpacing(1);
+
+    QString trackNames[2] = { tr("vocal"), tr("music") };
+
+    for (int i = 0; i < 2; ++i)
+    {
+        trackMute[i] = new QToolButton(this);
+        trackMute[i]->setCheckable(true);
+        trackMute[i]->setAutoRaise(true);
+        trackMute[i]->setIcon(QIcon(c_icon_sound));
+        trackMute[i]->setToolTip(tr("Mute %1").arg(trackNames[i]));
+
+        trackVolume[i] = new QSlider(Qt::Horizontal, this);
+        trackVolume[i]->setRange(0, 100);
+        trackVolume[i]->setValue(100);
+        trackVolume[i]->setToolTip(tr("Volume of %1").arg(trackNames[i]));
+
+        trackPan[i] = new QSlider(Qt::Horizontal, this);
+        trackPan[i]->setRange(-100, 100);
+        trackPan[i]->setValue(0);
+        trackPan[i]->setToolTip(tr("Pan of %1").arg(trackNames[i]));
+
+        trackLevels[i] = new qtauLevelBar(this);
+        trackLevels[i]->setFixedHeight(c_track_levels_height);
+        trackLevels[i]->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+
+        waveControlsL->addWidget(trackMute  [i], i * 3,     0, 3, 1);
+        waveControlsL->addWidget(trackVolume[i], i * 3,     1, 1, 1);
+        waveControlsL->addWidget(trackPan   [i], i * 3 + 1, 1, 1, 1);
+        waveControlsL->addWidget(trackLevels[i], i * 3 + 2, 1, 1, 1);
+
+        connect(trackMute  [i], SIGNAL(toggled(bool)),     SLOT(onTrackMixChanged()));
+        connect(trackVolume[i], SIGNAL(valueChanged(int)), SLOT(onTrackMixChanged()));
+        connect(trackPan   [i], SIGNAL(valueChanged(int)), SLOT(onTrackMixChanged()));
+    }
+
+    waveControls->setLayout(waveControlsL);
+
     vocalWave = new qtauWaveform(this);
     vocalWave->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
     vocalWave->setMinimumHeight(c_waveform_min_height);
@@ -413,8 +464,11 @@ MainWindow::MainWindow(QWidget *parent) :
     muteBtn->setCheckable(true);
     connect(muteBtn, SIGNAL(toggled(bool)), SLOT(onMute(bool)));
 
+    levelBar = new qtauLevelBar(this);
+
     playerTB->addWidget(volume);
     playerTB->addAction(muteBtn);
+    playerTB->addWidget(levelBar);
 
     QComboBox *quantizeCombo = new QComboBox(this);
     QComboBox *lengthCombo   = new QComboBox(this);
@@ -480,6 +534,20 @@ MainWindow::MainWindow(QWidget *parent) :
 
     connect(ui->actionSave_audio_as, &QAction::triggered, this, &MainWindow::onSaveAudioAs);
 
+    playheadTimer = new QTimer(this);
+    playheadTimer->setTimerType(Qt::PreciseTimer);
+    playheadTimer->setInterval(c_playhead_update_ms);
+    connect(playheadTimer, &QTimer::timeout, this, &MainWindow::onPlayheadTimer);
+
+    audioStatsLbl = new QLabel(this);
+    audioStatsLbl->setToolTip(tr("Audio blocks that took longer than their duration, underruns and worst load "
+                                 "of playback since it started"));
+    statusBar()->addPermanentWidget(audioStatsLbl);
+
+    statsTimer = new QTimer(this);
+    statsTimer->setInterval(c_stats_update_ms);
+    connect(statsTimer, &QTimer::timeout, this, &MainWindow::onStatsTimer);
+
     //----------------------------------------------
 
     lastScoreDir     = settings.value(c_key_dir_score,   "").toString();
@@ -557,11 +625,16 @@ bool MainWindow::setController(qtauController &c, qtauSession &s)
     connect(ui->actionPlay,   &QAction::triggered, doc, &qtauSession::startPlayback );
     connect(ui->actionStop,   &QAction::triggered, doc, &qtauSession::stopPlayback  );
     connect(ui->actionBack,   &QAction::triggered, doc, &qtauSession::resetPlayback );
-    connect(ui->actionRepeat, &QAction::triggered, doc, &qtauSession::repeatPlayback);
+    connect(ui->actionRepeat, &QAction::triggered, this, &MainWindow::onRepeat     );
 
     connect(this,   &MainWindow::loadUST,      &c, &qtauController::onLoadUST       );
     connect(this,   &MainWindow::saveUST,      &c, &qtauController::onSaveUST       );
     connect(this,   &MainWindow::saveAudio,    &c, &qtauController::onSaveAudio     );
+    connect(this,   &MainWindow::cancelExport, &c, &qtauController::onCancelExport  );
+    connect(this,   &MainWindow::loopRegion,   &c, &qtauController::onLoopRegion    );
+    connect(ui->actionMetronome, &QAction::toggled, &c, &qtauController::onMetronome);
+    connect(&c, &qtauController::exportProgress, this, &MainWindow::onExportProgress);
+    connect(&c, &qtauController::exportFinished, this, &MainWindow::onExportFinished);
 
     connect(this,   &MainWindow::loadAudio,    &c, &qtauController::onLoadAudio     );
     connect(volume, &QSlider   ::valueChanged, &c, &qtauController::onVolumeChanged );
@@ -569,9 +642,34 @@ bool MainWindow::setController(qtauController &c, qtauSession &s)
 
     connect(piano, &qtauPiano::keyPressed,     &c, &qtauController::pianoKeyPressed );
     connect(piano, &qtauPiano::keyReleased,    &c, &qtauController::pianoKeyReleased);
+
+    playhead   = c.getPlayhead();
+    controller = &c;
+    levelBar->setMeter(c.getLevels());
+    setTrackMeters();
     //-----------------------------------------------------------------------
 
     c.onVolumeChanged(volume->value());
+    // controls show mixing setup of session, without writing it back
+    const float volumes[2] = { doc->getVocal().volume, doc->getMusic().volume };
+    const float pans   [2] = { doc->getVocal().pan,    doc->getMusic().pan    };
+    const bool  muted  [2] = { doc->getVocal().muted,  doc->getMusic().muted  };
+
+    for (int i = 0; i < 2; ++i)
+    {
+        trackVolume[i]->blockSignals(true);
+        trackPan   [i]->blockSignals(true);
+        trackMute  [i]->blockSignals(true);
+
+        trackVolume[i]->setValue(qRound(volumes[i] * 100));
+        trackPan   [i]->setValue(qRound(pans   [i] * 100));
+        trackMute  [i]->setChecked(muted[i]);
+        trackMute  [i]->setIcon(QIcon(muted[i] ? c_icon_mute : c_icon_sound));
+
+        trackVolume[i]->blockSignals(false);
+        trackPan   [i]->blockSignals(false);
+        trackMute  [i]->blockSignals(false);
+    }
 
     // widget configuration - maybe read app settings here?
     noteEditor->setRMBScrollEnabled(!ui->actionEdit_Mode->isChecked());
@@ -641,6 +739,33 @@ void MainWindow::onSaveAudioAs()
     else vsLog::e(tr("Can't save audio because no audio codecs. At all. This shouldn't happen!"));
 }
 
+void MainWindow::onExportProgress(int percent)
+{
+    if (!exportDlg)
+    {
+        // editing and playback go on while it's exported, so dialog only shows progress and cancels
+        exportDlg = new QProgressDialog(tr("Exporting audio..."), tr("Cancel"), 0, 100, this);
+        exportDlg->setWindowModality(Qt::NonModal);
+        exportDlg->setAutoClose(false);
+        exportDlg->setAutoReset(false);
+        connect(exportDlg, &QProgressDialog::canceled, this, &MainWindow::cancelExport);
+        exportDlg->show();
+    }
+
+    exportDlg->setValue(percent);
+}
+
+void MainWindow::onExportFinished(bool success)
+{
+    Q_UNUSED(success) // already logged by controller
+
+    if (exportDlg)
+    {
+        exportDlg->deleteLater();
+        exportDlg = nullptr;
+    }
+}
+
 void MainWindow::notesVScrolled(int delta)
 {
     if (delta > 0 && vscr->value() > 0) // scroll up
@@ -743,13 +868,29 @@ void MainWindow::onPlaybackState(EAudioPlayback state)
         ui->actionStop->setEnabled(true);
         ui->actionBack->setEnabled(true);
         ui->actionRepeat->setEnabled(true);
+        ui->actionRepeat->setChecked(state == EAudioPlayback::repeating); // so its next trigger says whether loop is turned on
         ui->actionSave_audio_as->setEnabled(true);
+        playheadTimer->start();
+        statsTimer->start();
+        levelBar->setActive(true);
+        trackLevels[0]->setActive(true);
+        trackLevels[1]->setActive(true);
         break;
 
     case EAudioPlayback::stopped:
         ui->actionPlay->setChecked(false);
         ui->actionRepeat->setChecked(false);
+        playheadTimer->stop();
+        noteEditor->setPlayhead(-1);
+        levelBar->clear();
+        trackLevels[0]->clear();
+        trackLevels[1]->clear();
     case EAudioPlayback::paused:
+        statsTimer->stop();
+        onStatsTimer(); // last values stay visible until next playback
+        levelBar->setActive(false);
+        trackLevels[0]->setActive(false);
+        trackLevels[1]->setActive(false);
         ui->actionPlay->setIcon(QIcon(c_icon_play));
         ui->actionPlay->setText(tr("Play"));
         ui->actionSave_audio_as->setEnabled(true);
@@ -760,6 +901,45 @@ void MainWindow::onPlaybackState(EAudioPlayback state)
     }
 }
 
+void MainWindow::onPlayheadTimer()
+{
+    if (playhead)
+    {
+        // frames to pulses at session tempo, like mixer places the score, then c_midi_ppq pulses per note width
+        const SPlayheadSample s = playhead->sample();
+        const qint64 pulses = controller->framesToPulses(playhead->frameNow(), s.sampleRate);
+        noteEditor->setPlayhead((int)(pulses * ns.note.width() / c_midi_ppq));
+    }
+
+    if (doc && doc->playbackState() == EAudioPlayback::paused)
+        playheadTimer->stop(); // it was moved to where playback was paused
+}
+
+void MainWindow::onStatsTimer()
+{
+    if (controller)
+    {
+        const SAudioStats cb  = controller->getCallbackStats();
+        const SAudioStats mix = controller->getMixStats();
+
+        audioStatsLbl->setText(tr("Audio: %1 late of %2 blocks, %3 underruns, max load %4% (mixing %5%)")
+                               .arg(cb.late).arg(cb.blocks).arg(cb.underruns)
+                               .arg(qRound(cb.maxLoad * 100)).arg(qRound(mix.maxLoad * 100)));
+    }
+}
+
+void MainWindow::onRepeat(bool on)
+{
+    if (on)
+    {
+        qint64 start = 0, end = 0;
+        noteEditor->selectionPulses(start, end);
+        emit loopRegion(start, end); // empty one if nothing's selected
+    }
+
+    doc->repeatPlayback();
+}
+
 void MainWindow::onUndo()
 {
     if (doc->canUndo())
@@ -1014,6 +1194,7 @@ void MainWindow::onVocalAudioChanged()
     }
 
     vocalWave->setAudio(doc->getVocal().vocalWave);
+    setTrackMeters();
 }
 
 void MainWindow::onMusicAudioChanged()
@@ -1030,6 +1211,41 @@ void MainWindow::onMusicAudioChanged()
     }
 
     musicWave->setAudio(doc->getMusic().musicWave);
+    setTrackMeters();
+}
+
+void MainWindow::setTrackMeters()
+{
+    // player's copies of session sources share their mixing parameters, meters included
+    qtauAudioSource *sources[2] = { doc->getVocal().vocalWave, doc->getMusic().musicWave };
+
+    for (int i = 0; i < 2; ++i)
+    {
+        trackParams[i] = sources[i] ? sources[i]->getMixParams() : QSharedPointer<qtauMixParams>();
+        trackLevels[i]->setMeter(trackParams[i] ? &trackParams[i]->levels : nullptr, false);
+    }
+}
+
+void MainWindow::onTrackMixChanged()
+{
+    for (int i = 0; i < 2; ++i)
+        trackMute[i]->setIcon(QIcon(trackMute[i]->isChecked() ? c_icon_mute : c_icon_sound));
+
+    if (doc)
+    {
+        qtauSession::VocalWaveSetup &v = doc->getVocal();
+        qtauSession::MusicWaveSetup &m = doc->getMusic();
+
+        v.volume = trackVolume[0]->value() / 100.f;
+        v.pan    = trackPan   [0]->value() / 100.f;
+        v.muted  = trackMute  [0]->isChecked();
+
+        m.volume = trackVolume[1]->value() / 100.f;
+        m.pan    = trackPan   [1]->value() / 100.f;
+        m.muted  = trackMute  [1]->isChecked();
+
+        doc->mixSetupWasModified();
+    }
 }
 
 void MainWindow::dragEnterEvent(QDragEnterEvent *event)
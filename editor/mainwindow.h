@@ -5,6 +5,7 @@
 
 #include <QMainWindow>
 #include <QUrl>
+#include <QSharedPointer>
 
 #include "Utils.h"
 #include "utauloid/ust.h"
@@ -15,18 +16,25 @@ class qtauEvent;
 class qtauPiano;
 class qtauNoteEditor;
 class qtauMeterBar;
+class qtauLevelBar;
 class qtauDynDrawer;
 class qtauDynLabel;
 class qtauWaveform;
+class qtauPlayhead;
+class qtauMixParams;
 
 class QAction;
 class QScrollBar;
 class QSlider;
+class QToolButton;
 class QToolBar;
 class QTabWidget;
 class QTextEdit;
 class QToolBar;
 class QSplitter;
+class QProgressDialog;
+class QTimer;
+class QLabel;
 
 
 namespace Ui {
@@ -50,6 +58,8 @@ signals:
     void loadUST  (QString fileName);
     void saveUST  (QString fileName, bool rewrite);
     void saveAudio(QString fileName, bool rewrite);
+    void cancelExport();
+    void loopRegion(qint64 startPulse, qint64 endPulse);
 
     void loadAudio(QString fileName);
     void setVolume(int);
@@ -76,6 +86,7 @@ public slots:
 
     void onPlaybackState(EAudioPlayback);
     void onMute(bool m);
+    void onTrackMixChanged(); // any of vocal/music volume, pan or mute controls
 
     void onUndo();
     void onRedo();
@@ -100,6 +111,11 @@ public slots:
     void onDocEvent(qtauEvent*);
 
     void onSaveAudioAs();
+    void onExportProgress(int percent);
+    void onExportFinished(bool success);
+    void onPlayheadTimer(); // moves playhead in editor at display rate while playing
+    void onStatsTimer();    // shows audio timing stats in status bar while playing
+    void onRepeat(bool on);  // loops selected notes, or whole score if nothing is selected
 
 protected:
     qtauSession    *doc;
@@ -125,8 +141,25 @@ protected:
     QSlider        *zoom;
     QSlider        *volume;
     QAction        *muteBtn;
+    qtauLevelBar   *levelBar; // master levels, polled while playing
+
+    QToolButton    *trackMute  [2]; // vocal and music, in rows next to their waveforms
+    QSlider        *trackVolume[2];
+    QSlider        *trackPan   [2];
+    qtauLevelBar   *trackLevels[2]; // polled while playing like master one
+    QSharedPointer<qtauMixParams> trackParams[2]; // keeps meters shown by trackLevels alive
+
+    void setTrackMeters(); // after session's vocal or music source is set
 
     QTextEdit      *logpad;
+    QProgressDialog *exportDlg; // shown while audio is exported, not modal
+
+    const qtauPlayhead *playhead; // polled, audio thread doesn't send anything to window
+    QTimer             *playheadTimer;
+
+    const qtauController *controller; // audio stats are polled from it too
+    QLabel             *audioStatsLbl;
+    QTimer             *statsTimer;
 
     QList<QToolBar*> toolbars;
     void enableToolbars(bool enable = true);
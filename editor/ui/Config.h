@@ -24,6 +24,7 @@ const unsigned int cdef_color_selrect           = 0xff00857d;
 const unsigned int cdef_color_selrect_bg        = 0x2200857d;
 
 const unsigned int cdef_color_snap_line         = 0xaa3effab;
+const unsigned int cdef_color_playhead          = 0xffff6a00;
 
 const unsigned int cdef_color_piano_lbl_wh      = 0xff000000; // colors for white and black key lablels
 const unsigned int cdef_color_piano_lbl_wh_on   = 0xff00857d;
@@ -32,6 +33,13 @@ const unsigned int cdef_color_piano_lbl_bl_on   = 0xffeafffe;
 
 const unsigned int cdef_color_logtab_err        = 0xffff0000;
 
+const unsigned int cdef_color_level_low         = 0xff3ec66a; // level meter zones: below warn, warn to hot, above
+const unsigned int cdef_color_level_warn        = 0xffe8c53a;
+const unsigned int cdef_color_level_hot         = 0xffff6a00;
+const unsigned int cdef_color_level_peak        = 0xffeafffe;
+const unsigned int cdef_color_level_clip        = 0xffff0000;
+const unsigned int cdef_color_level_clip_off    = 0xff444444;
+
 const QString      cdef_color_dynbtn_off        = "#b7b7b7"; // CSS color
 const QString      cdef_color_dynbtn_bg         = "#77ded8"; // background graph button color
 const QString      cdef_color_dynbtn_on         = "#00857d"; // foreground graph button color
@@ -76,8 +84,10 @@ namespace qne {
 
         QRect selectionRect;
         int snapLine;
+        int playLine; // playback position, -1 if hidden
 
-        _editorState() : rmbScrollEnabled(true), editingEnabled(false), gridSnapEnabled(true), snapLine(-1) {}
+        _editorState() : rmbScrollEnabled(true), editingEnabled(false), gridSnapEnabled(true), snapLine(-1),
+            playLine(-1) {}
     } editorState;
 }
 
@@ -0,0 +1,138 @@
+/* levelBar.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#include "ui/levelBar.h"
+#include "ui/Config.h"
+
+#include <qevent.h>
+#include <QPainter>
+#include <QTimer>
+#include <QToolTip>
+
+const int   c_levelbar_update_ms = 33; // meters don't need full display rate
+const float c_levelbar_min_db    = -60.f;
+const float c_levelbar_max_db    = 3.f;
+const float c_levelbar_warn_db   = -18.f;
+const float c_levelbar_hot_db    = -6.f;
+const int   c_levelbar_clip_w    = 6;  // clip indicator at the right end
+
+
+qtauLevelBar::qtauLevelBar(QWidget *parent) :
+    QWidget(parent), meter(nullptr), master(true), timer(new QTimer(this))
+{
+    timer->setInterval(c_levelbar_update_ms);
+    connect(timer, &QTimer::timeout, this, &qtauLevelBar::onTimer);
+}
+
+bool qtauLevelBar::event(QEvent *e)
+{
+    if (e->type() == QEvent::ToolTip) // numbers of the moment when tooltip is asked for
+    {
+        QHelpEvent *he = static_cast<QHelpEvent*>(e);
+        QString text = tr("Peak %1 / %2 dB, RMS %3 / %4 dB\n")
+                .arg(SLevels::toDB(shown.peakL), 0, 'f', 1).arg(SLevels::toDB(shown.peakR), 0, 'f', 1)
+                .arg(SLevels::toDB(shown.rmsL),  0, 'f', 1).arg(SLevels::toDB(shown.rmsR),  0, 'f', 1);
+
+        if (master)
+            text += tr("True peak %1 dBTP, ").arg(SLevels::toDB(shown.truePeak), 0, 'f', 1);
+
+        text += tr("max %1 dB, %2 clipped blocks\nClick to reset max and clipping")
+                .arg(SLevels::toDB(shown.maxPeak), 0, 'f', 1).arg(shown.clips);
+
+        QToolTip::showText(he->globalPos(), text, this);
+        return true;
+    }
+
+    return QWidget::event(e);
+}
+
+QSize qtauLevelBar::sizeHint() const
+{
+    return QSize(120, 16);
+}
+
+void qtauLevelBar::setActive(bool on)
+{
+    if (on) timer->start();
+    else    timer->stop();
+}
+
+void qtauLevelBar::clear()
+{
+    shown = SLevels();
+    update();
+}
+
+void qtauLevelBar::onTimer()
+{
+    if (meter)
+    {
+        shown = meter->levels();
+        update();
+    }
+}
+
+int qtauLevelBar::dbToX(float db, int width) const
+{
+    const float k = (qBound(c_levelbar_min_db, db, c_levelbar_max_db) - c_levelbar_min_db) /
+                    (c_levelbar_max_db - c_levelbar_min_db);
+    return qRound(k * width);
+}
+
+void qtauLevelBar::paintEvent(QPaintEvent *)
+{
+    QPainter p(this);
+    const int w    = width() - c_levelbar_clip_w - 1;
+    const int rowH = height() / 2;
+
+    p.fillRect(rect(), QColor(cdef_color_black_key_bg));
+
+    const int warnX = dbToX(c_levelbar_warn_db, w);
+    const int hotX  = dbToX(c_levelbar_hot_db,  w);
+    const int zeroX = dbToX(0, w);
+
+    const float rms [2] = { shown.rmsL,  shown.rmsR  };
+    const float peak[2] = { shown.peakL, shown.peakR };
+
+    for (int ch = 0; ch < 2; ++ch)
+    {
+        const int y = ch * rowH + 1;
+        const int h = rowH - 2;
+        const int x = dbToX(SLevels::toDB(rms[ch]), w);
+
+        // RMS bar colored by zones, sample peak is a mark after it
+        p.fillRect(QRect(0,     y, qMin(x, warnX),                 h), QColor(cdef_color_level_low));
+        p.fillRect(QRect(warnX, y, qMax(qMin(x, hotX) - warnX, 0), h), QColor(cdef_color_level_warn));
+        p.fillRect(QRect(hotX,  y, qMax(x - hotX, 0),              h), QColor(cdef_color_level_hot));
+
+        const int px = dbToX(SLevels::toDB(peak[ch]), w);
+
+        if (peak[ch] > 0)
+            p.fillRect(QRect(qMax(px - 1, 0), y, 2, h), QColor(cdef_color_level_peak));
+    }
+
+    p.setPen(QColor(cdef_color_inner_line));
+    p.drawLine(zeroX, 0, zeroX, height());
+
+    if (master && shown.truePeak > 0) // inter-sample peak of both sides
+    {
+        const int tx = dbToX(SLevels::toDB(shown.truePeak), w);
+        p.setPen(QColor(cdef_color_playhead));
+        p.drawLine(tx, 0, tx, height());
+    }
+
+    // true peak over full scale is clipping somewhere between samples after conversion, even if samples aren't
+    const bool over = shown.clips > 0 || shown.maxPeak > 1.f;
+    p.fillRect(QRect(w + 1, 1, c_levelbar_clip_w, height() - 2), QColor(over ? cdef_color_level_clip : cdef_color_level_clip_off));
+}
+
+void qtauLevelBar::mousePressEvent(QMouseEvent *event)
+{
+    if (meter)
+        meter->reset();
+
+    shown.maxPeak = 0;
+    shown.clips   = 0;
+    update();
+
+    event->accept();
+}
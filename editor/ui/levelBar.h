@@ -0,0 +1,43 @@
+/* levelBar.h from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
+
+#ifndef LEVELBAR_H
+#define LEVELBAR_H
+
+#include "audio/Levels.h"
+#include <QWidget>
+
+class QTimer;
+
+
+/* Stereo level meter of master bus or of one track: RMS bars with sample peak marks, true peak (master only)
+ * and clipping on the right. Polls lock-free levels published by mixer at display rate while active,
+ * click resets held peak and clips. */
+class qtauLevelBar : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit qtauLevelBar(QWidget *parent = 0);
+
+    void setMeter(const qtauLevelMeter *m, bool isMaster = true) { meter = m; master = isMaster; }
+    void setActive(bool on); // polling, inactive bar keeps showing last levels
+    void clear();            // shows silence
+
+    QSize sizeHint() const override;
+
+protected:
+    bool event          (QEvent      *e)     override;
+    void paintEvent     (QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+
+    const qtauLevelMeter *meter;
+    bool     master; // tracks have no true peak measured
+    QTimer  *timer;
+    SLevels  shown;
+
+    void onTimer();
+    int  dbToX(float db, int width) const;
+
+};
+
+#endif // LEVELBAR_H
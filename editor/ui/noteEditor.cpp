@@ -260,6 +260,40 @@ void qtauNoteEditor::setHOffset(int hoff)
     }
 }
 
+void qtauNoteEditor::setPlayhead(int x)
+{
+    if (x != state.playLine)
+    {
+        const int vx = state.viewport.x();
+
+        if (state.playLine > -1)
+            update(state.playLine - vx - 1, 0, 3, height());
+
+        state.playLine = x;
+
+        if (x > -1)
+            update(x - vx - 1, 0, 3, height());
+    }
+}
+
+bool qtauNoteEditor::selectionPulses(qint64 &start, qint64 &end) const
+{
+    start = 0;
+    end   = 0;
+
+    for (int i = 0; i < notes.selected.size(); ++i)
+    {
+        const qne::editorNote n = notes.idMap.value(notes.selected[i]);
+
+        if (i == 0 || n.pulseOffset < start)
+            start = n.pulseOffset;
+
+        end = qMax(end, (qint64)n.pulseOffset + n.pulseLength);
+    }
+
+    return end > start;
+}
+
 QPoint qtauNoteEditor::scrollTo(const QRect &r)
 {
     QPoint result = state.viewport.topLeft();
@@ -397,6 +431,15 @@ void qtauNoteEditor::paintEvent(QPaintEvent *event)
         p.drawLine(state.snapLine, vSt, state.snapLine, vSt + state.viewport.height());
     }
 
+    if (state.playLine > -1)
+    {
+        QPen pen = p.pen();
+        pen.setWidth(1);
+        pen.setColor(QColor(cdef_color_playhead));
+        p.setPen(pen);
+        p.drawLine(state.playLine, vSt, state.playLine, vSt + state.viewport.height());
+    }
+
     updateCalled = false;
 }
 
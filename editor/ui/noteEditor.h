@@ -37,6 +37,10 @@ public:
     void   setHOffset(int hoff);
     QPoint scrollTo  (const QRect &r);
 
+    void   setPlayhead(int x); // in pixels from start of score, -1 hides it. Repaints only old and new lines
+
+    bool   selectionPulses(qint64 &start, qint64 &end) const; // span of selected notes, false if none
+
     void setRMBScrollEnabled(bool e) { state.rmbScrollEnabled  = e; }
     void setEditingEnabled  (bool e) { state.editingEnabled    = e; }
     void setGridSnapEnabled (bool e) { state.gridSnapEnabled   = e; }
@@ -72,7 +72,7 @@ void qtauWaveform::updateCache()
 
     bgCache->fill(QColor(255,255,255,255));
 
-    if (wave && !wave->data().isEmpty())
+    if (wave && wave->size() > 0)
     {
         const QAudioFormat &fmt = wave->getAudioFormat();
 
@@ -91,6 +91,22 @@ void qtauWaveform::updateCache()
 
         if (smpOff < totalSamples) // if waveform is visible at all
         {
+            // samples are counted from smpBase: whole buffer, or only visible part of streamed audio
+            const char *samples = wave->data().constData();
+            int smpBase = 0;
+
+            if (wave->data().isEmpty())
+            {
+                const int    chans      = qMax(fmt.channelCount(), 1);
+                const qint64 frameBytes = qMax(fmt.bytesPerFrame(), 1);
+                qint64 got = 0;
+
+                smpBase = smpOff / chans * chans;
+                wave->seek(smpBase / chans * frameBytes);
+                samples = wave->readPcm(((qint64)(fW * samplesPerPixel) / chans + 1) * frameBytes, got);
+                totalSamples = qMin(totalSamples, smpBase + (int)(got * 8 / fmt.sampleSize()));
+            }
+
             int smpSt  = smpOff;
             int smpEnd = smpSt;
 
@@ -110,14 +126,16 @@ void qtauWaveform::updateCache()
 
                 float hiVal = -10.f;
                 float loVal =  10.f;
+                int st  = smpSt  - smpBase;
+                int end = smpEnd - smpBase;
 
                 switch (sampType) // hoping that compiler will optimize const var + inline
                 {
-                case QAudioFormat::UnSignedInt: cycleU8 (smpSt, smpEnd, hiVal, loVal, (quint8*)wave->data().data());
+                case QAudioFormat::UnSignedInt: cycleU8 (st, end, hiVal, loVal, (const quint8*)samples);
                     break;
-                case QAudioFormat::SignedInt:   cycleS16(smpSt, smpEnd, hiVal, loVal, (qint16*)wave->data().data());
+                case QAudioFormat::SignedInt:   cycleS16(st, end, hiVal, loVal, (const qint16*)samples);
                     break;
-                case QAudioFormat::Float:       cycleF32(smpSt, smpEnd, hiVal, loVal, (float*) wave->data().data());
+                case QAudioFormat::Float:       cycleF32(st, end, hiVal, loVal, (const float*) samples);
                     break;
                 default:
                     vsLog::e("Waveform can't update cache because of unknown sample format of wave!");